@@ -1058,11 +1058,8 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 					p = NULL;
 					b->syn = NULL; /* So that autoprefs will load the right syntax. */
 					if (b->opt.auto_prefs) {
-						if (b->allocated_chars - b->free_chars <= MAX_SYNTAX_SIZE) {
-							if (load_auto_prefs(b, NULL) == HAS_NO_EXTENSION) load_auto_prefs(b, DEF_PREFS_NAME);
-							reset_syntax_states(b);
-						}
-						else if (error == OK) error = FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_DISABLED;
+						if (load_auto_prefs(b, NULL) == HAS_NO_EXTENSION) load_auto_prefs(b, DEF_PREFS_NAME);
+						reset_syntax_states(b);
 					}
 					buffer * old_buffer = (buffer *)cur_buffer->b_node.prev;
 					/* preserve cur_macro, find_string, and replace_string */
@@ -1111,7 +1108,9 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 
 	case FIND_A:
 	case FINDREGEXP_A:
-		if (p || (p = request_string(b, a == FIND_A ? "Find" : "Find RegExp", b->find_string, false, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
+		if (p || (p = a == FIND_A && inc_find
+				? request_incremental_find(b, "Find", b->find_string, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto)
+				: request_string(b, a == FIND_A ? "Find" : "Find RegExp", b->find_string, false, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
 
 			const encoding_type encoding = detect_encoding(p, strlen(p));
 
@@ -1131,6 +1130,12 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 
 		return error ? ERROR : 0;
 
+	case FINDANY_A:
+		print_error(error = find_any(b, p));
+		free(p);
+		if (error == NOT_FOUND) perform_wrap = 2;
+		return error ? ERROR : 0;
+
 	case REPLACE_A:
 	case REPLACEONCE_A:
 	case REPLACEALL_A:
@@ -1175,7 +1180,22 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 
 				if (a == REPLACEALL_A) start_undo_chain(b);
 
-				while(!stop &&
+				/* Forward ReplaceAll uses the batched engine, which gathers all
+				   occurrences in a line and updates the display just once. */
+				if (a == REPLACEALL_A && !b->opt.search_back) {
+					if (!(error = (b->last_was_regexp ? find_regexp : find)(b, NULL, false, false))) {
+						/* We delay buffer encoding promotion until it is really necessary. */
+						if (b->encoding == ENC_ASCII) b->encoding = replace_encoding;
+						first_search = false;
+						error = replace_all(b, p, &num_replace);
+						if (error != NOT_FOUND && error != STOPPED) {
+							end_undo_chain(b);
+							print_error(error);
+							return ERROR;
+						}
+					}
+				}
+				else while(!stop &&
 						!(error = (b->last_was_regexp ? find_regexp : find)(b, NULL, !first_search && a != REPLACEALL_A && c != 'A' && c != 'Y', false))) {
 
 					if (c != 'A' && a != REPLACEALL_A && a != REPLACEONCE_A) {
@@ -1314,6 +1334,34 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		if (error == NOT_FOUND) perform_wrap = 2;
 		return num_replace && error ? ERROR : error;
 
+	case GREP_A:
+		/* If the path is specified, we use the current search string, if any. */
+		if (!p || !b->find_string) {
+			if (!(q = request_string(b, b->last_was_regexp ? "Grep RegExp" : "Grep", b->find_string, false, COMPLETE_NONE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
+				free(p);
+				return ERROR;
+			}
+			free(b->find_string);
+			b->find_string = q;
+			b->find_string_changed = 1;
+		}
+
+		if (p || (p = request_string(b, "Grep in", ".", false, COMPLETE_FILE, b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && b->opt.utf8auto))) {
+			int64_t num_hits, num_files;
+			error = grep(b, p, &num_hits, &num_files);
+			free(p);
+			if (num_hits) {
+				snprintf(msg, MAX_MESSAGE_SIZE, "%" PRId64 " hit%s in %" PRId64 " file%s.%s", num_hits, num_hits > 1 ? "s" : "", num_files, num_files > 1 ? "s" : "", error == STOPPED ? " (stopped)" : "");
+				print_message(msg);
+			}
+			else print_error(error);
+			return error ? ERROR : OK;
+		}
+		return ERROR;
+
+	case OPENHIT_A:
+		return print_error(open_hit(b)) ? ERROR : OK;
+
 	case MATCHBRACKET_A:
 		return print_error(match_bracket(b)) ? ERROR : 0;
 
@@ -1395,6 +1443,10 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		reset_status_bar();
 		return OK;
 
+	case INCREMENTALFIND_A:
+		SET_GLOBAL_FLAG(c, inc_find);
+		return OK;
+
 	case INSERT_A:
 		SET_USER_FLAG(b, c, opt.insert);
 		return OK;
@@ -1482,6 +1534,12 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		b->find_string_changed = 1;
 		return OK;
 
+	case SEARCHINDEX_A:
+		SET_GLOBAL_FLAG(c, search_index);
+		if (!search_index)
+			for(buffer *bb = (buffer *)buffers.head; bb->b_node.next; bb = (buffer *)bb->b_node.next) free_trigram_index(bb);
+		return OK;
+
 	case ATOMICUNDO_A:
 		if (b->opt.do_undo) {
 			/* set c to the desired b->link_undos */
@@ -1890,6 +1948,37 @@ int do_action(buffer *b, action a, int64_t c, char *p) {
 		}
 		return ERROR;
 
+	case SYNTAXSTATS_A:
+		if (!do_syntax) return SYNTAX_NOT_ENABLED;
+		if (c == 0 || !syntax_stats) {
+			reset_syntax_stats();
+			syntax_stats = c != 0;
+			print_message(syntax_stats ? "Syntax profiling started." : "Syntax profiling stopped.");
+			return OK;
+		}
+		else {
+			char *s;
+			size_t len;
+			FILE * const f = open_memstream(&s, &len);
+			if (!f) return print_error(OUT_OF_MEMORY) ? ERROR : OK;
+			print_syntax_stats(f, c < 0 ? SYNTAX_STATS_STATES : c);
+			if (fclose(f)) return print_error(OUT_OF_MEMORY) ? ERROR : OK;
+
+			/* Lines are separated by NULs in streams; we drop the last newline. */
+			for(size_t i = 0; i < len; i++) if (s[i] == '\n') s[i] = 0;
+			buffer * const r = new_buffer();
+			if (r) {
+				const bool do_undo = r->opt.do_undo;
+				r->opt.do_undo = 0;
+				insert_stream(r, (line_desc *)r->line_desc_list.head, 0, 0, s, len - 1);
+				r->opt.do_undo = do_undo;
+				r->is_modified = false;
+			}
+			free(s);
+			reset_window();
+			return r ? OK : print_error(OUT_OF_MEMORY) ? ERROR : OK;
+		}
+
 	case ESCAPE_A:
 		handle_menus();
 		return OK;
@@ -0,0 +1,333 @@
+/* Aho-Corasick multi-pattern search for alternations of literals.
+
+   Copyright (C) 2026 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+
+/* A regular expression that is just an alternation of literal strings (e.g.,
+   "foo|bar|baz", or the expressions built by FindAny from a list of words) is
+   handled badly by the regex library: compilation time grows quickly with the
+   number of alternatives (thousands of words take seconds), and matching
+   time grows linearly with it. The functions in this file recognise such
+   expressions, and compile them into an Aho-Corasick automaton, which finds
+   the leftmost-longest match (or, searching backwards, the rightmost-longest
+   match) in a single pass over the text, independently of the number of
+   alternatives.
+
+   Bytes are first folded using the translation table (if any) and then
+   mapped to a small number of classes (one for each byte appearing in the
+   patterns, plus one for all other bytes). The trie built from the patterns
+   is laid out in breadth-first order, so that failure links always point to
+   earlier states. The first states (which, being the shallowest, are those
+   visited most frequently) have a dense transition table containing the
+   complete automaton transitions; the other states have a sorted list of
+   trie edges, and follow failure links until a dense state is reached. */
+
+
+/* The maximum number of entries in the dense transition table. */
+
+#define AC_DENSE_ENTRIES (1 << 18)
+
+typedef struct {
+	int32_t fail;       /* The longest proper suffix that is a state. */
+	int32_t depth;      /* The length of the string of the state. */
+	int32_t match_len;  /* The length of the longest pattern that is a suffix of the string of the state, or 0. */
+	int32_t dict;       /* The longest proper suffix that is a pattern, or -1. */
+	int32_t edges;      /* The index of the first edge; the last one precedes the first edge of the next state. */
+} ac_state;
+
+struct aho_corasick {
+	int num_states, num_dense, num_classes;
+	unsigned char map[256];        /* From bytes to classes. */
+	ac_state *state;               /* num_states + 1 states (the last one is a sentinel). */
+	unsigned char *edge_class;
+	int32_t *edge_to;
+	int32_t *dense;                /* num_dense rows of num_classes transitions. */
+};
+
+/* A node of the trie used during construction. Children are kept in
+   increasing class order. */
+
+typedef struct {
+	int32_t first_child, last_child, next_sibling;
+	unsigned char class;
+	bool terminal;
+} trie_node;
+
+typedef struct {
+	const unsigned char *s;
+	int len;
+} ac_pattern;
+
+
+static int pattern_cmp(const void *a, const void *b) {
+	const ac_pattern * const p = a, * const q = b;
+	const int c = memcmp(p->s, q->s, min(p->len, q->len));
+	return c ? c : p->len - q->len;
+}
+
+
+/* Splits regex into its alternatives, storing the unescaped, folded bytes in
+   buf (which must be as long as regex) and the patterns in pattern. Returns
+   the number of patterns, or 0 if regex is not an alternation of at least two
+   nonempty literal strings. */
+
+static int parse_alternation(const char *regex, unsigned char * const buf, ac_pattern * const pattern, const unsigned char * const translate, const bool ascii_only) {
+	unsigned char *q = buf;
+	int n = 0;
+
+	for(;;) {
+		const unsigned char * const start = q;
+		for(; *regex && *regex != '|' && *regex != '\n'; regex++) {
+			unsigned char c = *regex;
+			if (c == '\\') {
+				c = *++regex;
+				if (!c || !strchr("\\.[]*+?^$()|{}", c)) return 0;
+			}
+			else if (strchr(".[]*+?^$()", c)) return 0;
+			if (ascii_only && c >= 0x80) return 0;
+			*q++ = translate ? translate[c] : c;
+		}
+
+		if (q == start) return 0;
+		pattern[n].s = start;
+		pattern[n++].len = q - start;
+		if (!*regex++) break;
+	}
+
+	return n > 1 ? n : 0;
+}
+
+
+/* Returns the child of trie node n with the given class, or -1. */
+
+static int32_t trie_child(const trie_node * const t, const int32_t n, const int class) {
+	for(int32_t k = t[n].first_child; k >= 0 && t[k].class <= class; k = t[k].next_sibling)
+		if (t[k].class == class) return k;
+	return -1;
+}
+
+
+/* Compiles regex into an Aho-Corasick automaton, if it is an alternation of
+   literal strings. translate, if not NULL, is used to fold case; if ascii_only
+   is true, patterns containing non-US-ASCII characters are not compiled (this
+   is necessary when the regex library folds case in UTF-8 text). Returns NULL
+   if regex is not suitable or if there is not enough memory. */
+
+struct aho_corasick *alloc_aho_corasick(const char * const regex, const unsigned char * const translate, const bool ascii_only) {
+	const size_t regex_len = strlen(regex);
+	int max_patterns = 1;
+	for(const char *p = regex; *p; p++) if (*p == '|' || *p == '\n') max_patterns++;
+	if (max_patterns < 2 || regex_len >= INT32_MAX) return NULL;
+
+	struct aho_corasick *ac = NULL;
+	unsigned char * const buf = malloc(regex_len + 1);
+	ac_pattern * const pattern = malloc(max_patterns * sizeof *pattern);
+	trie_node *t = NULL;
+	int32_t *order = NULL, *id = NULL, *fail = NULL, *depth = NULL;
+	int n;
+
+	if (!buf || !pattern || !(n = parse_alternation(regex, buf, pattern, translate, ascii_only))) goto done;
+
+	if (!(ac = calloc(1, sizeof *ac))) goto done;
+
+	/* Classes are assigned in increasing byte order, so sorting the patterns
+		by bytes sorts them by classes, too. */
+	bool used[256] = { false };
+	for(int i = 0; i < n; i++)
+		for(int j = 0; j < pattern[i].len; j++) used[pattern[i].s[j]] = true;
+
+	unsigned char class_of[256];
+	ac->num_classes = 1;
+	for(int c = 0; c < 256; c++) class_of[c] = used[c] ? ac->num_classes++ : 0;
+	for(int c = 0; c < 256; c++) ac->map[c] = class_of[translate ? translate[c] : c];
+
+	qsort(pattern, n, sizeof *pattern, pattern_cmp);
+
+	/* We build the trie. Since patterns are sorted, a pattern either follows
+		the last child of a node, or adds a new last child. */
+	int32_t num_nodes = 1;
+	if (!(t = malloc((regex_len + 1) * sizeof *t))) goto fail;
+	t[0] = (trie_node){ -1, -1, -1, 0, false };
+
+	for(int i = 0; i < n; i++) {
+		int32_t v = 0;
+		for(int j = 0; j < pattern[i].len; j++) {
+			const unsigned char c = class_of[pattern[i].s[j]];
+			const int32_t k = t[v].last_child;
+			if (k >= 0 && t[k].class == c) v = k;
+			else {
+				t[num_nodes] = (trie_node){ -1, -1, -1, c, false };
+				if (k >= 0) t[k].next_sibling = num_nodes;
+				else t[v].first_child = num_nodes;
+				v = t[v].last_child = num_nodes++;
+			}
+		}
+		t[v].terminal = true;
+	}
+
+	/* We lay out states in breadth-first order, and compute failure links and
+		depths (indexed by trie node). */
+	if (!(order = malloc(num_nodes * sizeof *order)) || !(id = malloc(num_nodes * sizeof *id))
+		|| !(fail = malloc(num_nodes * sizeof *fail)) || !(depth = malloc(num_nodes * sizeof *depth))
+		|| !(ac->state = malloc((num_nodes + 1) * sizeof *ac->state))
+		|| !(ac->edge_class = malloc(num_nodes * sizeof *ac->edge_class))
+		|| !(ac->edge_to = malloc(num_nodes * sizeof *ac->edge_to))) goto fail;
+
+	int32_t head = 0, tail = 0;
+	order[tail++] = 0;
+	fail[0] = depth[0] = 0;
+
+	while(head < tail) {
+		const int32_t u = order[head];
+		id[u] = head++;
+		for(int32_t v = t[u].first_child; v >= 0; v = t[v].next_sibling) {
+			int32_t w = -1;
+			if (u != 0)
+				for(int32_t f = fail[u]; (w = trie_child(t, f, t[v].class)) < 0 && f != 0;) f = fail[f];
+			fail[v] = w >= 0 ? w : 0;
+			depth[v] = depth[u] + 1;
+			order[tail++] = v;
+		}
+	}
+
+	/* Now we compute the states. The failure state of a state precedes it, so
+		its data is already available. */
+	ac->num_states = num_nodes;
+	int32_t num_edges = 0;
+
+	for(int32_t i = 0; i < num_nodes; i++) {
+		const int32_t u = order[i];
+		ac_state * const s = &ac->state[i];
+
+		s->edges = num_edges;
+		for(int32_t v = t[u].first_child; v >= 0; v = t[v].next_sibling) {
+			ac->edge_class[num_edges] = t[v].class;
+			ac->edge_to[num_edges++] = id[v];
+		}
+
+		s->fail = id[fail[u]];
+		s->depth = depth[u];
+		if (i == 0) {
+			s->match_len = 0;
+			s->dict = -1;
+		}
+		else {
+			const ac_state * const f = &ac->state[s->fail];
+			s->match_len = t[u].terminal ? s->depth : f->match_len;
+			s->dict = f->depth && f->match_len == f->depth ? s->fail : f->dict;
+		}
+	}
+	ac->state[num_nodes].edges = num_edges;
+
+	/* Dense rows contain complete transitions: missing edges are resolved
+		using the (dense, as it precedes the state) row of the failure state. */
+	ac->num_dense = min(num_nodes, max(1, AC_DENSE_ENTRIES / ac->num_classes));
+	if (!(ac->dense = malloc((size_t)ac->num_dense * ac->num_classes * sizeof *ac->dense))) goto fail;
+
+	for(int32_t i = 0; i < ac->num_dense; i++) {
+		int32_t * const row = ac->dense + (size_t)i * ac->num_classes;
+		if (i == 0) memset(row, 0, ac->num_classes * sizeof *row);
+		else memcpy(row, ac->dense + (size_t)ac->state[i].fail * ac->num_classes, ac->num_classes * sizeof *row);
+		for(int32_t e = ac->state[i].edges; e < ac->state[i + 1].edges; e++) row[ac->edge_class[e]] = ac->edge_to[e];
+	}
+
+	goto done;
+
+	fail:
+	free_aho_corasick(ac);
+	ac = NULL;
+
+	done:
+	free(order);
+	free(id);
+	free(fail);
+	free(depth);
+	free(t);
+	free(pattern);
+	free(buf);
+	return ac;
+}
+
+
+void free_aho_corasick(struct aho_corasick * const ac) {
+	if (!ac) return;
+	free(ac->state);
+	free(ac->edge_class);
+	free(ac->edge_to);
+	free(ac->dense);
+	free(ac);
+}
+
+
+/* Returns the state reached from state s reading a byte of the given class. */
+
+static inline int32_t ac_next(const struct aho_corasick * const ac, int32_t s, const int class) {
+	while(s >= ac->num_dense) {
+		for(int32_t e = ac->state[s].edges; e < ac->state[s + 1].edges && ac->edge_class[e] <= class; e++)
+			if (ac->edge_class[e] == class) return ac->edge_to[e];
+		s = ac->state[s].fail;
+	}
+	return ac->dense[(size_t)s * ac->num_classes + class];
+}
+
+
+/* Searches for a pattern in the len bytes of s. Forward, finds the leftmost
+   match starting at or after start; backward, the rightmost match starting at
+   or before start (in both cases, the longest match starting there, as
+   re_search() does). Returns the starting position of the match, and stores
+   its end in *end, or returns -1 if there is no match. */
+
+int64_t aho_corasick_search(const struct aho_corasick * const ac, const char * const s, const int64_t len, const int64_t start, const bool back, int64_t * const end) {
+	const unsigned char * const map = ac->map;
+	int64_t best = -1;
+	int32_t q = 0;
+
+	if (!back) {
+		for(int64_t i = start; i < len; i++) {
+			q = ac_next(ac, q, map[(unsigned char)s[i]]);
+			const ac_state * const st = &ac->state[q];
+			/* No match can start before i + 1 - st->depth. */
+			if (best >= 0 && i + 1 - st->depth > best) break;
+			if (st->match_len && (best < 0 || i + 1 - st->match_len <= best)) {
+				best = i + 1 - st->match_len;
+				*end = i + 1;
+			}
+		}
+	}
+	else {
+		for(int64_t i = 0; i < len; i++) {
+			q = ac_next(ac, q, map[(unsigned char)s[i]]);
+			if (i + 1 - ac->state[q].depth > start) break;
+			/* We look, among the patterns ending here, for the last one
+				starting at or before start (patterns get shorter along the
+				dictionary chain). */
+			for(int32_t p = ac->state[q].match_len == ac->state[q].depth ? q : ac->state[q].dict; p > 0; p = ac->state[p].dict) {
+				const int64_t pos = i + 1 - ac->state[p].depth;
+				if (pos > start) break;
+				if (pos >= best) {
+					best = pos;
+					*end = i + 1;
+				}
+			}
+		}
+	}
+
+	return best;
+}
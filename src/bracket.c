@@ -0,0 +1,627 @@
+/* Bracket index for fast bracket matching.
+
+   Copyright (C) 2026 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+
+
+/* Finding the bracket matching a given one requires counting the brackets
+   of the same kind up to the match, which may be very far away. We keep for
+   pieces of text, and for each kind of bracket, a summary made of the
+   number of opening brackets minus the number of closing brackets (the
+   delta), and of the minimum of the same difference over all prefixes of
+   the piece (the minimum). A forward scan with depth n (the number of
+   opening brackets still to be closed) finds the match in a piece if and
+   only if n plus the minimum is nonpositive; otherwise, the piece can be
+   skipped and n increased by the delta. Backward scans use the minimum
+   minus the delta, which is the minimum over suffixes of the number of
+   closing brackets minus the number of opening brackets.
+
+   Summaries are kept at two levels. The lines of documents larger than
+   BRACKET_MIN_SIZE bytes are partitioned, when MatchBracket is first used,
+   into blocks of consecutive lines containing about BRACKET_BLOCK_SIZE
+   bytes, and each block has a summary. Moreover, lines of at least
+   BRACKET_MIN_LINE_LEN bytes are partitioned into chunks, each with a
+   summary; chunks are kept for the last BRACKET_LINES lines used, so that
+   automatch does not scan the whole line at each keystroke.
+
+   Since brackets are ASCII characters, they can be found by scanning bytes,
+   whatever the encoding. insert_stream() and delete_stream() just mark as
+   dirty the blocks and chunks they modify, shifting the following chunks;
+   summaries of dirty blocks and chunks are recomputed when they are needed.
+   If insert_stream() or delete_stream() fail halfway, the index is
+   discarded. */
+
+#define NUM_BRACKETS 5
+
+#define BRACKET_MIN_SIZE (1024 * 1024)
+
+/* The target size in bytes of a block. Blocks twice as large are split. */
+
+#define BRACKET_BLOCK_SIZE (64 * 1024)
+
+#define BRACKET_MIN_LINE_LEN (16 * 1024)
+
+/* The size in bytes of a chunk, when its summary is computed. */
+
+#define BRACKET_CHUNK_SIZE (4 * 1024)
+
+#define BRACKET_LINES 4
+
+typedef struct {
+	int64_t delta, min;
+} bracket_count;
+
+typedef struct {
+	line_desc *first;  /* The first line of the block. */
+	int64_t num_lines; /* The number of lines of the block. */
+	int64_t len;       /* An upper bound on the number of bytes of the block. */
+	bool dirty;        /* Whether count must be recomputed. */
+	bracket_count count[NUM_BRACKETS];
+} bracket_block;
+
+struct bracket_index {
+	bracket_block *block;
+	int64_t num_blocks, max_blocks;
+	int64_t hint, hint_line;  /* A block and its first line, from which blocks are located. */
+};
+
+typedef struct {
+	int64_t pos;       /* The position of the chunk in its line; a chunk ends where the next one starts. */
+	bool dirty;        /* Whether count must be recomputed (and the chunk split). */
+	bracket_count count[NUM_BRACKETS];
+} bracket_chunk;
+
+typedef struct {
+	const line_desc *ld;
+	int64_t line_len;       /* The length of the line described by the chunks. */
+	bracket_chunk *chunk;   /* The chunks; chunk[0].pos is always zero. */
+	int64_t num_chunks, size;
+} bracket_line;
+
+static bracket_line bracket_lines[BRACKET_LINES];
+
+/* The entry of bracket_lines[] to be used next if a line is not found. */
+
+static int next_entry;
+
+static const unsigned char bracket_table[NUM_BRACKETS][2] = { { '(', ')'  },
+                                                              { '[', ']'  },
+                                                              { '{', '}'  },
+                                                              { '<', '>'  },
+                                                              { '`', '\'' } };
+
+/* For each character, zero or one plus its bracket type (see bracket_type()). */
+
+static unsigned char type_plus_one[256];
+
+
+static void init_types(void) {
+	static bool initialized;
+	if (initialized) return;
+
+	for(int i = 0; i < NUM_BRACKETS; i++)
+		for(int j = 0; j < 2; j++) type_plus_one[bracket_table[i][j]] = 2 * i + j + 1;
+
+	initialized = true;
+}
+
+
+/* Returns the type of the given character, that is, twice the index of its
+   kind of bracket, plus one if it is a closing bracket, or -1 if the
+   character is not a bracket. */
+
+int bracket_type(const int c) {
+	init_types();
+	return type_plus_one[(unsigned char)c] - 1;
+}
+
+
+/* Computes the summaries of the len bytes starting at p. */
+
+static void count_brackets(const char * const p, const int64_t len, bracket_count * const count) {
+	init_types();
+	memset(count, 0, sizeof *count * NUM_BRACKETS);
+	for(int64_t i = 0; i < len; i++) {
+		const int t = type_plus_one[(unsigned char)p[i]] - 1;
+		if (t >= 0) {
+			bracket_count * const c = &count[t >> 1];
+			if (t & 1) {
+				if (--c->delta < c->min) c->min = c->delta;
+			}
+			else c->delta++;
+		}
+	}
+}
+
+
+/* Appends the summaries b to the summaries a. */
+
+static void add_counts(bracket_count * const a, const bracket_count * const b) {
+	for(int i = 0; i < NUM_BRACKETS; i++) {
+		if (a[i].delta + b[i].min < a[i].min) a[i].min = a[i].delta + b[i].min;
+		a[i].delta += b[i].delta;
+	}
+}
+
+
+/* Scans the bytes of line from start (inclusive) to end (exclusive), or
+   backwards if type is a closing bracket, updating the depth *n. Returns the
+   position at which the depth becomes zero, or -1. */
+
+static int64_t scan_brackets(const char * const line, const int64_t start, const int64_t end, const int type, int64_t * const n) {
+	const bool back = type & 1;
+	const char same = bracket_table[type >> 1][back], other = bracket_table[type >> 1][!back];
+
+	if (back) {
+		for(int64_t i = end; i-- > start;) {
+			if (line[i] == same) ++*n;
+			else if (line[i] == other && --*n == 0) return i;
+		}
+	}
+	else {
+		for(int64_t i = start; i < end; i++) {
+			if (line[i] == same) ++*n;
+			else if (line[i] == other && --*n == 0) return i;
+		}
+	}
+	return -1;
+}
+
+
+/* Returns whether a scan with depth n may find a match in a piece of text
+   with the given summary. Otherwise, the depth is updated as if the piece
+   had been scanned. */
+
+static bool may_match(const bracket_count * const c, const int type, int64_t * const n) {
+	if (type & 1) {
+		if (*n + c->min - c->delta <= 0) return true;
+		*n -= c->delta;
+	}
+	else {
+		if (*n + c->min <= 0) return true;
+		*n += c->delta;
+	}
+	return false;
+}
+
+
+
+static bracket_line *find_bracket_line(const line_desc * const ld) {
+	for(int i = 0; i < BRACKET_LINES; i++)
+		if (bracket_lines[i].ld == ld) return &bracket_lines[i];
+	return NULL;
+}
+
+
+/* Returns the chunks of the given line, creating a single dirty chunk if
+   necessary, or NULL if we run out of memory. */
+
+static bracket_line *get_bracket_line(const line_desc * const ld) {
+	bracket_line *e = find_bracket_line(ld);
+	if (e) return e;
+
+	e = &bracket_lines[next_entry];
+	if (!e->chunk) {
+		if (!(e->chunk = malloc(sizeof *e->chunk * 64))) return NULL;
+		e->size = 64;
+	}
+	next_entry = (next_entry + 1) % BRACKET_LINES;
+
+	e->ld = ld;
+	e->line_len = ld->line_len;
+	e->chunk[0].pos = 0;
+	e->chunk[0].dirty = true;
+	e->num_chunks = 1;
+	return e;
+}
+
+
+static inline int64_t chunk_end(const bracket_line * const e, const int64_t k) {
+	return k + 1 < e->num_chunks ? e->chunk[k + 1].pos : e->line_len;
+}
+
+
+/* Returns the index of the last chunk starting at or before pos. */
+
+static int64_t find_chunk(const bracket_line * const e, const int64_t pos) {
+	int64_t l = 0, r = e->num_chunks;
+	while(r - l > 1) {
+		const int64_t m = (l + r) / 2;
+		if (e->chunk[m].pos <= pos) l = m;
+		else r = m;
+	}
+	return l;
+}
+
+
+static void remove_chunks(bracket_line * const e, const int64_t k, const int64_t n) {
+	memmove(&e->chunk[k], &e->chunk[k + n], sizeof *e->chunk * (e->num_chunks - k - n));
+	e->num_chunks -= n;
+}
+
+
+/* Splits the dirty chunk k in chunks of BRACKET_CHUNK_SIZE bytes and
+   computes their summaries. Returns the number of chunks replacing chunk k
+   (zero if it was empty). If we run out of memory, the chunk is not split. */
+
+static int64_t clean_chunk(bracket_line * const e, const int64_t k) {
+	const int64_t start = e->chunk[k].pos, len = chunk_end(e, k) - start;
+	if (len == 0) {
+		if (e->num_chunks > 1) {
+			remove_chunks(e, k, 1);
+			if (k == 0) e->chunk[0].pos = 0;
+			return 0;
+		}
+		e->chunk[k].dirty = false;
+		memset(e->chunk[k].count, 0, sizeof e->chunk[k].count);
+		return 1;
+	}
+
+	int64_t p = (len + BRACKET_CHUNK_SIZE - 1) / BRACKET_CHUNK_SIZE;
+	if (e->num_chunks + p - 1 > e->size) {
+		int64_t size = e->size;
+		while(size < e->num_chunks + p - 1) size *= 2;
+		bracket_chunk * const chunk = realloc(e->chunk, sizeof *chunk * size);
+		if (chunk) {
+			e->chunk = chunk;
+			e->size = size;
+		}
+		else p = 1;
+	}
+
+	memmove(&e->chunk[k + p], &e->chunk[k + 1], sizeof *e->chunk * (e->num_chunks - k - 1));
+	e->num_chunks += p - 1;
+
+	for(int64_t i = 0; i < p; i++) {
+		bracket_chunk * const c = &e->chunk[k + i];
+		c->pos = start + i * BRACKET_CHUNK_SIZE;
+		c->dirty = false;
+		count_brackets(e->ld->line + c->pos, i == p - 1 ? start + len - c->pos : BRACKET_CHUNK_SIZE, c->count);
+	}
+
+	return p;
+}
+
+
+/* Computes the summaries of the given line. */
+
+static void count_line(const line_desc * const ld, bracket_count * const count) {
+	bracket_line * const e = ld->line_len >= BRACKET_MIN_LINE_LEN ? get_bracket_line(ld) : NULL;
+	if (!e) {
+		count_brackets(ld->line, ld->line_len, count);
+		return;
+	}
+
+	memset(count, 0, sizeof *count * NUM_BRACKETS);
+	for(int64_t k = 0; k < e->num_chunks;) {
+		if (e->chunk[k].dirty) {
+			clean_chunk(e, k);
+			continue;
+		}
+		add_counts(count, e->chunk[k++].count);
+	}
+}
+
+
+/* Scans the given line from position pos (inclusive), forwards or backwards
+   depending on the bracket type, updating the depth *n. Returns the position
+   at which the depth becomes zero, or -1. */
+
+int64_t find_bracket_in_line(const line_desc * const ld, const int64_t pos, const int type, int64_t * const n) {
+	const bool back = type & 1;
+	bracket_line * const e = ld->line_len >= BRACKET_MIN_LINE_LEN ? get_bracket_line(ld) : NULL;
+	if (!e) return back ? scan_brackets(ld->line, 0, pos + 1, type, n) : scan_brackets(ld->line, pos, ld->line_len, type, n);
+
+	assert(e->line_len == ld->line_len);
+
+	/* We scan the chunk containing pos, and then skip chunks until we find one
+	that contains the match. */
+
+	int64_t k = find_chunk(e, pos);
+	if (e->chunk[k].dirty) {
+		clean_chunk(e, k);
+		k = find_chunk(e, pos);
+	}
+
+	int64_t result = back ? scan_brackets(ld->line, e->chunk[k].pos, pos + 1, type, n) : scan_brackets(ld->line, pos, chunk_end(e, k), type, n);
+	if (result >= 0) return result;
+
+	if (back) {
+		while(--k >= 0) {
+			if (e->chunk[k].dirty) {
+				k += clean_chunk(e, k);
+				continue;
+			}
+			if (may_match(&e->chunk[k].count[type >> 1], type, n)) return scan_brackets(ld->line, e->chunk[k].pos, chunk_end(e, k), type, n);
+		}
+	}
+	else {
+		while(++k < e->num_chunks) {
+			if (e->chunk[k].dirty) {
+				clean_chunk(e, k--);
+				continue;
+			}
+			if (may_match(&e->chunk[k].count[type >> 1], type, n)) return scan_brackets(ld->line, e->chunk[k].pos, chunk_end(e, k), type, n);
+		}
+	}
+
+	return -1;
+}
+
+
+/* Updates the chunks of the given line after len bytes have been inserted
+   at position pos. */
+
+static void bracket_line_insert(bracket_line * const e, const int64_t pos, const int64_t len) {
+	const int64_t k = find_chunk(e, pos);
+	e->chunk[k].dirty = true;
+	for(int64_t i = k + 1; i < e->num_chunks; i++) e->chunk[i].pos += len;
+	e->line_len += len;
+}
+
+
+/* Updates the chunks of the given line after len bytes have been deleted
+   at position pos. */
+
+static void bracket_line_delete(bracket_line * const e, const int64_t pos, const int64_t len) {
+	const int64_t k = find_chunk(e, pos);
+	int64_t i = k + 1;
+	while(i < e->num_chunks && e->chunk[i].pos < pos + len) i++;
+	remove_chunks(e, k + 1, i - (k + 1));
+
+	for(i = k + 1; i < e->num_chunks; i++) e->chunk[i].pos -= len;
+	e->chunk[k].dirty = true;
+	e->line_len -= len;
+
+	/* If chunk k has been deleted completely, we remove it. */
+	if (k + 1 < e->num_chunks && e->chunk[k + 1].pos == e->chunk[k].pos) remove_chunks(e, k, 1);
+}
+
+
+/* Updates the chunks of the given line, which has changed from position pos
+   to its new end. */
+
+static void bracket_line_truncate(bracket_line * const e, const int64_t pos, const int64_t line_len) {
+	const int64_t k = find_chunk(e, pos);
+	e->num_chunks = k + 1;
+	e->chunk[k].dirty = true;
+	e->line_len = line_len;
+}
+
+
+/* Forgets the chunks of the given line (e.g., because it is being freed). */
+
+void forget_bracket_line(const line_desc * const ld) {
+	bracket_line * const e = find_bracket_line(ld);
+	if (e) e->ld = NULL;
+}
+
+
+
+/* Returns the index of the block containing the given line, and leaves it,
+   with its first line, in the hint. */
+
+static int64_t find_block(struct bracket_index * const bi, const int64_t line) {
+	int64_t i = bi->hint, start = bi->hint_line;
+	while(line < start) start -= bi->block[--i].num_lines;
+	while(line >= start + bi->block[i].num_lines) start += bi->block[i++].num_lines;
+	bi->hint = i;
+	bi->hint_line = start;
+	return i;
+}
+
+
+/* Inserts an empty, dirty block at the given index, returning false if we
+   run out of memory. */
+
+static bool new_block(struct bracket_index * const bi, const int64_t i) {
+	if (bi->num_blocks == bi->max_blocks) {
+		const int64_t max_blocks = bi->max_blocks ? bi->max_blocks * 2 : 64;
+		bracket_block * const block = realloc(bi->block, sizeof *block * max_blocks);
+		if (!block) return false;
+		bi->block = block;
+		bi->max_blocks = max_blocks;
+	}
+
+	memmove(&bi->block[i + 1], &bi->block[i], sizeof *bi->block * (bi->num_blocks - i));
+	bi->block[i] = (bracket_block){ .dirty = true };
+	bi->num_blocks++;
+	return true;
+}
+
+
+/* Splits a block in two halves of approximately the same size. If we run
+   out of memory, the block is left alone. */
+
+static void split_block(struct bracket_index * const bi, const int64_t i) {
+	if (bi->block[i].num_lines < 2 || !new_block(bi, i + 1)) return;
+
+	bracket_block * const a = &bi->block[i], * const c = &bi->block[i + 1];
+	const int64_t num_lines = a->num_lines;
+
+	line_desc *ld = a->first;
+	int64_t len = 0;
+	for(int64_t k = 0; k < num_lines; k++, ld = (line_desc *)ld->ld_node.next) len += ld->line_len + 1;
+
+	a->num_lines = a->len = 0;
+	a->dirty = true;
+	ld = a->first;
+	for(int64_t k = 0; k < num_lines; k++, ld = (line_desc *)ld->ld_node.next) {
+		bracket_block * const d = k > 0 && (a->len >= len / 2 || k == num_lines - 1 && !c->num_lines) ? c : a;
+		if (d == c && !c->num_lines) c->first = ld;
+		d->len += ld->line_len + 1;
+		d->num_lines++;
+	}
+}
+
+
+void free_bracket_index(buffer * const b) {
+	for(int i = 0; i < BRACKET_LINES; i++) bracket_lines[i].ld = NULL;
+
+	struct bracket_index * const bi = b->bracket_index;
+	if (!bi) return;
+	free(bi->block);
+	free(bi);
+	b->bracket_index = NULL;
+}
+
+
+/* Partitions the lines of the given buffer into blocks, if the buffer is
+   large enough and it has not been done yet. Summaries are computed when
+   they are needed. Returns false if we run out of memory. */
+
+bool build_bracket_index(buffer * const b) {
+	if (b->bracket_index || b->allocated_chars - b->free_chars < BRACKET_MIN_SIZE) return true;
+
+	struct bracket_index * const bi = b->bracket_index = calloc(1, sizeof *bi);
+	if (!bi) return false;
+
+	for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next;) {
+		if (!new_block(bi, bi->num_blocks)) {
+			free_bracket_index(b);
+			return false;
+		}
+
+		bracket_block * const bl = &bi->block[bi->num_blocks - 1];
+		bl->first = ld;
+		do {
+			bl->len += ld->line_len + 1;
+			bl->num_lines++;
+			ld = (line_desc *)ld->ld_node.next;
+		} while(ld->ld_node.next && bl->len < BRACKET_BLOCK_SIZE);
+	}
+
+	return true;
+}
+
+
+/* Updates the index after len bytes, containing new_lines line
+   terminators, have been inserted in the line ld, numbered line, at
+   position pos. */
+
+void bracket_index_insert(buffer * const b, const int64_t line, const line_desc * const ld, const int64_t pos, const int64_t new_lines, const int64_t len) {
+	bracket_line * const e = find_bracket_line(ld);
+	if (e) {
+		if (new_lines) bracket_line_truncate(e, pos, ld->line_len);
+		else bracket_line_insert(e, pos, len);
+	}
+
+	struct bracket_index * const bi = b->bracket_index;
+	if (!bi) return;
+
+	const int64_t i = find_block(bi, line);
+	bracket_block * const bl = &bi->block[i];
+	bl->num_lines += new_lines;
+	bl->len += len;
+	bl->dirty = true;
+
+	if (bl->len > 2 * BRACKET_BLOCK_SIZE) split_block(bi, i);
+}
+
+
+/* Updates the index after some bytes have been deleted from the line ld,
+   numbered line, at position pos, joining to it the following removed_lines
+   lines (which are no longer in the buffer). */
+
+void bracket_index_delete(buffer * const b, const int64_t line, line_desc * const ld, const int64_t pos, int64_t removed_lines) {
+	bracket_line * const e = find_bracket_line(ld);
+	if (e) {
+		if (removed_lines) bracket_line_truncate(e, pos, ld->line_len);
+		else bracket_line_delete(e, pos, e->line_len - ld->line_len);
+	}
+
+	struct bracket_index * const bi = b->bracket_index;
+	if (!bi) return;
+
+	const int64_t i = find_block(bi, line);
+	bracket_block * const bl = &bi->block[i];
+	const int64_t n = removed_lines < bi->hint_line + bl->num_lines - 1 - line ? removed_lines : bi->hint_line + bl->num_lines - 1 - line;
+
+	/* Lines joined from the following blocks become part of this block. */
+	bl->num_lines -= n;
+	bl->dirty = true;
+	removed_lines -= n;
+
+	/* The following blocks lose their first lines, or disappear. */
+	int64_t j = i + 1;
+	for(; removed_lines && j < bi->num_blocks && removed_lines >= bi->block[j].num_lines; j++) removed_lines -= bi->block[j].num_lines;
+	if (removed_lines && j < bi->num_blocks) {
+		bi->block[j].num_lines -= removed_lines;
+		bi->block[j].first = (line_desc *)ld->ld_node.next;
+		bi->block[j].dirty = true;
+	}
+
+	memmove(&bi->block[i + 1], &bi->block[j], sizeof *bi->block * (bi->num_blocks - j));
+	bi->num_blocks -= j - (i + 1);
+}
+
+
+/* Returns the summaries of the given block, recomputing them if necessary. */
+
+static const bracket_count *block_count(bracket_block * const bl) {
+	if (bl->dirty) {
+		memset(bl->count, 0, sizeof bl->count);
+		const line_desc *ld = bl->first;
+		for(int64_t k = 0; k < bl->num_lines; k++, ld = (line_desc *)ld->ld_node.next) {
+			bracket_count count[NUM_BRACKETS];
+			count_line(ld, count);
+			add_counts(bl->count, count);
+		}
+		bl->dirty = false;
+	}
+	return bl->count;
+}
+
+
+/* Given the line ld, numbered *y, which a bracket-matching scan with
+   depth *n for the given bracket type is about to visit, skips the blocks
+   starting (or ending, when scanning backwards) at *y that cannot contain
+   the match and lie within min_line and max_line. Returns the descriptor of
+   the new line *y, which might be the head or tail of the line list. */
+
+line_desc *skip_bracket_blocks(buffer * const b, line_desc * const ld, int64_t * const y, const int type, int64_t * const n, const int64_t min_line, const int64_t max_line) {
+	struct bracket_index * const bi = b->bracket_index;
+	const int64_t i = find_block(bi, *y);
+	int64_t j = i, first = bi->hint_line;
+
+	if (!(type & 1)) {
+		if (*y != first) return ld;
+
+		for(; j < bi->num_blocks && first + bi->block[j].num_lines - 1 <= max_line; first += bi->block[j++].num_lines) {
+			if (may_match(&block_count(&bi->block[j])[type >> 1], type, n)) break;
+		}
+
+		if (j == i) return ld;
+		*y = first;
+		return j < bi->num_blocks ? bi->block[j].first : (line_desc *)b->line_desc_list.tail_pred->next;
+	}
+	else {
+		int64_t last = first + bi->block[i].num_lines - 1;
+		if (*y != last) return ld;
+
+		for(; j >= 0 && last - bi->block[j].num_lines + 1 >= min_line; last -= bi->block[j--].num_lines) {
+			if (may_match(&block_count(&bi->block[j])[type >> 1], type, n)) break;
+		}
+
+		if (j == i) return ld;
+		*y = last;
+		return (line_desc *)bi->block[j + 1].first->ld_node.prev;
+	}
+}
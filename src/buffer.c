@@ -27,6 +27,11 @@
 
 #define STD_POOL_SIZE (16 * 1024)
 
+/* Lines longer than STD_POOL_SIZE that must be moved get this fraction of
+their length as free room on each side (see alloc_line_chars()). */
+
+#define LONG_LINE_ROOM_DIV (8)
+
 /* The standard line descriptor pool allocation dimension (in lines). */
 
 #define STD_LINE_DESC_POOL_SIZE (512)
@@ -213,6 +218,7 @@ buffer *alloc_buffer(const buffer * const cur_b) {
 		b->opt.utf8auto = io_utf8;
 
 		b->attr_len = -1;
+		b->syntax_frontier = -1;
 
 		if (cur_b) {
 
@@ -281,6 +287,11 @@ void free_buffer_contents(buffer * const b) {
 	free_char_stream(b->last_deleted);
 	b->last_deleted = NULL;
 
+	free_trigram_index(b);
+	free_bracket_index(b);
+	col_index_reset();
+	b->syntax_frontier = -1;
+
 	free(b->filename);
 	b->filename = NULL;
 
@@ -519,6 +530,8 @@ void free_line_desc(buffer * const b, line_desc * const ld) {
 
 	block_signals();
 
+	col_index_invalidate(ld, 0);
+	forget_bracket_line(ld);
 	add_head(&ldp->free_list, &ld->ld_node);
 
 	if (--ldp->allocated_items == 0) {
@@ -543,6 +556,7 @@ char *alloc_chars(buffer * const b, const int64_t len) {
 	char_pool *cp;
 	for(cp = (char_pool *)b->char_pool_list.head; cp->cp_node.next; cp = (char_pool *)cp->cp_node.next) {
 		assert_char_pool(cp);
+		if (cp->reserved) continue;
 
 		/* We try to allocate before the first used character,
 		or after the last used character. If we succeed with a
@@ -597,6 +611,51 @@ char *alloc_chars(buffer * const b, const int64_t len) {
 
 
 
+/* Allocates len characters for a line that is being moved because there is no
+   room around it. Short lines are handled by alloc_chars(). Longer lines would
+   get a pool sized exactly to their length, so the next insertion would move
+   them again: on a single line of megabytes, this means copying the whole line
+   at each keystroke. Thus, we allocate a pool with LONG_LINE_ROOM_DIV-th of
+   the length free on both sides, and place the line in the middle. Subsequent
+   insertions are satisfied by alloc_chars_around(), and since the room grows
+   with the line the cost of moving it is amortized.
+
+   Note that lines are contiguous, so there is no gap at the editing
+   position: an insertion inside a line still moves the shorter of the two
+   parts of the line around the insertion point, which is cheap only near
+   the ends of the line. */
+
+static char *alloc_line_chars(buffer * const b, const int64_t len) {
+	if (len < STD_POOL_SIZE) return alloc_chars(b, len);
+
+	const int64_t room = len / LONG_LINE_ROOM_DIV;
+
+	block_signals();
+
+	char_pool * const cp = alloc_char_pool(len + 2 * room, 0, -1);
+	if (!cp) {
+		release_signals();
+		return alloc_chars(b, len);
+	}
+
+	/* The room is kept for the line (and for the lines it might be split
+	into): alloc_chars() skips reserved pools, so only alloc_chars_around()
+	can use it. */
+
+	cp->reserved = true;
+	add_tail(&b->char_pool_list, &cp->cp_node);
+	cp->first_used = room;
+	cp->last_used = room + len - 1;
+
+	b->allocated_chars += cp->size;
+	b->free_chars += cp->size - len;
+
+	release_signals();
+	return cp->pool + room;
+}
+
+
+
 /* This function is very important, since it embeds all the philosophy behind
    ne's character pool management. It performs an allocation *locally*, that
    is, it tries to see if there are enough free characters around the line
@@ -777,6 +836,8 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 
 	block_signals();
 
+	col_index_invalidate(ld, pos);
+
 	if (b->opt.do_undo && !(b->undoing || b->redoing)) {
 		const int error = add_undo_step(b, line, pos, -stream_len);
 		if (error) {
@@ -785,9 +846,14 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 		}
 	}
 
+	const int64_t first_line = line, first_pos = pos;
+	line_desc * const first_ld = ld;
+	int64_t end_pos = pos;
+
 	const char *s = stream;
 	while(s - stream < stream_len) {
 		int64_t const len = strnlen_ne(s, stream_len - (s - stream));
+		end_pos = pos + len;
 		if (len) {
 
 			/* First case; there is no character allocated on this line. We
@@ -799,6 +865,8 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 					ld->line_len = len;
 				}
 				else {
+					free_trigram_index(b);
+					free_bracket_index(b);
 					release_signals();
 					return OUT_OF_MEMORY_DISK_FULL;
 				}
@@ -813,7 +881,7 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 			else {
 				const int64_t result = alloc_chars_around(b, ld, len, pos < ld->line_len / 2);
 				if (result < 0) {
-					char * const p = alloc_chars(b, ld->line_len + len);
+					char * const p = alloc_line_chars(b, ld->line_len + len);
 					if (p) {
 						memcpy(p, ld->line, pos);
 						memcpy(&p[pos], s, len);
@@ -823,6 +891,8 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 						ld->line_len += len;
 					}
 					else {
+						free_trigram_index(b);
+						free_bracket_index(b);
 						release_signals();
 						return OUT_OF_MEMORY_DISK_FULL;
 					}
@@ -884,10 +954,12 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 						else if (b->bookmark[i].line > line) b->bookmark[i].line++;
 					}
 				}
-				pos = 0;
+				pos = end_pos = 0;
 				line++;
 			}
 			else {
+				free_trigram_index(b);
+				free_bracket_index(b);
 				release_signals();
 				return OUT_OF_MEMORY_DISK_FULL;
 			}
@@ -896,6 +968,11 @@ int insert_stream(buffer * const b, line_desc * ld, int64_t line, int64_t pos, c
 		s += len + 1;
 	}
 
+	if (b->trigram_index) trigram_index_insert(b, first_line, first_ld, first_pos, line - first_line, end_pos, stream_len);
+	bracket_index_insert(b, first_line, first_ld, first_pos, line - first_line, stream_len);
+	if (b->syntax_frontier > first_line) b->syntax_frontier += line - first_line;
+	if (b->syntax_frontier >= 0 && b->syntax_frontier_end >= first_line) b->syntax_frontier_end += line - first_line;
+
 	release_signals();
 	return OK;
 }
@@ -957,6 +1034,8 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 
 	block_signals();
 
+	col_index_invalidate(ld, pos);
+
 	if (b->opt.do_undo && !(b->undoing || b->redoing)) {
 		const int error = add_undo_step(b, line, pos, len);
 		if (error) {
@@ -965,6 +1044,8 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 		}
 	}
 
+	int64_t removed_lines = 0;
+
 	while(len) {
 		/* First case: we are just on the end of a line. We join the current
 		line with the following one (if it's there of course). If, however,
@@ -1005,7 +1086,7 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 				if ((n = alloc_chars_around(b, ld, next_ld->line_len, false))<0 && (m = alloc_chars_around(b, next_ld, ld->line_len, true))<0) {
 					/* We try to allocate characters around one line or the other
 						one; if we fail, we allocate enough space for both lines elsewhere. */
-					char * const p = alloc_chars(b, ld->line_len + next_ld->line_len);
+					char * const p = alloc_line_chars(b, ld->line_len + next_ld->line_len);
 					if (p) {
 
 						memcpy(p, ld->line, ld->line_len);
@@ -1017,6 +1098,8 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 						ld->line = p;
 					}
 					else {
+						free_trigram_index(b);
+						free_bracket_index(b);
 						release_signals();
 						if (b->opt.do_undo && !(b->undoing || b->redoing)) fix_last_undo_step(b, -len);
 						return OUT_OF_MEMORY_DISK_FULL;
@@ -1046,7 +1129,9 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 
 			ld->line_len += next_ld->line_len;
 			b->num_lines--;
+			removed_lines++;
 
+			if (b->syntax_frontier_ld == next_ld) b->syntax_frontier_ld = ld;
 			rem(&next_ld->ld_node);
 			free_line_desc(b, next_ld);
 
@@ -1111,6 +1196,11 @@ int delete_stream(buffer * const b, line_desc * const ld, const int64_t line, co
 
 	if (b->opt.do_undo && !(b->undoing || b->redoing)) fix_last_undo_step(b, -len);
 
+	if (b->trigram_index) trigram_index_delete(b, line, ld, pos, removed_lines);
+	bracket_index_delete(b, line, ld, pos, removed_lines);
+	if (b->syntax_frontier > line) b->syntax_frontier = max(line, b->syntax_frontier - removed_lines);
+	if (b->syntax_frontier >= 0 && b->syntax_frontier_end > line) b->syntax_frontier_end = max(line, b->syntax_frontier_end - removed_lines);
+
 	release_signals();
 	return OK;
 }
@@ -1152,6 +1242,23 @@ line_desc *nth_line_desc(const buffer *b, const int64_t n) {
 	return ld;
 }
 
+/* Returns the number of the line described by ld, searching for it in both
+   directions starting from the current line (which must be coherent with
+   cur_line_desc), or -1 if ld is not a line of b. */
+
+int64_t line_desc_number(const buffer * const b, const line_desc * const ld) {
+	const line_desc *p = b->cur_line_desc, *q = b->cur_line_desc;
+
+	for(int64_t i = 0; p || q; i++) {
+		if (p == ld) return b->cur_line - i;
+		if (q == ld) return b->cur_line + i;
+		p = p && p->ld_node.prev->prev ? (line_desc *)p->ld_node.prev : NULL;
+		q = q && q->ld_node.next->next ? (line_desc *)q->ld_node.next : NULL;
+	}
+
+	return -1;
+}
+
 /* Changes the buffer file name to the given string, which must have been
    obtained through malloc(). */
 
@@ -1520,16 +1627,22 @@ int load_fd_in_buffer(buffer *b, int fd) {
 	return OK;
 }
 
-/* Recomputes initial states for all lines in a buffer. */
+/* Resets the initial states of all lines in a buffer to the initial state
+   of the parser. Actual states will be computed on demand, starting from the
+   first line (see continue_syntax_states()). */
 
 void reset_syntax_states(buffer *b) {
+	b->syntax_frontier = -1;
 	if (b->syn) {
-		HIGHLIGHT_STATE next_line_state = { 0, 0, "" };
-		for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next) {
-			ld->highlight_state = next_line_state;
-			next_line_state = parse(b->syn, ld, next_line_state, b->encoding == ENC_UTF8);
+		const HIGHLIGHT_STATE initial_state = { 0, 0, "" };
+		for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next)
+			ld->highlight_state = initial_state;
+
+		if (b->num_lines > 1) {
+			b->syntax_frontier = 0;
+			b->syntax_frontier_ld = (line_desc *)b->line_desc_list.head;
+			b->syntax_frontier_end = b->num_lines - 1;
 		}
-
 		b->attr_len = -1;
 	}
 }
@@ -33,6 +33,7 @@
 #endif
 
 #include "cm.h"
+#include "term.h"
 
 #define	BIG	9999
 
@@ -53,7 +54,7 @@ int evalcost (int c) {
 /* This function is used in tputs(). */
 
 int cmputc (int c) {
-	return putchar(c & 0x7f);
+	return frame_putc(c & 0x7f);
 }
 
 
@@ -69,8 +70,8 @@ int cmputc (int c) {
 void cmcheckmagic () {
 	if (curX == ScreenCols) {
 		assert(MagicWrap && curY < ScreenRows - 1);
-		putchar ('\r');
-		putchar ('\n');
+		frame_putc('\r');
+		frame_putc('\n');
 		curX = 0;
 		curY++;
 	}
@@ -214,13 +215,16 @@ done:
 #define	USECR	3
 
 
-void cmgoto (int row, int col) {
+/* Moves the cursor to (row, col) using the cheapest motion, or, if doit is
+   false, just returns the cost of the motion. */
+
+static int goto_rowcol (int row, int col, int doit) {
 	int	  homecost, crcost, llcost, relcost, directcost;
 	int	  use = USEREL;
 	char	*p, *dcm;
 	
 	/* First the degenerate case */
-	if (row == curY && col == curX) return; /* already there */
+	if (row == curY && col == curX) return 0; /* already there */
 		
 	if (curY >= 0 && curX >= 0) {
 		/* We may have quick ways to go to the upper-left, bottom-left,
@@ -258,12 +262,15 @@ void cmgoto (int row, int col) {
 		p = dcm == Wcm.cm_habs ? tgoto (dcm, row, col) : tgoto (dcm, col, row);
 		tputs (p, 1, evalcost);
 		if (cost <= relcost) {	/* really is cheaper */
+			if (!doit) return cost;
 			tputs (p, 1, cmputc);
 			curY = row, curX = col;
-			return;
+			return cost;
 		}
 	}
 	
+	if (!doit) return relcost;
+
 	switch (use) {
 	case USEHOME: 
 		tputs (Wcm.cm_home, 1, cmputc);
@@ -284,6 +291,19 @@ void cmgoto (int row, int col) {
 	
 	(void) calccost (curY, curX, row, col, 1);
 	curY = row, curX = col;
+	return relcost;
+}
+
+
+void cmgoto (int row, int col) {
+	goto_rowcol (row, col, 1);
+}
+
+
+/* Returns the cost of the motion that cmgoto() would use to reach (row, col). */
+
+int cmgoto_cost (int row, int col) {
+	return goto_rowcol (row, col, 0);
 }
 
 /* Clears out all terminal info.  Used before copying into it the info on the
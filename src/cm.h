@@ -142,5 +142,6 @@ int cmputc(int);
 int Wcm_init (void);
 void cmcostinit (void);
 void cmgoto (int row, int col);
+int cmgoto_cost (int row, int col);
 
 #include "debug.h"
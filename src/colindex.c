@@ -0,0 +1,191 @@
+/* Column index for very long lines.
+
+   Copyright (C) 2026 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+#include "support.h"
+
+
+/* Turning a column into a position (or vice versa) requires scanning a line
+   from its start, expanding TABs and decoding UTF-8. On lines of megabytes
+   (e.g., minified JSON) this makes every cursor movement and every repaint
+   slow. For lines of at least COL_INDEX_MIN_LEN bytes we thus keep a
+   sequence of checkpoints: checkpoint i is the first character starting at
+   or after byte i * COL_INDEX_STEP, and records its position, the
+   TAB-expanded width and the number of characters preceding it. The
+   functions in support.h start scanning from the last checkpoint preceding
+   the position or column they need, so their cost does not depend on the
+   length of the line.
+
+   Checkpoints are computed lazily, just up to the part of the line that
+   has been accessed, and are kept for the last COL_INDEX_LINES lines used.
+   Since checkpoints depend only on the content of the line before them,
+   insert_stream() and delete_stream() just discard the checkpoints after
+   the position they modify; free_line_desc() and free_buffer_contents()
+   discard the checkpoints of the lines they free. */
+
+#define COL_INDEX_STEP 1024
+#define COL_INDEX_LINES 4
+
+typedef struct {
+	const line_desc *ld;
+	int tab_size;
+	bool utf8;
+	bool complete;          /* Whether all checkpoints of the line have been computed. */
+	col_checkpoint *cp;     /* The checkpoints computed so far; cp[0] is always the start of the line. */
+	int64_t num_cp, size;
+} col_index;
+
+static col_index col_indices[COL_INDEX_LINES];
+
+/* The index entry to be used next if a line is not found. */
+
+static int next_entry;
+
+/* The checkpoint returned when no index is available: scanning starts from
+   the beginning of the line. */
+
+static const col_checkpoint line_start;
+
+
+/* Returns the index entry of the given line, creating it if necessary. If
+   tab_size is zero, any existing entry will do (the caller needs no
+   widths). */
+
+static col_index *get_index(const line_desc * const ld, int tab_size, const encoding_type encoding) {
+	const bool utf8 = encoding == ENC_UTF8;
+	col_index *e = NULL;
+	for(int i = 0; i < COL_INDEX_LINES; i++)
+		if (col_indices[i].ld == ld) {
+			e = &col_indices[i];
+			break;
+		}
+
+	if (e && e->utf8 == utf8 && (tab_size == 0 || e->tab_size == tab_size)) return e;
+
+	if (tab_size == 0) tab_size = 8;
+
+	if (!e) {
+		e = &col_indices[next_entry];
+		next_entry = (next_entry + 1) % COL_INDEX_LINES;
+	}
+
+	if (!e->cp) {
+		if (!(e->cp = malloc(sizeof *e->cp * 64))) return NULL;
+		e->size = 64;
+	}
+
+	e->ld = ld;
+	e->tab_size = tab_size;
+	e->utf8 = utf8;
+	e->complete = false;
+	e->cp[0] = line_start;
+	e->num_cp = 1;
+	return e;
+}
+
+/* Computes further checkpoints, until the last one has position greater
+   than max_pos and width greater than max_col, or the end of the line is
+   reached. */
+
+static void extend_index(col_index * const e, const int64_t max_pos, const int64_t max_col) {
+	const line_desc * const ld = e->ld;
+	const encoding_type encoding = e->utf8 ? ENC_UTF8 : ENC_8_BIT;
+	col_checkpoint c = e->cp[e->num_cp - 1];
+
+	while(!e->complete && (c.pos <= max_pos || c.width <= max_col)) {
+		const int64_t next = (c.pos / COL_INDEX_STEP + 1) * COL_INDEX_STEP;
+		while(c.pos < next && c.pos < ld->line_len) {
+			if (ld->line[c.pos] != '\t') c.width += get_char_width(&ld->line[c.pos], encoding);
+			else c.width += e->tab_size - c.width % e->tab_size;
+			c.pos = next_pos(ld->line, c.pos, encoding);
+			c.chars++;
+		}
+
+		if (c.pos >= ld->line_len) {
+			e->complete = true;
+			break;
+		}
+
+		if (e->num_cp == e->size) {
+			col_checkpoint * const p = realloc(e->cp, sizeof *e->cp * e->size * 2);
+			if (!p) return;
+			e->cp = p;
+			e->size *= 2;
+		}
+		e->cp[e->num_cp++] = c;
+	}
+}
+
+/* Returns the last checkpoint of the given line whose position is at most
+   pos. If tab_size is zero, the width of the checkpoint must be ignored. */
+
+const col_checkpoint *col_checkpoint_by_pos(const line_desc * const ld, const int64_t pos, const int tab_size, const encoding_type encoding) {
+	col_index * const e = get_index(ld, tab_size, encoding);
+	if (!e) return &line_start;
+	extend_index(e, pos, -1);
+
+	int64_t l = 0, r = e->num_cp;
+	while(r - l > 1) {
+		const int64_t m = (l + r) / 2;
+		if (e->cp[m].pos <= pos) l = m;
+		else r = m;
+	}
+	return &e->cp[l];
+}
+
+/* Returns the last checkpoint of the given line whose width is at most
+   col. */
+
+const col_checkpoint *col_checkpoint_by_col(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding) {
+	col_index * const e = get_index(ld, tab_size, encoding);
+	if (!e) return &line_start;
+	extend_index(e, -1, col);
+
+	int64_t l = 0, r = e->num_cp;
+	while(r - l > 1) {
+		const int64_t m = (l + r) / 2;
+		if (e->cp[m].width <= col) l = m;
+		else r = m;
+	}
+	return &e->cp[l];
+}
+
+/* Discards the checkpoints of the given line that follow the given
+   position, as the line is going to be modified starting from there. If
+   pos is zero, the line is forgotten altogether (e.g., because it is being
+   freed). */
+
+void col_index_invalidate(const line_desc * const ld, const int64_t pos) {
+	for(int i = 0; i < COL_INDEX_LINES; i++) {
+		col_index * const e = &col_indices[i];
+		if (e->ld != ld) continue;
+		if (pos == 0) e->ld = NULL;
+		else {
+			while(e->num_cp > 1 && e->cp[e->num_cp - 1].pos > pos) e->num_cp--;
+			e->complete = false;
+		}
+	}
+}
+
+/* Forgets all lines (e.g., because line descriptor pools are being freed). */
+
+void col_index_reset(void) {
+	for(int i = 0; i < COL_INDEX_LINES; i++) col_indices[i].ld = NULL;
+}
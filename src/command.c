@@ -95,6 +95,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(EXIT          ), NO_ARGS                                                               },
 	{ NAHL(FASTGUI       ),                           IS_OPTION                                   },
 	{ NAHL(FIND          ),           ARG_IS_STRING                                               },
+	{ NAHL(FINDANY       ),           ARG_IS_STRING                                               },
 	{ NAHL(FINDREGEXP    ),           ARG_IS_STRING                                               },
 	{ NAHL(FLAGS         ), NO_ARGS |                             DO_NOT_RECORD                   },
 	{ NAHL(FLASH         ), NO_ARGS                                                               },
@@ -103,8 +104,10 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(GOTOCOLUMN    ),0                                                                      },
 	{ NAHL(GOTOLINE      ),0                                                                      },
 	{ NAHL(GOTOMARK      ), NO_ARGS                                                               },
+	{ NAHL(GREP          ),           ARG_IS_STRING                                               },
 	{ NAHL(HELP          ),           ARG_IS_STRING |             DO_NOT_RECORD                   },
 	{ NAHL(HEXCODE       ),                           IS_OPTION                                   },
+	{ NAHL(INCREMENTALFIND),                          IS_OPTION                                   },
 	{ NAHL(INSERT        ),                           IS_OPTION                                   },
 	{ NAHL(INSERTCHAR    ),0                                                                      },
 	{ NAHL(INSERTLINE    ),0                                                                      },
@@ -140,6 +143,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(NOP           ), NO_ARGS                                                               },
 	{ NAHL(OPEN          ),           ARG_IS_STRING                                               },
 	{ NAHL(OPENCLIP      ),           ARG_IS_STRING                                               },
+	{ NAHL(OPENHIT       ), NO_ARGS                                                               },
 	{ NAHL(OPENMACRO     ),           ARG_IS_STRING                                               },
 	{ NAHL(OPENNEW       ),           ARG_IS_STRING                                               },
 	{ NAHL(PAGEDOWN      ),0                                                                      },
@@ -174,6 +178,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(SAVEMACRO     ),           ARG_IS_STRING                                               },
 	{ NAHL(SAVEPREFS     ),           ARG_IS_STRING                                               },
 	{ NAHL(SEARCHBACK    ),                           IS_OPTION                                   },
+	{ NAHL(SEARCHINDEX   ),                           IS_OPTION                                   },
 	{ NAHL(SELECTDOC     ),0                                                                      },
 	{ NAHL(SETBOOKMARK   ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
 	{ NAHL(SHIFT         ),           ARG_IS_STRING |                             EMPTY_STRING_OK },
@@ -181,6 +186,7 @@ static const command commands[ACTION_COUNT] = {
 	{ NAHL(STATUSBAR     ),                           IS_OPTION                                   },
 	{ NAHL(SUSPEND       ), NO_ARGS                                                               },
 	{ NAHL(SYNTAX        ),           ARG_IS_STRING | IS_OPTION                                   },
+	{ NAHL(SYNTAXSTATS   ),0                                                                      },
 	{ NAHL(SYSTEM        ),           ARG_IS_STRING                                               },
 	{ NAHL(TABS          ),                           IS_OPTION                                   },
 	{ NAHL(TABSIZE       ),                           IS_OPTION                                   },
@@ -0,0 +1,885 @@
+/* Lazy DFA line filter for regular-expression searches.
+
+   Copyright (C) 2026 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+
+/* Searching for a regular expression with the regex library has a
+   noticeable fixed cost per line (re_search() allocates and initialises its
+   matching context each time), which dominates when most lines do not match.
+   The functions in this file compile a regular expression (in the syntax set
+   up in main()) into a Thompson NFA, and then decide whether a line contains
+   a match by running a DFA whose states are built lazily, one transition at a
+   time, and cached. Lines rejected by the DFA are skipped; the others are
+   handed to re_search(), which computes the actual match and registers.
+
+   While parsing, we also compute a literal string that every match must
+   contain (e.g., "timeout" in "ERROR.*timeout"), if any. Lines not containing
+   it are rejected by a fast substring scan before running the DFA.
+
+   The filter is conservative: anchors and word boundaries are treated as
+   empty strings, so the DFA accepts a superset of the lines containing a
+   match. In UTF-8 text, the regex library matches whole characters: we
+   compile literal characters (and their case variants, if case is folded)
+   into byte sequences, and let everything else that can match a
+   non-US-ASCII character match any non-US-ASCII byte followed by any
+   number of continuation bytes. Expressions the filter cannot handle (back-references, collating
+   elements, equivalence classes and operators in unusual positions), or that
+   match the empty string (and thus every line), are not compiled at all. */
+
+
+/* The maximum number of cached DFA states. When the limit is reached, the
+   cache is flushed and rebuilt from scratch. */
+
+#define MAX_DFA_STATES 4096
+
+/* The size of the hash table of DFA states (a power of two). */
+
+#define DFA_HASH_SIZE (2 * MAX_DFA_STATES)
+
+/* The maximum nesting of parentheses we are willing to parse. */
+
+#define MAX_DFA_DEPTH 256
+
+/* The maximum length of a required literal. */
+
+#define MAX_LITERAL 64
+
+/* Transition table markers: the transition has not been computed yet, or
+   leads to an accepting state (which has no transitions, as a line is
+   accepted as soon as a match has been found). */
+
+#define DFA_UNKNOWN (-1)
+#define DFA_ACCEPT (-2)
+
+typedef enum { NFA_SET, NFA_EPS, NFA_SPLIT, NFA_MATCH } nfa_node_type;
+
+typedef struct {
+	nfa_node_type type;
+	int out1, out2;
+	uint32_t set[8];   /* The bytes accepted by an NFA_SET node. */
+} nfa_node;
+
+typedef struct {
+	int len;
+	unsigned char s[MAX_LITERAL];
+} literal;
+
+/* An NFA fragment under construction: out1 of the end node is dangling.
+   Each match of the fragment starts with prefix, ends with suffix and
+   contains best; if exact is true, the fragment matches just prefix. All
+   literals contain translated bytes. */
+
+typedef struct {
+	int start, end;
+	bool exact;
+	literal prefix, suffix, best;
+} nfa_frag;
+
+struct lazy_dfa {
+	nfa_node *node;
+	int num_nodes, max_nodes, start;
+	bool broken;               /* An allocation failed: accept everything. */
+
+	int num_cls;               /* The number of byte classes. */
+	unsigned char cls[256];    /* The class of each (untranslated) byte. */
+	unsigned char rep[256];    /* A representative translated byte for each class. */
+
+	int num_states, max_states;
+	int *trans;                /* num_cls transitions per state, as offsets of rows. */
+	int *set_start, *set_len;  /* Each state is a sorted list of NFA_SET nodes in pool. */
+	int *pool;
+	int pool_len, pool_size;
+	int hash[DFA_HASH_SIZE];   /* State indices plus one; zero means empty. */
+
+	const unsigned char *t;    /* The translation table (possibly the identity). */
+	int literal_len;           /* The length of the required literal, or 0. */
+	unsigned char literal[MAX_LITERAL];
+	int skip[256];             /* Boyer-Moore-Horspool shifts for literal. */
+
+	int *start_set, start_len; /* The closure of the start node. */
+	int *list, *stack;         /* Scratch space (num_nodes elements each). */
+	unsigned int *mark, gen;
+};
+
+#define SET_BIT(s, c) ((s)[(c) >> 5] |= 1U << ((c) & 31))
+#define GET_BIT(s, c) ((s)[(c) >> 5] >> ((c) & 31) & 1)
+
+
+/* NFA construction. */
+
+typedef struct {
+	const unsigned char *p;
+	const unsigned char *t;
+	struct lazy_dfa *dfa;
+	bool utf8;
+	bool fail;
+} dfa_parser;
+
+/* Returns a new node, or node 0 (which always exists) after setting ps->fail
+   if we run out of memory. */
+
+static int new_node(dfa_parser * const ps, const nfa_node_type type, const int out2) {
+	struct lazy_dfa * const dfa = ps->dfa;
+	if (dfa->num_nodes == dfa->max_nodes) {
+		nfa_node * const node = realloc(dfa->node, sizeof *node * dfa->max_nodes * 2);
+		if (!node) {
+			ps->fail = true;
+			return 0;
+		}
+		dfa->node = node;
+		dfa->max_nodes *= 2;
+	}
+
+	nfa_node * const n = &dfa->node[dfa->num_nodes];
+	n->type = type;
+	n->out1 = -1;
+	n->out2 = out2;
+	memset(n->set, 0, sizeof n->set);
+	return ps->dfa->num_nodes++;
+}
+
+/* Stores in r the concatenation of a and b, keeping the tail if it is too
+   long and keep_tail is true, or the head otherwise. */
+
+static void join_literals(literal * const r, const literal * const a, const literal * const b, const bool keep_tail) {
+	unsigned char s[2 * MAX_LITERAL];
+	memcpy(s, a->s, a->len);
+	memcpy(s + a->len, b->s, b->len);
+	r->len = min(a->len + b->len, MAX_LITERAL);
+	memcpy(r->s, keep_tail ? s + a->len + b->len - r->len : s, r->len);
+}
+
+static void keep_longer(literal * const best, const literal * const l) {
+	if (l->len > best->len) *best = *l;
+}
+
+static nfa_frag eps_frag(dfa_parser * const ps) {
+	const int n = new_node(ps, NFA_EPS, -1);
+	return (nfa_frag){ .start = n, .end = n, .exact = true };
+}
+
+/* Builds a fragment for a set of bytes, which is closed under translation (as
+   the input is translated, this makes the set a superset of the one the regex
+   library uses, whatever the side it translates). */
+
+static nfa_frag set_frag(dfa_parser * const ps, const uint32_t * const set) {
+	const int n = new_node(ps, NFA_SET, -1);
+	uint32_t * const node_set = ps->dfa->node[n].set;
+	memcpy(node_set, set, sizeof ps->dfa->node[n].set);
+	if (ps->t) for(int c = 0; c < 256; c++) if (GET_BIT(set, c)) SET_BIT(node_set, ps->t[c]);
+
+	nfa_frag f = { .start = n, .end = n };
+
+	/* If all bytes in the set have the same translation, we have a literal. */
+	int v = -1;
+	for(int c = 0; c < 256; c++)
+		if (GET_BIT(node_set, c)) {
+			const int tc = ps->t ? ps->t[c] : c;
+			if (v >= 0 && tc != v) return f;
+			v = tc;
+		}
+
+	f.exact = true;
+	f.prefix.len = 1;
+	f.prefix.s[0] = v;
+	f.suffix = f.best = f.prefix;
+	return f;
+}
+
+static nfa_frag char_frag(dfa_parser * const ps, const unsigned char c) {
+	uint32_t set[8] = { 0 };
+	SET_BIT(set, c);
+	return set_frag(ps, set);
+}
+
+static nfa_frag concat_frag(dfa_parser * const ps, const nfa_frag f, const nfa_frag g) {
+	ps->dfa->node[f.end].out1 = g.start;
+
+	nfa_frag r = { .start = f.start, .end = g.end, .best = f.best };
+	r.exact = f.exact && g.exact && f.prefix.len + g.prefix.len <= MAX_LITERAL;
+	if (f.exact) join_literals(&r.prefix, &f.prefix, &g.prefix, false);
+	else r.prefix = f.prefix;
+	if (g.exact) join_literals(&r.suffix, &f.suffix, &g.suffix, true);
+	else r.suffix = g.suffix;
+
+	/* The end of f is followed by the start of g. */
+	literal middle;
+	join_literals(&middle, &f.suffix, &g.prefix, false);
+	keep_longer(&r.best, &g.best);
+	keep_longer(&r.best, &middle);
+	keep_longer(&r.best, &r.prefix);
+	keep_longer(&r.best, &r.suffix);
+	return r;
+}
+
+static nfa_frag alt_frag(dfa_parser * const ps, const nfa_frag f, const nfa_frag g) {
+	const int e = new_node(ps, NFA_EPS, -1), s = new_node(ps, NFA_SPLIT, g.start);
+	ps->dfa->node[s].out1 = f.start;
+	ps->dfa->node[f.end].out1 = ps->dfa->node[g.end].out1 = e;
+
+	/* Only common prefixes and suffixes are required. */
+	nfa_frag r = { .start = s, .end = e };
+	while(r.prefix.len < min(f.prefix.len, g.prefix.len) && f.prefix.s[r.prefix.len] == g.prefix.s[r.prefix.len]) r.prefix.len++;
+	memcpy(r.prefix.s, f.prefix.s, r.prefix.len);
+	while(r.suffix.len < min(f.suffix.len, g.suffix.len) && f.suffix.s[f.suffix.len - r.suffix.len - 1] == g.suffix.s[g.suffix.len - r.suffix.len - 1]) r.suffix.len++;
+	memcpy(r.suffix.s, f.suffix.s + f.suffix.len - r.suffix.len, r.suffix.len);
+	r.exact = f.exact && g.exact && f.prefix.len == g.prefix.len && r.prefix.len == f.prefix.len;
+	r.best = r.prefix;
+	keep_longer(&r.best, &r.suffix);
+	return r;
+}
+
+static nfa_frag dup_frag(dfa_parser * const ps, const nfa_frag f, const unsigned char op) {
+	const int e = new_node(ps, NFA_EPS, -1), s = new_node(ps, NFA_SPLIT, e);
+	ps->dfa->node[s].out1 = f.start;
+	ps->dfa->node[f.end].out1 = op == '?' ? e : s;
+
+	/* One or more repetitions keep the literals of f, except for exactness. */
+	nfa_frag r = { .start = op == '+' ? f.start : s, .end = e };
+	if (op == '+') {
+		r.prefix = f.prefix;
+		r.suffix = f.suffix;
+		r.best = f.best;
+	}
+	return r;
+}
+
+/* Matches any non-US-ASCII UTF-8 character, and in fact any non-US-ASCII byte
+   followed by any number of continuation bytes. */
+
+static nfa_frag non_ascii_frag(dfa_parser * const ps) {
+	uint32_t lead[8] = { 0 }, cont[8] = { 0 };
+	for(int c = 0x80; c < 0x100; c++) SET_BIT(lead, c);
+	for(int c = 0x80; c < 0xC0; c++) SET_BIT(cont, c);
+	const nfa_frag f = set_frag(ps, lead);
+	return concat_frag(ps, f, dup_frag(ps, set_frag(ps, cont), '*'));
+}
+
+/* Builds a fragment for a set of bytes; in UTF-8 text, only the US-ASCII part
+   of the set is considered, and non_ascii tells whether the set may match
+   non-US-ASCII characters. */
+
+static nfa_frag utf8_set_frag(dfa_parser * const ps, uint32_t * const set, const bool non_ascii) {
+	if (!ps->utf8) return set_frag(ps, set);
+
+	for(int i = 4; i < 8; i++) set[i] = 0;
+	if (!non_ascii) return set_frag(ps, set);
+	if (!(set[0] | set[1] | set[2] | set[3])) return non_ascii_frag(ps);
+	const nfa_frag f = set_frag(ps, set);
+	return alt_frag(ps, f, non_ascii_frag(ps));
+}
+
+/* The fold table, used to fold case in UTF-8 text, contains all pairs
+   (utf8toupper(c), c) such that c is not upper case, sorted by the first
+   element. */
+
+static struct fold_pair {
+	int upper, c;
+} *fold_table;
+static int fold_table_len;
+
+static int fold_pair_cmp(const void *a, const void *b) {
+	const struct fold_pair * const p = a, * const q = b;
+	return p->upper != q->upper ? p->upper - q->upper : p->c - q->c;
+}
+
+static bool init_fold_table(void) {
+	if (fold_table) return true;
+
+	int n = 0;
+	for(int c = 1; c < 0x20000; c++) if (utf8toupper(c) != c) n++;
+	if (!(fold_table = malloc(sizeof *fold_table * (n + 1)))) return false;
+	for(int c = 1; c < 0x20000; c++)
+		if (utf8toupper(c) != c) fold_table[fold_table_len++] = (struct fold_pair){ utf8toupper(c), c };
+	qsort(fold_table, fold_table_len, sizeof *fold_table, fold_pair_cmp);
+	return true;
+}
+
+/* Builds a fragment for the UTF-8 encoding of the given character. */
+
+static nfa_frag seq_frag(dfa_parser * const ps, const int c) {
+	char s[8];
+	const int len = utf8str(c, s);
+	nfa_frag f = char_frag(ps, s[0]);
+	for(int i = 1; i < len; i++) {
+		const nfa_frag g = char_frag(ps, s[i]);
+		f = concat_frag(ps, f, g);
+	}
+	return f;
+}
+
+/* Builds a fragment for a character of UTF-8 text. If case is folded, the
+   regex library compares upper-cased characters, so we accept all characters
+   with the same upper case. */
+
+static nfa_frag utf8_char_frag(dfa_parser * const ps, const int c) {
+	if (!ps->t) return seq_frag(ps, c);
+	if (!init_fold_table()) {
+		ps->fail = true;
+		return (nfa_frag){ 0, 0 };
+	}
+
+	const int upper = utf8toupper(c);
+	nfa_frag f = seq_frag(ps, upper);
+
+	int lo = 0, hi = fold_table_len;
+	while(lo < hi) {
+		const int mid = (lo + hi) / 2;
+		if (fold_table[mid].upper < upper) lo = mid + 1;
+		else hi = mid;
+	}
+	for(; lo < fold_table_len && fold_table[lo].upper == upper; lo++) {
+		const nfa_frag g = seq_frag(ps, fold_table[lo].c);
+		f = alt_frag(ps, f, g);
+	}
+	return f;
+}
+
+/* Adds to a set of bytes the upper-case US-ASCII characters folding to the
+   same upper case as some non-US-ASCII character from c to e (e.g., S for the
+   long s), which the regex library matches if case is folded. */
+
+static bool fold_ascii_range(const dfa_parser * const ps, uint32_t * const set, const int c, const int e) {
+	if (!init_fold_table()) return false;
+	for(int i = 0; i < fold_table_len; i++)
+		if (fold_table[i].upper < 0x80 && fold_table[i].c >= max(c, 0x80) && fold_table[i].c <= e) SET_BIT(set, ps->t[fold_table[i].upper]);
+	return true;
+}
+
+/* Parses a character at ps->p, returning it and advancing ps->p. In UTF-8
+   text, *valid is set if a valid non-US-ASCII sequence has been decoded. */
+
+static int next_char(dfa_parser * const ps, bool * const valid) {
+	const int len = ps->utf8 ? utf8len(*ps->p) : 1;
+
+	*valid = false;
+	if (len > 1) {
+		int i;
+		for(i = 1; i < len && (ps->p[i] & 0xC0) == 0x80; i++);
+		if (i == len) {
+			const int c = utf8char((const char *)ps->p);
+			ps->p += len;
+			*valid = true;
+			return c;
+		}
+	}
+	return *ps->p++;
+}
+
+/* The set of bytes matched by \w, \W, \s or \S, built as the regex library
+   does (i.e., translating the bytes of the class). */
+
+static nfa_frag class_frag(dfa_parser * const ps, const unsigned char c) {
+	const bool word = c == 'w' || c == 'W', negate = c == 'W' || c == 'S';
+	uint32_t set[8] = { 0 };
+
+	for(int i = 0; i < 256; i++)
+		if (word ? isalnum(i) : isspace(i)) SET_BIT(set, ps->t ? ps->t[i] : i);
+	if (word) SET_BIT(set, '_');
+	if (negate) for(int i = 0; i < 8; i++) set[i] = ~set[i];
+	return utf8_set_frag(ps, set, true);
+}
+
+static nfa_frag bracket_frag(dfa_parser * const ps) {
+	const int limit = ps->utf8 ? 0x7F : 0xFF;
+	uint32_t set[8] = { 0 };
+	bool negate = false, non_ascii = ps->utf8 && ps->t != NULL, valid;
+
+	if (*ps->p == '^') {
+		negate = non_ascii = true;
+		ps->p++;
+	}
+
+	for(bool first = true;; first = false) {
+		if (*ps->p == ']' && !first) break;
+		if (!*ps->p || *ps->p == '[' && (ps->p[1] == '.' || ps->p[1] == '=')) {
+			ps->fail = true;
+			return (nfa_frag){ 0, 0 };
+		}
+
+		int c = next_char(ps, &valid);
+		if (valid) non_ascii = true;
+		else if (ps->t) c = ps->t[c];
+
+		int e = c;
+		if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+			if (ps->p[1] == '[' && (ps->p[2] == '.' || ps->p[2] == '=')) {
+				ps->fail = true;
+				return (nfa_frag){ 0, 0 };
+			}
+			ps->p++;
+			e = next_char(ps, &valid);
+			if (!valid && ps->t) e = ps->t[e];
+		}
+
+		if (e > limit) {
+			non_ascii = true;
+			/* In a negated bracket, a smaller set is conservative. */
+			if (ps->t && !negate && !fold_ascii_range(ps, set, c, e)) {
+				ps->fail = true;
+				return (nfa_frag){ 0, 0 };
+			}
+		}
+		for(; c <= min(e, limit); c++) SET_BIT(set, c);
+	}
+
+	ps->p++;
+	if (negate) {
+		for(int i = 0; i < 8; i++) set[i] = ~set[i];
+		set['\n' >> 5] &= ~(1U << ('\n' & 31));
+	}
+	return utf8_set_frag(ps, set, non_ascii);
+}
+
+static nfa_frag parse_alt(dfa_parser *ps, int depth);
+
+/* Parses a literal character. */
+
+static nfa_frag literal_frag(dfa_parser * const ps) {
+	bool valid;
+	const int c = next_char(ps, &valid);
+	if (valid || ps->utf8 && ps->t && c < 0x80) return utf8_char_frag(ps, c);
+	return char_frag(ps, ps->t ? ps->t[c] : c);
+}
+
+/* Parses an atom followed by any number of postfix operators. */
+
+static nfa_frag parse_piece(dfa_parser * const ps, const int depth) {
+	nfa_frag f;
+	bool anchor = false;
+	unsigned char c = *ps->p++;
+
+	switch(c) {
+		case '(':
+			if (*ps->p == ')') f = eps_frag(ps);
+			else {
+				f = parse_alt(ps, depth + 1);
+				if (ps->fail || *ps->p != ')') {
+					ps->fail = true;
+					return f;
+				}
+			}
+			ps->p++;
+			break;
+
+		case '*':
+		case '+':
+		case '?':
+			/* The regex library discards operators with nothing to apply to; we
+				do not bother. */
+			ps->fail = true;
+			return (nfa_frag){ 0, 0 };
+
+		case '^':
+		case '$':
+			f = eps_frag(ps);
+			anchor = true;
+			break;
+
+		case '.': {
+			uint32_t set[8];
+			memset(set, 0xFF, sizeof set);
+			set['\n' >> 5] &= ~(1U << ('\n' & 31));
+			f = utf8_set_frag(ps, set, true);
+			break;
+		}
+
+		case '[':
+			f = bracket_frag(ps);
+			if (ps->fail) return f;
+			break;
+
+		case '\\':
+			c = *ps->p++;
+			if (!c || c >= '1' && c <= '9') {
+				/* A trailing backslash or a back-reference. */
+				ps->fail = true;
+				return (nfa_frag){ 0, 0 };
+			}
+			if (strchr("wWsS", c)) f = class_frag(ps, c);
+			else if (strchr("bB<>`'", c)) {
+				f = eps_frag(ps);
+				anchor = true;
+			}
+			else if (ps->utf8) {
+				ps->p--;
+				f = literal_frag(ps);
+			}
+			else {
+				/* The regex library does not translate escaped characters. */
+				f = char_frag(ps, c);
+			}
+			break;
+
+		default:
+			ps->p--;
+			f = literal_frag(ps);
+			break;
+	}
+
+	while(*ps->p == '*' || *ps->p == '+' || *ps->p == '?') {
+		/* The regex library applies no operator to an anchor. */
+		if (anchor) {
+			ps->fail = true;
+			return f;
+		}
+		f = dup_frag(ps, f, *ps->p++);
+	}
+
+	return f;
+}
+
+static nfa_frag parse_branch(dfa_parser * const ps, const int depth) {
+	nfa_frag f = eps_frag(ps);
+	while(*ps->p && *ps->p != '|' && *ps->p != '\n' && *ps->p != ')' && !ps->fail) f = concat_frag(ps, f, parse_piece(ps, depth));
+	return f;
+}
+
+static nfa_frag parse_alt(dfa_parser * const ps, const int depth) {
+	if (depth > MAX_DFA_DEPTH) {
+		ps->fail = true;
+		return (nfa_frag){ 0, 0 };
+	}
+
+	nfa_frag f = parse_branch(ps, depth);
+	while((*ps->p == '|' || *ps->p == '\n') && !ps->fail) {
+		ps->p++;
+		f = alt_frag(ps, f, parse_branch(ps, depth));
+	}
+	return f;
+}
+
+
+/* Lazy DFA construction. */
+
+/* Adds to dfa->mark the epsilon closure of node n, returning true if it
+   contains the final node. */
+
+static bool add_closure(struct lazy_dfa * const dfa, const int n) {
+	int sp = 0;
+	bool match = false;
+
+	if (dfa->mark[n] == dfa->gen) return false;
+	dfa->mark[n] = dfa->gen;
+	dfa->stack[sp++] = n;
+
+	while(sp) {
+		const nfa_node * const node = &dfa->node[dfa->stack[--sp]];
+		if (node->type == NFA_MATCH) match = true;
+		if (node->type == NFA_EPS || node->type == NFA_SPLIT) {
+			if (node->out1 >= 0 && dfa->mark[node->out1] != dfa->gen) {
+				dfa->mark[node->out1] = dfa->gen;
+				dfa->stack[sp++] = node->out1;
+			}
+			if (node->type == NFA_SPLIT && dfa->mark[node->out2] != dfa->gen) {
+				dfa->mark[node->out2] = dfa->gen;
+				dfa->stack[sp++] = node->out2;
+			}
+		}
+	}
+	return match;
+}
+
+/* Collects in dfa->list the marked NFA_SET nodes, in increasing order, and
+   returns their number. */
+
+static int collect_marked(struct lazy_dfa * const dfa) {
+	int len = 0;
+	for(int i = 0; i < dfa->num_nodes; i++)
+		if (dfa->mark[i] == dfa->gen && dfa->node[i].type == NFA_SET) dfa->list[len++] = i;
+	return len;
+}
+
+static uint32_t hash_list(const int * const list, const int len) {
+	uint32_t h = 2166136261U;
+	for(int i = 0; i < len; i++) h = (h ^ list[i]) * 16777619U;
+	return h;
+}
+
+/* Adds the state described by the given list of NFA_SET nodes to the cache,
+   returning its index, or -1 if we run out of memory. */
+
+static int add_state(struct lazy_dfa * const dfa, const int * const list, const int len) {
+	if (dfa->num_states == dfa->max_states) {
+		const int max_states = dfa->max_states * 2;
+		int * const trans = realloc(dfa->trans, sizeof *trans * max_states * dfa->num_cls);
+		if (trans) dfa->trans = trans;
+		int * const set_start = realloc(dfa->set_start, sizeof *set_start * max_states);
+		if (set_start) dfa->set_start = set_start;
+		int * const set_len = realloc(dfa->set_len, sizeof *set_len * max_states);
+		if (set_len) dfa->set_len = set_len;
+		if (!trans || !set_start || !set_len) return -1;
+		dfa->max_states = max_states;
+	}
+
+	if (dfa->pool_len + len > dfa->pool_size) {
+		const int pool_size = max(dfa->pool_size * 2, dfa->pool_len + len);
+		int * const pool = realloc(dfa->pool, sizeof *pool * pool_size);
+		if (!pool) return -1;
+		dfa->pool = pool;
+		dfa->pool_size = pool_size;
+	}
+
+	const int s = dfa->num_states++;
+	memcpy(dfa->pool + dfa->pool_len, list, sizeof *list * len);
+	dfa->set_start[s] = dfa->pool_len;
+	dfa->set_len[s] = len;
+	dfa->pool_len += len;
+	for(int i = 0; i < dfa->num_cls; i++) dfa->trans[s * dfa->num_cls + i] = DFA_UNKNOWN;
+
+	int i = hash_list(list, len) & (DFA_HASH_SIZE - 1);
+	while(dfa->hash[i]) i = (i + 1) & (DFA_HASH_SIZE - 1);
+	dfa->hash[i] = s + 1;
+	return s;
+}
+
+/* Returns the index of the state described by dfa->list, adding it if
+   necessary (possibly flushing the cache, in which case *flushed is set),
+   or -1 if we run out of memory. */
+
+static int find_state(struct lazy_dfa * const dfa, const int len, bool * const flushed) {
+	const uint32_t h = hash_list(dfa->list, len);
+
+	for(int i = h & (DFA_HASH_SIZE - 1); dfa->hash[i]; i = (i + 1) & (DFA_HASH_SIZE - 1)) {
+		const int s = dfa->hash[i] - 1;
+		if (dfa->set_len[s] == len && !memcmp(dfa->pool + dfa->set_start[s], dfa->list, sizeof *dfa->list * len)) return s;
+	}
+
+	if (dfa->num_states == MAX_DFA_STATES) {
+		/* We start afresh, keeping the start state at index 0. */
+		memset(dfa->hash, 0, sizeof dfa->hash);
+		dfa->num_states = dfa->pool_len = 0;
+		if (add_state(dfa, dfa->start_set, dfa->start_len) < 0) return -1;
+		*flushed = true;
+	}
+
+	return add_state(dfa, dfa->list, len);
+}
+
+/* Computes the transition of state s on byte class k, returning the offset
+   in dfa->trans of the row of the target state, or DFA_ACCEPT. */
+
+static int next_state(struct lazy_dfa * const dfa, const int s, const int k) {
+	if (dfa->broken) return DFA_ACCEPT;
+
+	const unsigned char c = dfa->rep[k];
+	const int * const set = dfa->pool + dfa->set_start[s];
+	const int len = dfa->set_len[s];
+	bool match = false, flushed = false;
+
+	/* The search is unanchored, so the start closure is part of every state. */
+	if (++dfa->gen == 0) {
+		memset(dfa->mark, 0, sizeof *dfa->mark * dfa->num_nodes);
+		dfa->gen = 1;
+	}
+	for(int i = 0; i < dfa->start_len; i++) dfa->mark[dfa->start_set[i]] = dfa->gen;
+	for(int i = 0; i < len; i++)
+		if (GET_BIT(dfa->node[set[i]].set, c)) match |= add_closure(dfa, dfa->node[set[i]].out1);
+
+	int t = DFA_ACCEPT;
+	if (!match) {
+		const int list_len = collect_marked(dfa);
+		if (list_len == dfa->start_len) t = 0;
+		else if ((t = find_state(dfa, list_len, &flushed)) < 0) {
+			dfa->broken = true;
+			return DFA_ACCEPT;
+		}
+	}
+
+	if (t != DFA_ACCEPT) t *= dfa->num_cls;
+	if (!flushed) dfa->trans[s * dfa->num_cls + k] = t;
+	return t;
+}
+
+/* Computes the byte classes: two bytes are in the same class if every
+   NFA_SET node accepts either both or none of their translations. */
+
+static void compute_classes(struct lazy_dfa * const dfa, const unsigned char * const t) {
+	unsigned char cls[256];
+	int map[512];
+
+	memset(cls, 0, sizeof cls);
+	dfa->num_cls = 1;
+
+	for(int n = 0; n < dfa->num_nodes; n++) {
+		if (dfa->node[n].type != NFA_SET) continue;
+		int num_cls = 0;
+		memset(map, -1, sizeof map);
+		for(int c = 0; c < 256; c++) {
+			const int key = cls[c] * 2 + GET_BIT(dfa->node[n].set, c);
+			if (map[key] < 0) map[key] = num_cls++;
+			cls[c] = map[key];
+		}
+		dfa->num_cls = num_cls;
+	}
+
+	for(int c = 255; c >= 0; c--) dfa->rep[cls[c]] = c;
+	for(int c = 0; c < 256; c++) dfa->cls[c] = cls[t ? t[c] : c];
+}
+
+
+/* Sets up the Boyer-Moore-Horspool scan for the given required literal,
+   which works on translated bytes, as find() does. */
+
+static void setup_literal(struct lazy_dfa * const dfa, const literal * const l, const unsigned char * const t) {
+	static unsigned char identity[256];
+	const int m = l->len;
+
+	if (!t) {
+		for(int c = 0; c < 256; c++) identity[c] = c;
+		dfa->t = identity;
+	}
+	else dfa->t = t;
+
+	dfa->literal_len = m;
+	memcpy(dfa->literal, l->s, m);
+	for(int c = 0; c < 256; c++) dfa->skip[c] = m;
+	for(int i = 0; i < m - 1; i++)
+		for(int c = 0; c < 256; c++)
+			if (dfa->t[c] == l->s[i]) dfa->skip[c] = m - 1 - i;
+}
+
+
+/* Compiles the given regular expression into a lazy DFA, using the given
+   translation table (or none, if it is NULL) as the regex library does. If
+   utf8 is true, the expression will be matched against UTF-8 text, and
+   a translation table means that case is folded. Returns NULL if the
+   expression is not suitable for filtering, or if we run out of memory. */
+
+struct lazy_dfa *alloc_lazy_dfa(const char * const regex, const unsigned char * const translate, const bool utf8) {
+	struct lazy_dfa * const dfa = calloc(1, sizeof *dfa);
+	if (!dfa) return NULL;
+
+	/* Without UTF-8, each byte of the expression generates at most three nodes. */
+	dfa->max_nodes = 3 * strlen(regex) + 3;
+	if (!(dfa->node = malloc(sizeof *dfa->node * dfa->max_nodes))) {
+		free(dfa);
+		return NULL;
+	}
+
+	dfa_parser ps = { (const unsigned char *)regex, translate, dfa, utf8, false };
+	nfa_frag f = parse_alt(&ps, 0);
+
+	/* An unmatched closed parenthesis means a parse error (or a malformed expression). */
+	if (!ps.fail && !*ps.p) {
+		const int match = new_node(&ps, NFA_MATCH, -1);
+		dfa->node[f.end].out1 = match;
+		dfa->start = f.start;
+	}
+
+	if (!ps.fail && !*ps.p) {
+		dfa->mark = calloc(dfa->num_nodes, sizeof *dfa->mark);
+		dfa->list = malloc(sizeof *dfa->list * dfa->num_nodes);
+		dfa->stack = malloc(sizeof *dfa->stack * dfa->num_nodes);
+		dfa->start_set = malloc(sizeof *dfa->start_set * dfa->num_nodes);
+	}
+
+	if (ps.fail || *ps.p || !dfa->mark || !dfa->list || !dfa->stack || !dfa->start_set) {
+		free_lazy_dfa(dfa);
+		return NULL;
+	}
+
+	setup_literal(dfa, &f.best, translate);
+
+	compute_classes(dfa, translate);
+
+	dfa->gen = 1;
+	if (add_closure(dfa, dfa->start)) {
+		/* The expression matches the empty string, and thus every line. */
+		free_lazy_dfa(dfa);
+		return NULL;
+	}
+
+	dfa->start_len = collect_marked(dfa);
+	memcpy(dfa->start_set, dfa->list, sizeof *dfa->list * dfa->start_len);
+
+	dfa->max_states = 64;
+	dfa->trans = malloc(sizeof *dfa->trans * dfa->max_states * dfa->num_cls);
+	dfa->set_start = malloc(sizeof *dfa->set_start * dfa->max_states);
+	dfa->set_len = malloc(sizeof *dfa->set_len * dfa->max_states);
+	if (!dfa->trans || !dfa->set_start || !dfa->set_len || add_state(dfa, dfa->start_set, dfa->start_len) < 0) {
+		free_lazy_dfa(dfa);
+		return NULL;
+	}
+
+	return dfa;
+}
+
+
+void free_lazy_dfa(struct lazy_dfa * const dfa) {
+	if (!dfa) return;
+	free(dfa->node);
+	free(dfa->mark);
+	free(dfa->list);
+	free(dfa->stack);
+	free(dfa->start_set);
+	free(dfa->trans);
+	free(dfa->set_start);
+	free(dfa->set_len);
+	free(dfa->pool);
+	free(dfa);
+}
+
+
+static bool contains_literal(const struct lazy_dfa * const dfa, const unsigned char * const s, const int64_t len) {
+	const int m = dfa->literal_len;
+
+	if (len < m) return false;
+
+	const unsigned char * const t = dfa->t, * const last = dfa->literal + m - 1;
+	for(const unsigned char *p = s + m - 1; p < s + len; p += dfa->skip[*p]) {
+		if (t[*p] == *last) {
+			int i;
+			for(i = 1; i < m && t[*(p - i)] == *(last - i); i++);
+			if (i == m) return true;
+		}
+	}
+	return false;
+}
+
+
+/* Returns false if the given string certainly does not contain a match of
+   the regular expression dfa has been compiled from. */
+
+bool lazy_dfa_may_match(struct lazy_dfa * const dfa, const char * const s, const int64_t len) {
+	const unsigned char *p = (const unsigned char *)s, * const end = p + len;
+	int row = 0;
+
+	if (dfa->literal_len && !contains_literal(dfa, p, len)) return false;
+
+	while(p < end) {
+		const int k = dfa->cls[*p++];
+		int t = dfa->trans[row + k];
+		if (t < 0 && (t == DFA_ACCEPT || (t = next_state(dfa, row / dfa->num_cls, k)) == DFA_ACCEPT)) return true;
+		row = t;
+	}
+
+	return false;
+}
+
+
+/* Sets *literal to the literal that every match of the regular expression
+   dfa has been compiled from must contain (as translated bytes), and returns
+   its length, or 0 if there is no such literal. */
+
+int lazy_dfa_literal(const struct lazy_dfa * const dfa, const char ** const literal) {
+	*literal = (const char *)dfa->literal;
+	return dfa->literal_len;
+}
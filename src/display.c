@@ -23,6 +23,8 @@
 #include "support.h"
 #include "cm.h"
 #include "termchar.h"
+#include <pthread.h>
+#include <signal.h>
 
 
 /* The functions in this file act as an interface between the main code and the
@@ -38,6 +40,17 @@
 
 #define TURBO (turbo ? turbo : ne_lines * 2)
 
+/* The number of lines after the end of the window whose initial syntax
+   states are updated immediately after a change (see update_syntax_states()). */
+
+#define SYNTAX_MARGIN 128
+
+/* Runs of at least this number of lines are parsed speculatively in parallel
+   by at most MAX_SYNTAX_THREADS threads (see parallel_syntax_states()). */
+
+#define PARALLEL_SYNTAX_LINES (1 << 16)
+#define MAX_SYNTAX_THREADS 16
+
 
 /* If true, the current line has changed and care must be taken to update the initial state of the following lines. */
 
@@ -72,6 +85,115 @@ int highlight_cmp(HIGHLIGHT_STATE *x, HIGHLIGHT_STATE *y) {
 }
 
 
+/* The attributes of recently displayed lines are kept in a direct-mapped
+   cache indexed by line descriptor, so that repainting a line that has
+   already been displayed does not require parsing it again. Attributes are
+   stored as runs (attribute, length). An entry is valid only if the line
+   has the same length and content (checked using a hash), syntax, encoding
+   and initial state as when the entry was filled: thus, an edit implicitly
+   invalidates the entries of the lines it modifies, and changes of initial
+   state are detected, too. */
+
+#define ATTR_CACHE_BITS 10
+/* Entries with more runs than this free them when reused. */
+#define ATTR_CACHE_MAX_RUNS 4096
+
+typedef struct {
+	const line_desc *ld;
+	const struct high_syntax *syn;
+	uint64_t hash;
+	int64_t line_len;
+	bool utf8;
+	HIGHLIGHT_STATE state, next_state;
+	int64_t attr_len;           /* As set by parse(): the attributes are attr_len + 1, including the final newline. */
+	uint32_t (*run)[2];         /* Runs (attribute, length). */
+	int64_t num_runs, run_size;
+} attr_cache_entry;
+
+static attr_cache_entry attr_cache[1 << ATTR_CACHE_BITS];
+
+static uint64_t line_hash(const char * const line, const int64_t len) {
+	uint64_t h = len, x;
+	int64_t i;
+	for(i = 0; i + 8 <= len; i += 8) {
+		memcpy(&x, line + i, sizeof x);
+		h = (h ^ x) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 32;
+	}
+	for(x = 0; i < len; i++) x = x << 8 | (unsigned char)line[i];
+	h = (h ^ x) * 0x9E3779B97F4A7C15ULL;
+	return h ^ h >> 29;
+}
+
+/* Works like parse(b->syn, ld, ld->highlight_state, ...), leaving the
+   attributes of the line in attr_buf and their number in attr_len, but
+   uses the attribute cache when possible. */
+
+HIGHLIGHT_STATE parse_cached(buffer * const b, line_desc * const ld) {
+	const bool utf8 = b->encoding == ENC_UTF8;
+
+	assert(b->syn);
+	if (ld->highlight_state.state < 0) return parse(b->syn, ld, ld->highlight_state, utf8);
+
+	attr_cache_entry * const e = &attr_cache[(uint64_t)(uintptr_t)ld * 0x9E3779B97F4A7C15ULL >> (64 - ATTR_CACHE_BITS)];
+	const uint64_t hash = line_hash(ld->line, ld->line_len);
+
+	if (e->ld == ld && e->syn == b->syn && e->utf8 == utf8 && e->line_len == ld->line_len && e->hash == hash && highlight_cmp(&e->state, &ld->highlight_state)) {
+		if (attr_size < e->attr_len + 1) {
+			uint32_t * const a = realloc(attr_buf, (e->attr_len + 1) * sizeof *attr_buf);
+			if (!a) return parse(b->syn, ld, ld->highlight_state, utf8);
+			attr_buf = a;
+			attr_size = e->attr_len + 1;
+		}
+		uint32_t *a = attr_buf;
+		for(int64_t i = 0; i < e->num_runs; i++)
+			for(uint32_t j = e->run[i][1]; j-- != 0;) *(a++) = e->run[i][0];
+		attr_len = e->attr_len;
+		return e->next_state;
+	}
+
+	const HIGHLIGHT_STATE next_state = parse(b->syn, ld, ld->highlight_state, utf8);
+	if (next_state.state < 0) {
+		e->ld = NULL;
+		return next_state;
+	}
+
+	if (e->run_size > ATTR_CACHE_MAX_RUNS) {
+		free(e->run);
+		e->run = NULL;
+		e->run_size = 0;
+	}
+	e->num_runs = 0;
+	for(int64_t i = 0; i <= attr_len; i++) {
+		if (e->num_runs && e->run[e->num_runs - 1][0] == attr_buf[i] && e->run[e->num_runs - 1][1] != UINT32_MAX) {
+			e->run[e->num_runs - 1][1]++;
+			continue;
+		}
+		if (e->num_runs == e->run_size) {
+			uint32_t (* const run)[2] = realloc(e->run, (e->run_size * 2 + 8) * sizeof *e->run);
+			if (!run) {
+				e->ld = NULL;
+				return next_state;
+			}
+			e->run = run;
+			e->run_size = e->run_size * 2 + 8;
+		}
+		e->run[e->num_runs][0] = attr_buf[i];
+		e->run[e->num_runs++][1] = 1;
+	}
+
+	e->ld = ld;
+	e->syn = b->syn;
+	e->hash = hash;
+	e->line_len = ld->line_len;
+	e->utf8 = utf8;
+	e->state = ld->highlight_state;
+	e->next_state = next_state;
+	e->attr_len = attr_len;
+	return next_state;
+}
+
+
 
 /* Updates the initial syntax state of line descriptors starting from a given line descriptor.
 If row is nonnegative, we assume that we have also to update differentially the given lines.
@@ -85,6 +207,11 @@ initial state concides with the final state of the previous line; in case you wa
 more lines to be updated, you can provide a non-NULL end_ld. Note that, in any case, we
 update only visible lines (albeit initial states will be updated as necessary).
 
+Since a single keystroke (e.g., opening a comment) can change the state of all following
+lines, the update stops SYNTAX_MARGIN lines after the end of the window, or after the given
+line descriptor, whichever comes last. The buffer syntax frontier records where the update
+stopped, so that continue_syntax_states() can complete it later.
+
 This function uses the local attribute buffer: thus, after a call the local attribute buffer
 could be invalidated. */
 
@@ -93,17 +220,45 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 	if (b->syn && need_attr_update) {
 		bool got_end_ld = end_ld == NULL;
 		bool invalidate_attr_buf = false;
-		HIGHLIGHT_STATE next_line_state = b->attr_len < 0 ? parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8) : b->next_state;
+		HIGHLIGHT_STATE next_line_state = b->attr_len < 0 ? parse_cached(b, ld) : b->next_state;
 		assert(b->attr_len < 0 || b->attr_len == calc_char_len(ld, ld->line_len, b->encoding));
 
+		const int64_t start = line_desc_number(b, ld);
+		const int64_t limit = start < 0 ? INT64_MAX : max(start, b->cur_line - b->cur_y + ne_lines - 2) + SYNTAX_MARGIN;
+		int64_t n = start;
+
 		for(;;) {
 
 			/* We move one row down. */
 			ld = (line_desc *) ld->ld_node.next;
+			n++;
 
 			/* We update lines until next_line_state is equal to our current highlight_state, but we go until
 			   end_ld if it is not NULL. In any case, we bail out at the end of the file. */
-			if ((highlight_cmp(&ld->highlight_state, &next_line_state) && got_end_ld) || !ld->ld_node.next) break;
+			if ((highlight_cmp(&ld->highlight_state, &next_line_state) && got_end_ld) || !ld->ld_node.next) {
+				/* Stops in the range we have just updated have been resolved. */
+				if (start >= 0 && b->syntax_frontier >= start && b->syntax_frontier < n) {
+					if (b->syntax_frontier_end < n || !ld->ld_node.next) b->syntax_frontier = -1;
+					else {
+						b->syntax_frontier = n;
+						b->syntax_frontier_ld = ld;
+					}
+				}
+				break;
+			}
+
+			if (n > limit) {
+				int64_t end = n - 1;
+				if (!got_end_ld) for(line_desc *p = ld; p->ld_node.next && p != end_ld; p = (line_desc *)p->ld_node.next) end++;
+				if (b->syntax_frontier < 0 || b->syntax_frontier >= start) {
+					if (b->syntax_frontier < 0) b->syntax_frontier_end = end;
+					b->syntax_frontier = n - 1;
+					b->syntax_frontier_ld = (line_desc *)ld->ld_node.prev;
+				}
+				b->syntax_frontier_end = max(b->syntax_frontier_end, end);
+				break;
+			}
+
 			if (row >= 0) {
 				row++;
 				if (row < ne_lines - 1) {
@@ -125,7 +280,7 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 
 			/* This is where we go on parsing each line, updating highlight_state and next_line_state at each step. */
 			ld->highlight_state = next_line_state;
-			next_line_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+			next_line_state = row >= 0 && row < ne_lines - 1 ? parse_cached(b, ld) : parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
 
 			/* If we are in the visible range and window_needs_refresh is false, b->attr_buf contains the
 			   current on-screen attributes, whereas attr_buf contains the new attributes, so we can
@@ -142,6 +297,148 @@ void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld)
 }
 
 
+/* Returns true if update_syntax_states() left some work to
+   continue_syntax_states(). */
+
+bool syntax_states_pending(const buffer * const b) {
+	return b->syn && b->syntax_frontier >= 0;
+}
+
+
+typedef struct {
+	pthread_t thread;
+	struct high_syntax *syn;
+	line_desc *ld;          /* The first line of the chunk. */
+	int64_t len;            /* The number of lines of the chunk. */
+	HIGHLIGHT_STATE state;  /* The (guessed) initial state of the chunk; after parsing, the state after the chunk. */
+	bool utf8;
+} syntax_chunk;
+
+/* Sets the initial states of the lines of a chunk, starting from its
+   initial state. Can be run by any thread, as it uses a private
+   attribute buffer. */
+
+static void *parse_chunk(void *arg) {
+	syntax_chunk * const c = arg;
+	uint32_t *buf = NULL;
+	int64_t size = 0, len;
+	line_desc *ld = c->ld;
+
+	for(int64_t i = 0; i < c->len; i++, ld = (line_desc *)ld->ld_node.next) {
+		ld->highlight_state = c->state;
+		c->state = parse_r(c->syn, ld, c->state, c->utf8, &buf, &size, &len);
+	}
+
+	free(buf);
+	return NULL;
+}
+
+
+/* Sets the initial states of the n lines following ld, given the state after
+   ld, and returns the state after the last line.
+
+   The lines are divided into chunks that are parsed in parallel. Since the
+   initial state of a chunk is known only when the previous chunk has been
+   parsed, all chunks but the first one start from the initial state of the
+   parser. A sequential pass then reparses each wrongly guessed chunk until its
+   states coincide with the speculative ones, which usually happens after a
+   few lines. */
+
+static HIGHLIGHT_STATE parallel_syntax_states(buffer * const b, line_desc *ld, const HIGHLIGHT_STATE state, const int64_t n) {
+	const long p = sysconf(_SC_NPROCESSORS_ONLN);
+	const int num_chunks = p < 1 ? 1 : p > MAX_SYNTAX_THREADS ? MAX_SYNTAX_THREADS : p;
+	const HIGHLIGHT_STATE initial_state = { 0, 0, "" };
+	syntax_chunk c[MAX_SYNTAX_THREADS];
+
+	for(int i = 0; i < num_chunks; i++) {
+		c[i].syn = b->syn;
+		c[i].utf8 = b->encoding == ENC_UTF8;
+		c[i].ld = ld = (line_desc *)ld->ld_node.next;
+		c[i].len = n / num_chunks + (i < n % num_chunks);
+		c[i].state = i == 0 ? state : initial_state;
+		for(int64_t j = 1; j < c[i].len; j++) ld = (line_desc *)ld->ld_node.next;
+	}
+
+	/* Signals must be handled by the main thread. */
+	sigset_t all, mask;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &mask);
+	parallel_parse = true;
+	int started;
+	for(started = 1; started < num_chunks; started++)
+		if (pthread_create(&c[started].thread, NULL, parse_chunk, c + started)) break;
+	pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+	for(int i = started; i < num_chunks; i++) parse_chunk(c + i);
+	parse_chunk(c);
+	for(int i = 1; i < started; i++) pthread_join(c[i].thread, NULL);
+	parallel_parse = false;
+
+	/* Fix-up pass: c[i - 1].state is now the correct initial state of chunk i. */
+	for(int i = 1; i < num_chunks; i++) {
+		HIGHLIGHT_STATE s = c[i - 1].state;
+		ld = c[i].ld;
+		int64_t j;
+		for(j = 0; j < c[i].len && (j == 0 || !highlight_cmp(&ld->highlight_state, &s)); j++, ld = (line_desc *)ld->ld_node.next) {
+			ld->highlight_state = s;
+			s = parse(b->syn, ld, s, c[i].utf8);
+		}
+		if (j == c[i].len) c[i].state = s;
+	}
+
+	return c[num_chunks - 1].state;
+}
+
+
+/* Continues the update of initial syntax states from the syntax frontier,
+   updating at most n lines. Returns true if the initial state of a visible
+   line has changed (in which case the window should be updated). */
+
+bool continue_syntax_states(buffer * const b, int64_t n) {
+	assert(syntax_states_pending(b));
+
+	const int64_t top = b->cur_line - b->cur_y, bottom = top + ne_lines - 2;
+	line_desc *ld = b->syntax_frontier_ld;
+	int64_t line = b->syntax_frontier;
+	HIGHLIGHT_STATE next_line_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+	bool changed = false;
+
+	/* While profiling, counters are updated by a single thread. */
+	if (!syntax_stats && n >= PARALLEL_SYNTAX_LINES && b->num_lines - 1 - line >= PARALLEL_SYNTAX_LINES) {
+		const int64_t m = min(n, b->num_lines - 1 - line) - 1;
+		next_line_state = parallel_syntax_states(b, ld, next_line_state, m);
+		changed = line + m >= top && line < bottom;
+		for(int64_t i = 0; i < m; i++) ld = (line_desc *)ld->ld_node.next;
+		line += m;
+		n -= m;
+	}
+
+	for(;;) {
+		ld = (line_desc *)ld->ld_node.next;
+		line++;
+
+		if (!ld->ld_node.next || line > b->syntax_frontier_end && highlight_cmp(&ld->highlight_state, &next_line_state)) {
+			b->syntax_frontier = -1;
+			break;
+		}
+
+		if (n-- == 0) {
+			b->syntax_frontier = line - 1;
+			b->syntax_frontier_ld = (line_desc *)ld->ld_node.prev;
+			b->syntax_frontier_end = max(b->syntax_frontier_end, line - 1);
+			break;
+		}
+
+		if (line >= top && line <= bottom && !highlight_cmp(&ld->highlight_state, &next_line_state)) changed = true;
+		ld->highlight_state = next_line_state;
+		next_line_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+	}
+
+	if (changed) b->attr_len = -1;
+	return changed;
+}
+
+
 /* Outputs part of a line descriptor at the given screen row and column.
    The output will start at the first character of the line with a column
    position larger than or equal to from_col, and will continue until
@@ -169,9 +466,19 @@ void output_line_desc(const int row, const int col, const line_desc *ld, const i
 		ld->line + pos. The actual output screen column at any time is
 		col + curr_col - from_col. */
 
-	const char *s = ld->line;
 	int64_t curr_col = 0, pos = 0, attr_pos = 0;
 
+	/* On long lines, we skip the characters before the last checkpoint of
+	   the column index preceding from_col, as they would not be output. */
+	if (ld->line_len >= COL_INDEX_MIN_LEN) {
+		const col_checkpoint * const cp = col_checkpoint_by_col(ld, from_col, tab_size, utf8 ? ENC_UTF8 : ENC_8_BIT);
+		curr_col = cp->width;
+		pos = cp->pos;
+		attr_pos = cp->chars;
+	}
+
+	const char *s = ld->line + pos;
+
 	while(curr_col - from_col < num_cols && pos < ld->line_len) {
 		const int64_t output_col = col + curr_col - from_col;
 		const int c = utf8 ? get_char(s, ENC_UTF8) : *s;
@@ -287,7 +594,7 @@ void update_line(buffer * const b, line_desc * const ld, const int row, const in
 
 	if (b->syn) {
 		const bool differential = ld == b->cur_line_desc && b->attr_len >= 0;
-		HIGHLIGHT_STATE next_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+		HIGHLIGHT_STATE next_state = parse_cached(b, ld);
 		output_line_desc(row, 0, ld, b->win_x, ne_columns, b->opt.tab_size, cleared_at_end, b->encoding == ENC_UTF8, attr_buf, differential ? b->attr_buf : NULL, differential ? b->attr_len : 0);
 
 		if (ld == b->cur_line_desc) {
@@ -322,10 +629,14 @@ void update_window_lines(buffer * const b, line_desc * ld, const int start_line,
 	if (first_line != start_line) for(uint64_t i = first_line - start_line; i-- != 0; ) ld = (line_desc *)ld->ld_node.next;
 	assert_line_desc(ld, b->encoding);
 
+	/* When updating several lines, we capture the output, so that blocks of
+	   lines that are just shifted can be moved by scrolling the terminal. */
+	const bool captured = last_line > first_line && capture_lines(first_line, last_line);
+
 	int i;
 	for(i = first_line; i <= last_line && i + b->win_y < b->num_lines; i++) {
 		assert(ld->ld_node.next != NULL);
-		if (b->syn) parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+		if (b->syn) parse_cached(b, ld);
 		output_line_desc(i, 0, ld, b->win_x, ne_columns, b->opt.tab_size, false, b->encoding == ENC_UTF8, b->syn ? attr_buf : NULL, NULL, 0);
 		ld = (line_desc *)ld->ld_node.next;
 	}
@@ -335,6 +646,8 @@ void update_window_lines(buffer * const b, line_desc * ld, const int start_line,
 		clear_to_eol();
 	}
 
+	if (captured) flush_captured_lines();
+
 	window_needs_refresh = false;
 	first_line = ne_lines;
 	last_line = -1;
@@ -678,6 +991,10 @@ void reset_window(void) {
    interact, so that he is presented with a correctly updated display. */
 
 void refresh_window(buffer * const b) {
+	/* Visible lines must have valid initial syntax states. */
+	const int64_t bottom = b->cur_line - b->cur_y + ne_lines - 2;
+	if (syntax_states_pending(b) && b->syntax_frontier < bottom && continue_syntax_states(b, bottom + SYNTAX_MARGIN - b->syntax_frontier)) reset_window();
+
 	if (window_needs_refresh) {
 		line_desc *ld = b->top_line_desc;
 		for(int i = first_line; i-- != 0 && (line_desc *)ld->ld_node.next;) ld = (line_desc *)ld->ld_node.next;
@@ -728,6 +1045,8 @@ void scroll_window(buffer * const b, line_desc * const ld, const int line, const
 
 void ensure_attributes(buffer *b) {
 	if (! b->syn || b->attr_len >= 0) return;
+	/* The current line might not be visible (e.g., during a macro). */
+	if (syntax_states_pending(b) && b->syntax_frontier < b->cur_line) continue_syntax_states(b, b->cur_line - b->syntax_frontier);
 	store_attributes(b, b->cur_line_desc);
 }
 
@@ -739,7 +1058,7 @@ void ensure_attributes(buffer *b) {
    (b->attr_len = -1). */
 
 void store_attributes(buffer *b, line_desc *ld) {
-	b->next_state = parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+	b->next_state = parse_cached(b, ld);
 	assert(calc_char_len(ld, ld->line_len, b->encoding) == attr_len);
 	// This test is necessary to avoid warnings from -fsanitize
 	ensure_attr_buf(b, attr_len);
@@ -895,3 +1214,46 @@ void highlight_mark(buffer * const b, const bool show) {
 	}
 }
 
+
+
+/* (Un)highlights (depending on the value of show) the len bytes starting at
+   the cursor position, which are the current occurrence of an incremental
+   search. Since the text cannot change while the search is in progress,
+   unhighlighting simply redraws the line, which must still be on the same
+   row: thus, this function must be called with show false before moving the
+   cursor. */
+
+void highlight_match(buffer * const b, const int64_t len, const bool show) {
+	static line_desc *ld;
+	static int row;
+	static bool shown;
+
+	if (shown) {
+		b->attr_len = -1;
+		update_line(b, ld, row, 0, false);
+		shown = false;
+	}
+
+	if (!show || !len || fast_gui) return;
+
+	ld = b->cur_line_desc;
+	row = b->cur_y;
+	if (b->syn) parse(b->syn, ld, ld->highlight_state, b->encoding == ENC_UTF8);
+
+	int64_t width = calc_width(ld, b->cur_pos, b->opt.tab_size, b->encoding);
+	int64_t char_pos = calc_char_len(ld, b->cur_pos, b->encoding);
+
+	for(int64_t pos = b->cur_pos; pos < b->cur_pos + len && pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding), char_pos++) {
+		const int c_width = ld->line[pos] == '\t' ? b->opt.tab_size - width % b->opt.tab_size : get_char_width(&ld->line[pos], b->encoding);
+		const int64_t x = width - b->win_x;
+		width += c_width;
+		if (x < 0 || ld->line[pos] == '\t') continue;
+		if (x + c_width > ne_columns) break;
+		move_cursor(row, x);
+		output_char(get_char(&ld->line[pos], b->encoding), (b->syn ? attr_buf[char_pos] : 0) ^ INVERSE, b->encoding == ENC_UTF8);
+		shown = true;
+	}
+
+	/* Without syntax highlighting, attributes are never reset when outputting. */
+	if (shown && !b->syn) set_attr(0);
+}
@@ -22,9 +22,6 @@
 #include "ne.h"
 #include "support.h"
 
-/* The number of type of brackets we recognize. */
-#define NUM_BRACKETS 5
-
 /* Applies a given to_first() function to the first letter of the text starting at the cursor,
    and to_rest() to the following alphabetical letters (see the functions below). */
 
@@ -124,10 +121,12 @@ int capitalize(buffer *b) {
 
 
 /* Finds which bracket matches the bracket under the cursor, and moves it
-   there. Various error codes can be returned. */
+   there. Various error codes can be returned. On large documents, the first
+   call builds the bracket index (see bracket.c). */
 
 int match_bracket(buffer *b) {
 	int64_t match_line, match_pos;
+	build_bracket_index(b);
 	const int rc = find_matching_bracket(b, 0, b->num_lines-1, &match_line, &match_pos, NULL, NULL);
 	if (rc == OK) {
 		goto_line_pos(b, match_line, match_pos);
@@ -138,64 +137,43 @@ int match_bracket(buffer *b) {
 
 int find_matching_bracket(buffer *b, const int64_t min_line, int64_t max_line, int64_t *match_line, int64_t *match_pos, int *c, line_desc ** match_ld) {
 
-	static unsigned char bracket_table[NUM_BRACKETS][2] = { { '(', ')'  },
-	                                                        { '[', ']'  },
-	                                                        { '{', '}'  },
-	                                                        { '<', '>'  },
-	                                                        { '`', '\'' } };
-
 	line_desc *ld = b->cur_line_desc;
 
 	if (b->cur_pos >= ld->line_len) return NOT_ON_A_BRACKET;
 
-	int i, j, dir;
-	for(i = 0; i < NUM_BRACKETS; i++) {
-		for(j = 0; j < 2; j++)
-			if (ld->line[b->cur_pos] == bracket_table[i][j]) break;
-		if (j < 2) break;
-	}
-
-	if (i == NUM_BRACKETS && j == 2) return NOT_ON_A_BRACKET;
+	const int type = bracket_type(ld->line[b->cur_pos]);
+	if (type < 0) return NOT_ON_A_BRACKET;
 
-	if (j) dir = -1;
-	else dir = 1;
+	/* We scan forwards from opening brackets, and backwards from closing
+	brackets. find_bracket_in_line() and skip_bracket_blocks() keep track of
+	the number n of brackets still to be matched. */
 
-	int n = 0;
-	int64_t pos = b->cur_pos, y = b->cur_line;
+	const bool back = type & 1;
+	int64_t n = 0, pos = b->cur_pos, y = b->cur_line;
 
 	while(ld->ld_node.next && ld->ld_node.prev && y >= min_line && y <= max_line) {
 
-		if (pos >= 0) {
-			char * const line = ld->line;
-			while(pos >= 0 && pos < ld->line_len) {
-
-				if (line[pos] == bracket_table[i][j]) n++;
-				else if (line[pos] == bracket_table[i][1 - j]) n--;
-
-				if (n == 0) {
-					*match_line = y;
-					*match_pos  = pos;
-					if (c) *c = line[pos];
-					if (match_ld) *match_ld = ld;
-					return OK;
-				}
-				if (dir > 0) pos = next_pos(line, pos, b->encoding);
-				else pos = prev_pos(line, pos, b->encoding);
-			}
+		if (pos >= 0 && (pos = find_bracket_in_line(ld, pos, type, &n)) >= 0) {
+			*match_line = y;
+			*match_pos  = pos;
+			if (c) *c = ld->line[pos];
+			if (match_ld) *match_ld = ld;
+			return OK;
 		}
 
-		pos = -1;
-
-		if (dir == 1) {
-			ld = (line_desc *)ld->ld_node.next;
-			if (ld->ld_node.next && ld->line) pos = 0;
-			y++;
-		}
-		else {
+		if (back) {
 			ld = (line_desc *)ld->ld_node.prev;
-			if (ld->ld_node.prev && ld->line) pos = ld->line_len - 1;
 			y--;
 		}
+		else {
+			ld = (line_desc *)ld->ld_node.next;
+			y++;
+		}
+
+		if (b->bracket_index && ld->ld_node.next && ld->ld_node.prev) ld = skip_bracket_blocks(b, ld, &y, type, &n, min_line, max_line);
+
+		pos = -1;
+		if (ld->ld_node.next && ld->ld_node.prev && ld->line) pos = back ? ld->line_len - 1 : 0;
 	}
 
 	return CANT_FIND_BRACKET;
@@ -91,10 +91,10 @@ char *error_msg[ERROR_COUNT] = {
 	/* 63 */ "Invalid Shift specified (use [<|>][#][s|t]; default is \">1t\").",
 	/* 64 */ "Insufficient white space for requested left shift.",
 	/* 65 */ "Document not saved.",
-	/* 66 */ "File is too large--syntax highlighting disabled (use SYNTAX to reactivate).",
-	/* 67 */ "Cannot save: disk full.",
-	/* 68 */ "Out of memory (insufficient disk space?). DANGER!",
-	/* 69 */ "Invalid Bracketed Paste designation (use '0', '1', or two macro names)."
+	/* 66 */ "Cannot save: disk full.",
+	/* 67 */ "Out of memory (insufficient disk space?). DANGER!",
+	/* 68 */ "Invalid Bracketed Paste designation (use '0', '1', or two macro names).",
+	/* 69 */ "This line is not a Grep hit (file:line:text)."
 };
 
 char *info_msg[INFO_COUNT] = {
@@ -109,10 +109,10 @@ enum error {
 	/* 63 */ INVALID_SHIFT_SPECIFIED,
 	/* 64 */ INSUFFICIENT_WHITESPACE,
 	/* 65 */ DOCUMENT_NOT_SAVED,
-	/* 66 */ FILE_TOO_LARGE_SYNTAX_HIGHLIGHTING_DISABLED,
-	/* 67 */ CANNOT_SAVE_DISK_FULL,
-	/* 68 */ OUT_OF_MEMORY_DISK_FULL,
-	/* 69 */ INVALID_BRACKETED_PASTE_DESIGNATION,
+	/* 66 */ CANNOT_SAVE_DISK_FULL,
+	/* 67 */ OUT_OF_MEMORY_DISK_FULL,
+	/* 68 */ INVALID_BRACKETED_PASTE_DESIGNATION,
+	/* 69 */ NOT_A_HIT,
 
 	ERROR_COUNT
 };
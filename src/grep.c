@@ -0,0 +1,640 @@
+/* Multi-file search (the Grep command).
+
+   Copyright (C) 2026 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+#include "regex.h"
+#include "support.h"
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+
+/* grep() searches the current search pattern in a set of files, and
+   collects the hits, in the form file:line:text, in a new document.
+
+   The main thread enumerates the files, while a pool of worker threads
+   scans them, each with its own copy of the compiled pattern (the regex
+   library and the lazy DFA are not thread safe). Files are mapped in memory
+   (small files are read in a single call), and never loaded as documents.
+   The hits of each file are gathered by the worker that scans it; the main
+   thread appends them to the results document in the order in which files
+   have been enumerated, refreshing the display every GREP_REFRESH_MS
+   milliseconds, and cancels the search if stop becomes true. Hits are
+   collected also while files are being enumerated, so the first ones appear
+   before the enumeration of a large tree completes. */
+
+/* The maximum number of worker threads. */
+
+#define MAX_GREP_THREADS 64
+
+/* Files shorter than this are read rather than mapped. */
+
+#define GREP_READ_SIZE (64 * 1024)
+
+/* A file containing a NUL within its first GREP_BINARY_PROBE bytes is
+   considered binary, and skipped. */
+
+#define GREP_BINARY_PROBE 4096
+
+/* The delay between display refreshes while hits are collected. */
+
+#define GREP_REFRESH_MS 100
+
+/* This macro upper cases a character or not, depending on g.sense_case. */
+
+#define CONV(c) (g.sense_case ? (unsigned char)(c) : g.up_case[(unsigned char)(c)])
+
+typedef struct {
+	char *name;
+	char *hits;        /* The hits, as a stream of file:line:text lines. */
+	int64_t hits_len;
+	bool done;         /* The file has been scanned. */
+} grep_file;
+
+typedef struct {
+	pthread_t thread;
+	struct re_pattern_buffer pb;
+	struct lazy_dfa *dfa;
+	char *hits, *buf;
+	int64_t hits_len, hits_size;
+} grep_worker;
+
+/* The file list is shared by the main thread, which fills it, and by the
+   workers; it is protected by grep_mutex. Workers wait on more_files for new
+   files, and the main thread waits on more_hits for scanned files. */
+
+static pthread_mutex_t grep_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t more_files = PTHREAD_COND_INITIALIZER, more_hits = PTHREAD_COND_INITIALIZER;
+
+static struct {
+	grep_file *file;
+	int64_t num_files, max_files, next_file;
+	bool walk_done;
+	volatile bool cancel;
+
+	const unsigned char *pattern;
+	int m;
+	bool regexp, sense_case;
+	const unsigned char *up_case;
+	unsigned int d[256];   /* The Boyer-Moore skip table for literal patterns. */
+	locale_t locale;       /* The locale for regular expressions. */
+
+	/* The following fields are used by the main thread only. */
+	buffer *results;       /* The results document. */
+	int64_t collected;     /* The number of files whose hits have been appended to results. */
+	int64_t num_hits;
+	struct timespec last_refresh;
+	bool refresh;          /* results has changed since last_refresh. */
+} g;
+
+
+/* Appends to the hits of w the given line of the given file. */
+
+static void add_hit(grep_worker * const w, const char * const name, const int64_t line, const char * const s, int64_t len) {
+	if (len > 0 && s[len - 1] == '\r') len--;
+
+	char num[24];
+	const int64_t name_len = strlen(name), num_len = sprintf(num, ":%" PRId64 ":", line + 1);
+	const int64_t size = w->hits_len + name_len + num_len + len + 1;
+
+	if (size > w->hits_size) {
+		const int64_t new_size = max(size, w->hits_size * 2);
+		char * const p = realloc(w->hits, new_size);
+		if (!p) return;
+		w->hits = p;
+		w->hits_size = new_size;
+	}
+
+	char *p = w->hits + w->hits_len;
+	memcpy(p, name, name_len);
+	memcpy(p += name_len, num, num_len);
+	memcpy(p += num_len, s, len);
+	p[len] = 0;
+	w->hits_len = size;
+}
+
+
+/* Scans a buffer for a literal pattern, using the same simplified
+   Boyer-Moore algorithm as find(). */
+
+static void scan_literal(grep_worker * const w, const char * const name, const char * const buf, const int64_t size) {
+	const int m = g.m;
+	const unsigned char first_char = CONV(g.pattern[m - 1]);
+	const char * const e = buf + size, *line = buf, *p = buf + m - 1;
+	int64_t n = 0;
+
+	while(p < e && !g.cancel) {
+		const unsigned char c = CONV(*p);
+		if (c != first_char) p += g.d[c];
+		else {
+			int i;
+			for (i = 1; i < m; i++)
+				if (CONV(*(p - i)) != CONV(g.pattern[m - i - 1])) {
+					p += g.d[c];
+					break;
+				}
+			if (i == m) {
+				/* Patterns cannot contain newlines, so the match is within a line. */
+				for(const char *q; q = memchr(line, '\n', p - line); line = q + 1) n++;
+				const char *eol = memchr(p, '\n', e - p);
+				if (!eol) eol = e;
+				add_hit(w, name, n++, line, eol - line);
+				line = eol + 1;
+				p = line + m - 1;
+			}
+		}
+	}
+}
+
+
+/* Scans a buffer for a regular expression, line by line. The lazy DFA, if
+   available, discards lines that cannot contain a match. */
+
+static void scan_regexp(grep_worker * const w, const char * const name, const char * const buf, const int64_t size) {
+	const char * const e = buf + size;
+	int64_t n = 0;
+
+	for(const char *p = buf; p < e && !g.cancel; n++) {
+		const char *q = memchr(p, '\n', e - p);
+		if (!q) q = e;
+		const int64_t len = q - p;
+		if ((!w->dfa || lazy_dfa_may_match(w->dfa, p, len)) && re_search(&w->pb, p, len, 0, len, NULL) >= 0) add_hit(w, name, n, p, len);
+		p = q + 1;
+	}
+}
+
+
+/* Scans a file, leaving its hits in w->hits. */
+
+static void scan_file(grep_worker * const w, const char * const name) {
+	const int fd = open(name, O_RDONLY);
+	if (fd < 0) return;
+
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+
+	int64_t size = st.st_size;
+	char *buf = NULL;
+	bool mapped = false;
+
+	if (size < GREP_READ_SIZE) {
+		if (!w->buf) w->buf = malloc(GREP_READ_SIZE);
+		if (buf = w->buf) {
+			size = read(fd, buf, size);
+			if (size <= 0) buf = NULL;
+		}
+	}
+	else if ((buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+		mapped = true;
+		posix_madvise(buf, size, POSIX_MADV_SEQUENTIAL);
+	}
+	else buf = NULL;
+
+	close(fd);
+	if (!buf) return;
+
+	if (!memchr(buf, 0, min(size, GREP_BINARY_PROBE))) (g.regexp ? scan_regexp : scan_literal)(w, name, buf, size);
+
+	if (mapped) munmap(buf, size);
+}
+
+
+static void *grep_thread(void * const arg) {
+	grep_worker * const w = arg;
+	if (g.regexp && g.locale) uselocale(g.locale);
+
+	pthread_mutex_lock(&grep_mutex);
+	for(;;) {
+		while(!g.cancel && g.next_file == g.num_files && !g.walk_done) pthread_cond_wait(&more_files, &grep_mutex);
+		if (g.cancel || g.next_file == g.num_files) break;
+
+		/* The file list might be reallocated by the walk in the meantime. */
+		const int64_t i = g.next_file++;
+		const char * const name = g.file[i].name;
+		pthread_mutex_unlock(&grep_mutex);
+
+		scan_file(w, name);
+
+		pthread_mutex_lock(&grep_mutex);
+		g.file[i].hits = w->hits;
+		g.file[i].hits_len = w->hits_len;
+		g.file[i].done = true;
+		w->hits = NULL;
+		w->hits_len = w->hits_size = 0;
+		pthread_cond_signal(&more_hits);
+	}
+	pthread_mutex_unlock(&grep_mutex);
+	return NULL;
+}
+
+
+static int64_t elapsed_ms(const struct timespec * const t) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (now.tv_sec - t->tv_sec) * 1000 + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+
+/* Appends a stream of hits to the results document. */
+
+static void append_hits(buffer * const r, const char * const s, const int64_t len) {
+	const encoding_type encoding = detect_encoding(s, len);
+	if (r->encoding == ENC_ASCII) r->encoding = encoding;
+	else if (encoding != ENC_ASCII && encoding != r->encoding) r->encoding = ENC_8_BIT;
+
+	line_desc * const ld = (line_desc *)r->line_desc_list.tail_pred;
+	insert_stream(r, ld, r->num_lines - 1, ld->line_len, s, len);
+}
+
+
+/* Appends to the results document the hits of the files scanned so far, in
+   enumeration order, and refreshes the display (if it has changed) when
+   GREP_REFRESH_MS milliseconds have elapsed since the last refresh. Must be
+   called by the main thread, with grep_mutex locked. */
+
+static void collect_hits(void) {
+	while(g.collected < g.num_files && g.file[g.collected].done) {
+		char * const hits = g.file[g.collected].hits;
+		const int64_t hits_len = g.file[g.collected].hits_len;
+		g.file[g.collected++].hits = NULL;
+		if (hits) {
+			pthread_mutex_unlock(&grep_mutex);
+			append_hits(g.results, hits, hits_len);
+			for(int64_t i = 0; i < hits_len; i++) if (!hits[i]) g.num_hits++;
+			free(hits);
+			g.refresh = true;
+			pthread_mutex_lock(&grep_mutex);
+		}
+	}
+
+	if (elapsed_ms(&g.last_refresh) >= GREP_REFRESH_MS) {
+		if (g.refresh && !executing_macro) {
+			pthread_mutex_unlock(&grep_mutex);
+			reset_window();
+			refresh_window(g.results);
+			draw_status_bar();
+			flush_frame();
+			pthread_mutex_lock(&grep_mutex);
+		}
+		clock_gettime(CLOCK_REALTIME, &g.last_refresh);
+		g.refresh = false;
+	}
+}
+
+
+/* Adds a file to the file list, which takes ownership of name, and collects
+   the hits found so far if GREP_REFRESH_MS milliseconds have elapsed since
+   the last refresh. */
+
+static void add_file(char * const name) {
+	pthread_mutex_lock(&grep_mutex);
+	if (g.num_files == g.max_files) {
+		const int64_t max_files = max(1024, g.max_files * 2);
+		grep_file * const file = realloc(g.file, max_files * sizeof *file);
+		if (!file) {
+			pthread_mutex_unlock(&grep_mutex);
+			free(name);
+			return;
+		}
+		g.file = file;
+		g.max_files = max_files;
+	}
+	g.file[g.num_files++] = (grep_file){ name };
+	pthread_cond_signal(&more_files);
+	if (elapsed_ms(&g.last_refresh) >= GREP_REFRESH_MS) collect_hits();
+	pthread_mutex_unlock(&grep_mutex);
+}
+
+
+typedef struct {
+	char *name;
+	unsigned char type;   /* The d_type of the entry. */
+} dir_entry;
+
+static int dir_entry_cmp(const void *a, const void *b) {
+	return strcmp(((const dir_entry *)a)->name, ((const dir_entry *)b)->name);
+}
+
+
+/* Adds the regular files in a directory and in its subdirectories, in
+   lexicographical order. Hidden files and directories, and symbolic links to
+   directories, are skipped. The type of entries is taken from the directory,
+   if available, so that most files need not be stat()ed. */
+
+static void walk_dir(const char * const dir) {
+	DIR * const d = opendir(dir);
+	if (!d) return;
+
+	/* We do not prefix names with "./". */
+	const int64_t dir_len = strcmp(dir, ".") ? strlen(dir) : 0;
+	const bool slash = dir_len && dir[dir_len - 1] != '/';
+	dir_entry *entry = NULL;
+	int64_t num_entries = 0, max_entries = 0;
+	struct dirent *de;
+
+	while(!stop && (de = readdir(d))) {
+		if (de->d_name[0] == '.') continue;
+		if (num_entries == max_entries) {
+			dir_entry * const p = realloc(entry, (max_entries = max(64, max_entries * 2)) * sizeof *entry);
+			if (!p) break;
+			entry = p;
+		}
+		char * const name = malloc(dir_len + slash + strlen(de->d_name) + 1);
+		if (!name) break;
+		memcpy(name, dir, dir_len);
+		if (slash) name[dir_len] = '/';
+		strcpy(name + dir_len + slash, de->d_name);
+		entry[num_entries++] = (dir_entry){ name, de->d_type };
+	}
+	closedir(d);
+
+	qsort(entry, num_entries, sizeof *entry, dir_entry_cmp);
+
+	for(int64_t i = 0; i < num_entries; i++) {
+		struct stat st;
+		char * const name = entry[i].name;
+		if (stop) free(name);
+		else if (entry[i].type == DT_DIR || entry[i].type == DT_UNKNOWN && !lstat(name, &st) && S_ISDIR(st.st_mode)) {
+			walk_dir(name);
+			free(name);
+		}
+		else if (entry[i].type == DT_REG || entry[i].type != DT_DIR && !stat(name, &st) && S_ISREG(st.st_mode)) add_file(name);
+		else free(name);
+	}
+	free(entry);
+}
+
+
+/* Adds the files specified by path, which may be a glob pattern, a
+   directory or a file. */
+
+static void walk(const char * const path) {
+	glob_t gl;
+	int flags = GLOB_NOCHECK;
+#ifdef GLOB_TILDE
+	flags |= GLOB_TILDE;
+#endif
+	if (glob(path, flags, NULL, &gl)) return;
+
+	for(size_t i = 0; i < gl.gl_pathc && !stop; i++) {
+		struct stat st;
+		if (stat(gl.gl_pathv[i], &st)) continue;
+		if (S_ISDIR(st.st_mode)) walk_dir(gl.gl_pathv[i]);
+		else if (S_ISREG(st.st_mode)) {
+			char * const name = str_dup(gl.gl_pathv[i]);
+			if (name) add_file(name);
+		}
+	}
+	globfree(&gl);
+}
+
+
+/* Searches the current search pattern of b (a regular expression if
+   b->last_was_regexp is true) in the files specified by path, which can be a
+   file, a directory (which is searched recursively) or a glob pattern. The
+   hits are collected in a new document, which becomes the current one;
+   *num_hits and *num_files are set to the number of hits and of searched
+   files. If there are no hits, the new document is deleted and b is the
+   current document again. */
+
+int grep(buffer * const b, const char * const path, int64_t * const num_hits, int64_t * const num_files) {
+	const char * const pattern = b->find_string;
+	*num_hits = *num_files = 0;
+	if (!pattern || !*pattern) return ERROR;
+
+	const int64_t m = strlen(pattern);
+	const encoding_type pattern_encoding = detect_encoding(pattern, m);
+	const bool utf8 = b->encoding == ENC_UTF8 || b->encoding == ENC_ASCII && (pattern_encoding == ENC_UTF8 || pattern_encoding == ENC_ASCII && b->opt.utf8auto);
+
+	memset(&g, 0, sizeof g);
+	g.pattern = (const unsigned char *)pattern;
+	g.m = m;
+	g.regexp = b->last_was_regexp;
+	g.sense_case = b->opt.case_search;
+	g.up_case = utf8 ? ascii_up_case : localised_up_case;
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	const int num_threads = n < 1 ? 1 : n > MAX_GREP_THREADS ? MAX_GREP_THREADS : n;
+	grep_worker * const w = calloc(num_threads, sizeof *w);
+	if (!w) return OUT_OF_MEMORY;
+
+	if (g.regexp) {
+		/* The same choices of find_regexp(). */
+		const bool native = utf8 && native_utf8_regexp(), icase = !g.sense_case && native;
+		unsigned char * const translate = g.sense_case || native ? NULL : utf8 ? (unsigned char *)ascii_up_case : localised_up_case;
+		const reg_syntax_t syntax = re_syntax_options;
+		const char *error = NULL;
+
+		char *actual_pattern = (char *)pattern;
+		if (utf8 && !native) {
+			const int e = utf8_byte_regexp(pattern, &actual_pattern, NULL);
+			if (e) {
+				free(w);
+				return e;
+			}
+		}
+
+		g.locale = regex_locale(native ? ENC_UTF8 : ENC_8_BIT);
+		const locale_t locale = uselocale(g.locale);
+		if (icase) re_set_syntax(syntax | RE_ICASE);
+		for(int i = 0; i < num_threads && !error; i++) {
+			w[i].pb.translate = translate;
+			w[i].pb.fastmap = malloc(256);
+			if (error = re_compile_pattern(actual_pattern, strlen(actual_pattern), &w[i].pb)) break;
+			w[i].dfa = alloc_lazy_dfa(actual_pattern, icase ? ascii_up_case : translate, native);
+		}
+		re_set_syntax(syntax);
+		uselocale(locale);
+		if (actual_pattern != pattern) free(actual_pattern);
+
+		if (error) {
+			for(int i = 0; i < num_threads; i++) {
+				w[i].pb.translate = NULL;
+				regfree(&w[i].pb);
+				free_lazy_dfa(w[i].dfa);
+			}
+			free(w);
+			print_message(error);
+			alert();
+			return ERROR;
+		}
+	}
+	else {
+		for(int i = 0; i < 256; i++) g.d[i] = m;
+		for(int i = 0; i < m - 1; i++) g.d[CONV(pattern[i])] = m - i - 1;
+	}
+
+	buffer * const r = new_buffer();
+	if (!r) {
+		free(w);
+		return OUT_OF_MEMORY;
+	}
+	g.results = r;
+	r->find_string = str_dup(pattern);
+	r->find_string_changed = 1;
+	r->last_was_regexp = g.regexp;
+	const bool do_undo = r->opt.do_undo;
+	r->opt.do_undo = 0;
+	reset_window();
+
+	/* Signals must be handled by the main thread. */
+	sigset_t all, mask;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &mask);
+	int started;
+	for(started = 0; started < num_threads; started++)
+		if (pthread_create(&w[started].thread, NULL, grep_thread, w + started)) break;
+	pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+	stop = false;
+	clock_gettime(CLOCK_REALTIME, &g.last_refresh);
+	if (started) walk(path);
+
+	pthread_mutex_lock(&grep_mutex);
+	g.walk_done = true;
+	pthread_cond_broadcast(&more_files);
+
+	while(started && !stop) {
+		collect_hits();
+		if (g.collected == g.num_files) break;
+
+		struct timespec timeout = g.last_refresh;
+		if ((timeout.tv_nsec += GREP_REFRESH_MS * 1000000) >= 1000000000) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&more_hits, &grep_mutex, &timeout);
+	}
+
+	g.cancel = true;
+	pthread_cond_broadcast(&more_files);
+	pthread_mutex_unlock(&grep_mutex);
+
+	for(int i = 0; i < started; i++) pthread_join(w[i].thread, NULL);
+
+	for(int i = 0; i < num_threads; i++) {
+		if (g.regexp) {
+			w[i].pb.translate = NULL;
+			regfree(&w[i].pb);
+			free_lazy_dfa(w[i].dfa);
+		}
+		free(w[i].hits);
+		free(w[i].buf);
+	}
+	free(w);
+
+	*num_hits = g.num_hits;
+	*num_files = g.collected;
+	for(int64_t i = 0; i < g.num_files; i++) {
+		free(g.file[i].name);
+		free(g.file[i].hits);
+	}
+	free(g.file);
+
+	r->opt.do_undo = do_undo;
+	r->is_modified = false;
+	reset_window();
+
+	if (*num_hits == 0) {
+		delete_buffer();
+		cur_buffer = b;
+		if (!started) return OUT_OF_MEMORY;
+		if (stop) return STOPPED;
+		return g.num_files ? NOT_FOUND : FILE_DOES_NOT_EXIST;
+	}
+	return stop ? STOPPED : OK;
+}
+
+
+/* Opens the hit on the current line of a results document produced by
+   grep(). If the cursor is on the text of the hit, it is moved to the
+   corresponding position of the file; otherwise, it is moved to the first
+   occurrence of the search pattern on the line of the hit. */
+
+int open_hit(buffer * const b) {
+	const line_desc * const ld = b->cur_line_desc;
+	const char * const s = ld->line;
+	int64_t i, j, line = 0;
+
+	/* File names may contain colons: we look for the first :number: */
+	for(i = 0; i < ld->line_len; i++) {
+		if (s[i] != ':') continue;
+		line = 0;
+		for(j = i + 1; j < ld->line_len && isdigit((unsigned char)s[j]); j++) line = line * 10 + s[j] - '0';
+		if (j > i + 1 && j < ld->line_len && s[j] == ':') break;
+	}
+	if (i == 0 || i >= ld->line_len || line == 0) return NOT_A_HIT;
+
+	const int64_t col = b->cur_pos > j ? b->cur_pos - j - 1 : -1;
+	char * const name = malloc(i + 1);
+	if (!name) return OUT_OF_MEMORY;
+	memcpy(name, s, i);
+	name[i] = 0;
+
+	buffer * const t = get_buffer_named(name);
+	if (t) {
+		free(name);
+		if (t != b) {
+			free(t->find_string);
+			t->find_string = str_dup(b->find_string);
+			t->find_string_changed = 1;
+			t->last_was_regexp = b->last_was_regexp;
+			cur_buffer = t;
+			t->act = ++buffer_actuations;
+			reset_window();
+		}
+	}
+	else {
+		struct stat st;
+		if (stat(name, &st)) {
+			free(name);
+			return FILE_DOES_NOT_EXIST;
+		}
+		/* OpenNew copies the search string of b in the new document, and
+			reports its own errors. */
+		do_action(b, OPENNEW_A, 1, name);
+		if (cur_buffer == b) return ERROR;
+	}
+
+	buffer * const h = cur_buffer;
+	const int64_t n = min(line, h->num_lines) - 1;
+	goto_line_pos(h, n, 0);
+
+	if (col >= 0) {
+		int64_t pos = min(col, h->cur_line_desc->line_len);
+		if (h->encoding == ENC_UTF8) while(pos > 0 && pos < h->cur_line_desc->line_len && (h->cur_line_desc->line[pos] & 0xC0) == 0x80) pos--;
+		goto_pos(h, pos);
+	}
+	else if (h->find_string) {
+		const bool search_back = h->opt.search_back;
+		h->opt.search_back = 0;
+		if ((h->last_was_regexp ? find_regexp : find)(h, NULL, false, false) != OK || h->cur_line != n) goto_line_pos(h, n, 0);
+		h->opt.search_back = search_back;
+	}
+
+	keep_cursor_on_screen(h);
+	return OK;
+}
@@ -63,6 +63,8 @@ typedef struct {
 
 static input_buf ib;        /* our main input buffer */
 
+static buffer *isearch_b;   /* if not NULL, we are serving an incremental search on this buffer */
+
 /* Unlike ne's document buffers, the command line may (and will) move
    back to ASCII if all non-US-ASCII characters are deleted .*/
 
@@ -231,6 +233,24 @@ char *request_string(const buffer * const b, const char * const prompt, const ch
 	return NULL;
 }
 
+
+/* Requests a search string as request_string() does, but while the string is
+   being edited the cursor of b tracks its first occurrence, which is
+   highlighted (see incremental_find()). If the input is escaped, the cursor
+   is moved back to its original position. */
+
+char *request_incremental_find(buffer * const b, const char * const prompt, const char * const default_string, const bool prefer_utf8) {
+
+	start_incremental_find(b, default_string);
+	isearch_b = b;
+	char * const result = request_string(b, prompt, default_string, false, COMPLETE_NONE, prefer_utf8);
+	isearch_b = NULL;
+	highlight_match(b, 0, false);
+	end_incremental_find(b, !result);
+
+	return result;
+}
+
 static buffer *history_buff = NULL;
 
 static void init_history(void) {
@@ -312,7 +332,7 @@ static void input_refresh(void) {
 		output_char(get_char(&ib.buf[j], ib.encoding), 0, ib.encoding);
 	}
 	clear_to_eol();
-	fflush(stdout);
+	flush_frame();
 }
 
 void input_and_prompt_refresh() {
@@ -644,6 +664,17 @@ static char *complete_filename(const char *start_prefix) {
 }
 
 
+/* Updates the incremental search, and the display if necessary. */
+
+static void input_incremental_find(void) {
+	int64_t match_len;
+	if (incremental_find(isearch_b, ib.buf, &match_len)) {
+		refresh_window(isearch_b);
+		highlight_match(isearch_b, match_len, true);
+	}
+}
+
+
 char *request(const buffer * const b, const char *prompt, const char * const default_string, const bool alpha_allowed, const int completion_type, const bool prefer_utf8) {
 
 	ib.buf[ib.pos = ib.len = ib.offset = 0] = 0;
@@ -666,6 +697,9 @@ char *request(const buffer * const b, const char *prompt, const char * const def
 
 		assert(ib.buf[ib.len] == 0);
 
+		/* If an incremental search is in progress, we keep scanning until a key is pressed. */
+		if (isearch_b) while(incremental_find_pending() && !key_available()) input_incremental_find();
+
 		move_cursor(ne_lines - 1, ib.x);
 
 		int c;
@@ -996,6 +1030,8 @@ char *request(const buffer * const b, const char *prompt, const char * const def
 			return ib.buf;
 		}
 
+		if (isearch_b) input_incremental_find();
+
 		first_char_typed = false;
 	}
 	highlight_mark((buffer * const)b, false);
@@ -25,6 +25,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
 
 /* The keywords used in the configuration files. */
 
@@ -490,10 +491,12 @@ static void set_termios_timeout(const int timeout) {
    on the following chars). */
 
 
-int get_key_code(void) {
-	static int cur_len = 0;
-	static char kbd_buffer[KBD_BUF_SIZE];
+/* The keyboard buffer used by get_key_code(), and its current length. */
+
+static int cur_len;
+static char kbd_buffer[KBD_BUF_SIZE];
 
+int get_key_code(void) {
 	int c, e, last_match = 0, cur_key = 0;
 	bool partial_match = false, partial_is_utf8 = false;
 
@@ -576,7 +579,7 @@ int get_key_code(void) {
 			partial_match = true;
 		}
 
-		fflush(stdout);
+		flush_frame();
 
 		if (partial_match) set_termios_timeout(escape_time);
 
@@ -615,6 +618,16 @@ int get_key_code(void) {
 	}
 }
 
+/* Returns true if some input is waiting to be processed by get_key_code(),
+   either in the keyboard buffer or on stdin. It never blocks. */
+
+bool key_available(void) {
+	if (cur_len) return true;
+	struct pollfd pfd = { .fd = 0, .events = POLLIN };
+	return poll(&pfd, 1, 0) > 0;
+}
+
+
 static void error_in_key_bindings(const int line, const char * const s) {
 	fprintf(stderr, "Error in key bindings file at line %d: %s\n", line, s);
 	exit(0);
@@ -132,10 +132,13 @@ static const menu_item search_item[] =
 	{
 		{ "Find...          ^F", FIND_ABBREV },
 		{ "Find RegExp...   ^_", FINDREGEXP_ABBREV },
+		{ "Find Any (Clip)    ", FINDANY_ABBREV },
 		{ "Replace...       ^R", REPLACE_ABBREV },
 		{ "Replace Once...    ", REPLACEONCE_ABBREV },
 		{ "Replace All...     ", REPLACEALL_ABBREV },
 		{ "Repeat Last      ^G", REPEATLAST_ABBREV },
+		{ "Grep...            ", GREP_ABBREV },
+		{ "Open Hit           ", OPENHIT_ABBREV },
 		{ "Goto Line...     ^J", GOTOLINE_ABBREV },
 		{ "Goto Col...      [J", GOTOCOLUMN_ABBREV },
 		{ "Goto Mark          ", GOTOMARK_ABBREV },
@@ -395,7 +398,7 @@ static void undraw_menu(const int n) {
 		if (i >= ne_lines - 1) break;
 		if (ld->ld_node.next->next) {
 			ld = (line_desc *)ld->ld_node.next;
-			if (cur_buffer->syn) parse(cur_buffer->syn, ld, ld->highlight_state, cur_buffer->encoding == ENC_UTF8);
+			if (cur_buffer->syn) parse_cached(cur_buffer, ld);
 			output_line_desc(i, menus[n].xpos - 1, ld, cur_buffer->win_x + menus[n].xpos - 1, menus[n].width + (standout_ok ? MENU_EXTRA : MENU_NOSTANDOUT_EXTRA), cur_buffer->opt.tab_size, false, cur_buffer->encoding == ENC_UTF8, cur_buffer->syn ? attr_buf : NULL, NULL, 0);
 		}
 		else {
@@ -771,7 +774,7 @@ void print_message(const char * const message) {
 				standout_off();
 			}
 
-			fflush(stdout);
+			flush_frame();
 
 			showing_msg = true;
 		}
@@ -93,8 +93,16 @@ void resync_pos(buffer * const b) {
 	}
 
 	line_desc *ld = b->cur_line_desc;
-	int64_t i, pos, width, last_char_width;
-	for(i = pos = width = 0; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding), i++) {
+	int64_t i = 0, pos = 0, width = 0, last_char_width;
+	if (ld->line_len >= COL_INDEX_MIN_LEN) {
+		/* We start from the last checkpoint strictly before x. */
+		const col_checkpoint * const cp = col_checkpoint_by_col(ld, x - 1, b->opt.tab_size, b->encoding);
+		i = cp->chars;
+		pos = cp->pos;
+		width = cp->width;
+	}
+
+	for(; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding), i++) {
 
 		if (ld->line[pos] != '\t') width += (last_char_width = get_char_width(&ld->line[pos], b->encoding));
 		else width += (last_char_width = b->opt.tab_size - width % b->opt.tab_size);
@@ -841,7 +849,15 @@ void move_to_eol(buffer * const b) {
 		return;
 	}
 
-	for(int64_t i = 0, pos = 0, width = 0; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding), i++)  {
+	int64_t pos = 0, width = 0;
+	if (ld->line_len >= COL_INDEX_MIN_LEN) {
+		/* We start from the last checkpoint at which the loop below cannot stop. */
+		const col_checkpoint * const cp = col_checkpoint_by_col(ld, total_width - ne_columns + b->opt.tab_size, b->opt.tab_size, b->encoding);
+		pos = cp->pos;
+		width = cp->width;
+	}
+
+	for(; pos < ld->line_len; pos = next_pos(ld->line, pos, b->encoding))  {
 		if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], b->encoding);
 		else width += b->opt.tab_size - width % b->opt.tab_size;
 
@@ -29,6 +29,7 @@
 #include <signal.h>
 #include <limits.h>
 #include <locale.h>
+#include <time.h>
 
 /* This is the array containing the "NO WARRANTY" message, which is displayed
    when ne is called without any specific file name or macro to execute. The
@@ -78,7 +79,8 @@ char ARG_HELP[] = ABOUT_MSG "\n"
 						"--prefs EXT   set autoprefs for the provided extension before loading the first file.\n"
 						"--keys FILE   use this file for keyboard configuration.\n"
 						"--menus FILE  use this file for menu configuration.\n"
-						"--macro FILE  exec this macro after start.\n\n"
+						"--macro FILE  exec this macro after start.\n"
+						"--bench-syntax N  highlight the files N times, print the throughput and exit.\n\n"
 						"             *These options may appear multiple times.\n";
 
 
@@ -102,6 +104,8 @@ bool req_order;
 bool req_order = true;
 #endif
 bool fast_gui;
+bool inc_find;
+bool search_index = true;
 bool status_bar = true;
 bool interactive_mode;
 bool verbose_macros = true;
@@ -170,6 +174,68 @@ void about(void) {
 	print_message(t);
 }
 
+/* Highlights the given files the given number of times, printing the
+   throughput of the highlighter and the profile of a further pass. Returns
+   the exit status. */
+
+static int bench_syntax(buffer * const b, const int argc, char * const * const argv, const char * const skiplist, const int passes) {
+	int status = EXIT_SUCCESS;
+
+	for(int i = 1; i < argc; i++) {
+		if (skiplist[i] || argv[i][0] == '-' || argv[i][0] == '+') continue;
+
+		clear_buffer(b);
+		b->syn = NULL;
+		int error = load_file_in_buffer(b, argv[i]);
+		if (!error) {
+			const char * const ext = extension(argv[i]);
+			error = ext ? load_syntax_by_name(b, ext) : HAS_NO_EXTENSION;
+		}
+		if (error) {
+			fflush(stdout);
+			fprintf(stderr, "%s: %s\n", argv[i], error_msg[error]);
+			status = EXIT_FAILURE;
+			continue;
+		}
+
+		const HIGHLIGHT_STATE initial_state = { 0, 0, "" };
+		const bool utf8 = b->encoding == ENC_UTF8;
+		int64_t bytes = 0;
+		for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next) bytes += ld->line_len + 1;
+
+		double total = 0, best = 0;
+		for(int pass = 0; pass <= passes; pass++) {
+			/* The last pass is not timed, and collects the profile. */
+			if (pass == passes) {
+				reset_syntax_stats();
+				syntax_stats = true;
+			}
+
+			struct timespec start, end;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			HIGHLIGHT_STATE state = initial_state;
+			for(line_desc *ld = (line_desc *)b->line_desc_list.head; ld->ld_node.next; ld = (line_desc *)ld->ld_node.next)
+				state = parse(b->syn, ld, state, utf8);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			const double t = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1E9;
+			if (pass < passes) {
+				total += t;
+				if (pass == 0 || t < best) best = t;
+			}
+		}
+		syntax_stats = false;
+
+		printf("%s: syntax %s, %" PRId64 " lines, %" PRId64 " bytes, %d passes, %.2f MB/s (best pass %.2f MB/s)\n\n",
+			argv[i], b->syn->name, b->num_lines, bytes, passes, bytes * passes / 1E6 / total, bytes / 1E6 / best);
+		print_syntax_stats(stdout, SYNTAX_STATS_STATES);
+		putchar('\n');
+	}
+
+	return status;
+}
+
+
 /* The main() function. It is responsible for argument parsing, calling
    some terminal and signal initialization functions, and entering the
    event loop. */
@@ -195,6 +261,7 @@ int main(int argc, char **argv) {
 	}
 
 	bool no_config = false;
+	int bench_passes = 0;
 	char *macro_name = NULL, *key_bindings_name = NULL, *menu_conf_name = NULL, *startup_prefs_name = DEF_PREFS_NAME;
 
 	char * const skiplist = calloc(argc, 1);
@@ -267,6 +334,12 @@ int main(int argc, char **argv) {
 					skiplist[i] = skiplist[i+1] = 1; /* argv[i] = argv[i+1] = NULL; */
 				}
 			}
+			else if (!strcmp(&argv[i][2], "bench-syntax")) {
+				if (i < argc-1) {
+					bench_passes = max(1, atoi(argv[i+1]));
+					skiplist[i] = skiplist[i+1] = 1; /* argv[i] = argv[i+1] = NULL; */
+				}
+			}
 		}
 	}
 
@@ -343,6 +416,17 @@ int main(int argc, char **argv) {
 
 	add_head(&clips, &cd->cd_node);
 
+	/* In benchmark mode, we just highlight the files and exit, without
+	   touching the terminal. */
+
+	if (bench_passes) {
+		if (!do_syntax) {
+			fprintf(stderr, "%s\n", error_msg[SYNTAX_NOT_ENABLED]);
+			exit(EXIT_FAILURE);
+		}
+		exit(bench_syntax(cur_buffer, argc, argv, skiplist, bench_passes));
+	}
+
 	/* General terminfo and cursor motion initialization. From here onwards,
 	   we cannot exit() lightly. */
 
@@ -493,16 +577,35 @@ int main(int argc, char **argv) {
 	}
 
 	while(true) {
-		/* If we are displaying the "NO WARRANTY" info, we should not refresh the
-		   window now */
-		if (!displaying_info) {
-			refresh_window(cur_buffer);
-			if (!cur_buffer->visible_mark.shown) highlight_mark(cur_buffer, true);
-			if (cur_buffer->opt.automatch) automatch_bracket(cur_buffer, true);
+		/* If more input is already waiting (e.g., because of fast key repeat,
+		   or because text is being pasted), we do not paint a frame that
+		   would be stale immediately: we delay updates, as we do for macros,
+		   and the screen is refreshed once pending input has been processed. */
+		if (key_available()) delay_update();
+		else {
+			/* If we are displaying the "NO WARRANTY" info, we should not refresh the
+			   window now */
+			if (!displaying_info) {
+				refresh_window(cur_buffer);
+				if (!cur_buffer->visible_mark.shown) highlight_mark(cur_buffer, true);
+				if (cur_buffer->opt.automatch) automatch_bracket(cur_buffer, true);
+			}
+
+			draw_status_bar();
+			move_cursor(cur_buffer->cur_y, cur_buffer->cur_x);
+		}
+
+		/* While no key is pressed, we complete the update of syntax states... */
+		if (syntax_states_pending(cur_buffer)) {
+			flush_frame();
+			while(syntax_states_pending(cur_buffer) && !key_available()) continue_syntax_states(cur_buffer, 1024);
 		}
 
-		draw_status_bar();
-		move_cursor(cur_buffer->cur_y, cur_buffer->cur_x);
+		/* ...and we index large documents for searching. */
+		if (trigram_index_pending(cur_buffer)) {
+			flush_frame();
+			while(trigram_index_pending(cur_buffer) && !key_available() && build_trigram_index(cur_buffer));
+		}
 
 		int c = get_key_code();
 		/* Work around alternative handling of bracketed paste
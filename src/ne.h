@@ -37,6 +37,7 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <locale.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -104,13 +105,18 @@ extern const char *config_source_names[];
 
 #define SYNTAX_EXT         ".jsf"
 
-/* The name of the file containing the mappings from extensions to syntax names. */
+/* The name of the subdirectory of the preferences directory caching compiled syntaxes, and their extension. */
 
-#define EXT_2_SYN          "ext2syn"
+#define SYNTAX_CACHE_DIR   ".syntax-cache"
+#define SYNTAX_CACHE_EXT   ".jsc"
 
-/* Files with more than this number of characters will not have syntax highlighting enabled automatically. */
+/* The number of states listed by SyntaxStats by default. */
 
-#define MAX_SYNTAX_SIZE		(10000000)
+#define SYNTAX_STATS_STATES 40
+
+/* The name of the file containing the mappings from extensions to syntax names. */
+
+#define EXT_2_SYN          "ext2syn"
 
 /* This is the name taken by unnamed documents. */
 
@@ -256,6 +262,17 @@ typedef struct {
 	HIGHLIGHT_STATE highlight_state; /* Initial highlight state for this line */
 } line_desc;
 
+/* A checkpoint of the column index of a long line (see colindex.c): the
+   position of a character, and the TAB-expanded width and the number of the
+   characters preceding it. Lines shorter than COL_INDEX_MIN_LEN bytes are
+   not indexed. */
+
+#define COL_INDEX_MIN_LEN (16 * 1024)
+
+typedef struct {
+	int64_t pos, width, chars;
+} col_checkpoint;
+
 /* The purpose of this structure is to provide the byte count for allocating
    line descriptors when no syntax highlighting is required.  */
 
@@ -307,8 +324,10 @@ typedef struct {
    the pool pointed by pool, while first_used and last_used represent
    the min and max characters which are used. A character is not used if it
    is zero. It is perfectly possible (and likely) that between first_used
-   and last_used there are many free chars, which are named "lost" chars. See
-   the source buffer.c for some elaboration on the subject. */
+   and last_used there are many free chars, which are named "lost" chars. A
+   reserved pool holds the room around a long line, and alloc_chars() never
+   allocates from it (see alloc_line_chars()). See the source buffer.c for
+   some elaboration on the subject. */
 
 typedef struct {
 	node cp_node;
@@ -316,6 +335,7 @@ typedef struct {
 	int64_t first_used, last_used;
 	char *pool;
 	bool mapped;
+	bool reserved;
 } char_pool;
 
 #ifndef NDEBUG
@@ -523,6 +543,12 @@ typedef struct {
 	int64_t attr_len;               /* attr_buf valid number of characters, or -1 to denote that attr_buf is not valid. */
 	HIGHLIGHT_STATE next_state; /* If attr_len >= 0, the state after the *current* line. */
 
+	struct trigram_index *trigram_index; /* The trigram index used by searches, or NULL (see trigram.c). */
+	struct bracket_index *bracket_index; /* The bracket index used by MatchBracket, or NULL (see bracket.c). */
+	int64_t syntax_frontier;     /* If nonnegative, the initial state of the next line might differ from the final state of this line. */
+	line_desc *syntax_frontier_ld; /* If syntax_frontier is nonnegative, the descriptor of that line. */
+	int64_t syntax_frontier_end; /* If syntax_frontier is nonnegative, the last line after which this might happen. */
+
 	int link_undos;             /* Link the undo steps. Multilevel. */
 
 	unsigned int
@@ -631,6 +657,17 @@ extern bool interactive_mode;
 extern bool fast_gui;
 
 
+/* If true, Find searches incrementally while the pattern is typed. */
+
+extern bool inc_find;
+
+
+/* If true, large documents are indexed by trigrams while ne is idle, and
+   searches skip the blocks that cannot contain the pattern. */
+
+extern bool search_index;
+
+
 /* Recorded macros use long command names */
 
 extern bool verbose_macros;
@@ -194,6 +194,8 @@ int save_prefs(buffer * const b, const char * const name) {
 			if (!req_order)      record_action(cs, REQUESTORDER_A,   req_order,      NULL, verbose_macros);
 #endif
 			if (fast_gui)        record_action(cs, FASTGUI_A,        fast_gui,       NULL, verbose_macros);
+			if (inc_find)        record_action(cs, INCREMENTALFIND_A, inc_find,      NULL, verbose_macros);
+			if (!search_index)   record_action(cs, SEARCHINDEX_A,    search_index,   NULL, verbose_macros);
 			if (!status_bar)     record_action(cs, STATUSBAR_A,      status_bar,     NULL, verbose_macros);
 			if (!verbose_macros) record_action(cs, VERBOSEMACROS_A,  verbose_macros, NULL, verbose_macros);
 			saving_defaults = false;
@@ -24,9 +24,24 @@
 /* actions.c */
 int do_action(buffer *b, action a, int64_t c, char *p);
 
+/* aho.c */
+struct aho_corasick *alloc_aho_corasick(const char *regex, const unsigned char *translate, bool ascii_only);
+void free_aho_corasick(struct aho_corasick *ac);
+int64_t aho_corasick_search(const struct aho_corasick *ac, const char *s, int64_t len, int64_t start, bool back, int64_t *end);
+
 /* autocomp.c */
 char *autocomplete(char *p, char *req_msg, const int ext, int * const error);
 
+/* bracket.c */
+int bracket_type(int c);
+int64_t find_bracket_in_line(const line_desc *ld, int64_t pos, int type, int64_t *n);
+void forget_bracket_line(const line_desc *ld);
+void free_bracket_index(buffer *b);
+bool build_bracket_index(buffer *b);
+void bracket_index_insert(buffer *b, int64_t line, const line_desc *ld, int64_t pos, int64_t new_lines, int64_t len);
+void bracket_index_delete(buffer *b, int64_t line, line_desc *ld, int64_t pos, int64_t removed_lines);
+line_desc *skip_bracket_blocks(buffer *b, line_desc *ld, int64_t *y, int type, int64_t *n, int64_t min_line, int64_t max_line);
+
 /* buffer.c */
 encoding_type detect_buffer_encoding(const buffer *b);
 char_pool *alloc_char_pool(int64_t size, int fd_or_zero, int force);
@@ -82,6 +97,12 @@ int paste_vert_to_buffer(buffer *b, int n);
 int load_clip(int n, const char *name, bool preserve_cr, bool binary);
 int save_clip(int n, const char *name, bool CRLF, bool binary);
 
+/* colindex.c */
+const col_checkpoint *col_checkpoint_by_pos(const line_desc *ld, int64_t pos, int tab_size, encoding_type encoding);
+const col_checkpoint *col_checkpoint_by_col(const line_desc *ld, int64_t col, int tab_size, encoding_type encoding);
+void col_index_invalidate(const line_desc *ld, int64_t pos);
+void col_index_reset(void);
+
 /* command.c */
 void build_hash_table(void);
 void build_command_name_table(void);
@@ -101,9 +122,18 @@ void optimize_macro(char_stream *cs, bool verbose);
 int parse_word_parm(char *p, char *pat, int64_t *match);
 
 
+/* dfa.c */
+struct lazy_dfa *alloc_lazy_dfa(const char *regex, const unsigned char *translate, bool utf8);
+void free_lazy_dfa(struct lazy_dfa *dfa);
+bool lazy_dfa_may_match(struct lazy_dfa *dfa, const char *s, int64_t len);
+int lazy_dfa_literal(const struct lazy_dfa *dfa, const char **literal);
+
 /* display.c */
 void update_syntax_states(buffer *b, int row, line_desc *ld, line_desc *end_ld);
+bool syntax_states_pending(const buffer *b);
+bool continue_syntax_states(buffer *b, int64_t n);
 int highlight_cmp(HIGHLIGHT_STATE *x, HIGHLIGHT_STATE *y);
+HIGHLIGHT_STATE parse_cached(buffer *b, line_desc *ld);
 void delay_update();
 void output_line_desc(int row, int col, const line_desc *ld, int64_t start, int64_t len, int tab_size, bool cleared_at_end, bool utf8, const uint32_t * const attr, const uint32_t * const diff, const int64_t diff_size);
 void update_line(buffer *b, line_desc *ld, int n, int64_t start_x, bool cleared_at_end);
@@ -120,6 +150,7 @@ void ensure_attributes(buffer *b);
 void store_attributes(buffer *b, line_desc *ld);
 void automatch_bracket(buffer * const b, const bool show);
 void highlight_mark(buffer * const b, const bool show);
+void highlight_match(buffer * const b, const int64_t len, const bool show);
 
 /* edit.c */
 int to_upper(buffer *b);
@@ -148,6 +179,10 @@ void apply_to_list(list *l, void (func)());
 /* ext.c */
 const char *ext2syntax(const char * const ext);
 
+/* grep.c */
+int grep(buffer *b, const char *path, int64_t *num_hits, int64_t *num_files);
+int open_hit(buffer *b);
+
 /* help.c */
 
 /* inputclass.c */
@@ -156,6 +191,7 @@ const char *ext2syntax(const char * const ext);
 void read_key_capabilities(void);
 void set_escape_time(int new_escape_time);
 int get_key_code(void);
+bool key_available(void);
 int key_may_set(const char * const cap_string, int code, config_source source);
 void get_key_bindings(const char *);
 
@@ -233,6 +269,7 @@ bool  request_response(const buffer *b, const char *prompt, bool default_value);
 char  request_char(const buffer *b, const char *prompt, const char default_value);
 int64_t request_number(const buffer *b, const char *prompt, int64_t default_value);
 char *request_string(const buffer *b, const char *prompt, const char *default_string, bool accept_null_string, int completion_type, bool prefer_utf8);
+char *request_incremental_find(buffer *b, const char *prompt, const char *default_string, bool prefer_utf8);
 /* char *complete_filename(const char *start_prefix); */
 char *request(const buffer *b, const char *prompt, const char *default_string, bool alpha_allowed, int completion_type, bool prefer_utf8);
 
@@ -251,11 +288,20 @@ void  req_list_finalize(req_list * const rl);
 
 /* search.c */
 int  find(buffer *b, const char *pattern, const bool skip_first, bool wrap_once);
+void start_incremental_find(buffer *b, const char *pattern);
+bool incremental_find(buffer *b, const char *pattern, int64_t *match_len);
+bool incremental_find_pending(void);
+void end_incremental_find(buffer *b, bool restore);
 int  replace(buffer *b, int n, const char *string);
 int  find_regexp(buffer *b, const char *regex, const bool skip_first, bool wrap_once);
+int  find_any(buffer *b, const char *name);
 int  replace_regexp(buffer *b, const char *string);
+int  replace_all(buffer *b, const char *string, int64_t *num_replace);
 char *nth_regex_substring(const line_desc *ld, int i);
 bool nth_regex_substring_nonempty(const line_desc *ld, int i);
+locale_t regex_locale(encoding_type encoding);
+bool native_utf8_regexp(void);
+int  utf8_byte_regexp(const char *regex, char **actual_regex, int *map_group);
 
 /* signals.c */
 void stop_ne(void);
@@ -311,10 +357,20 @@ bool is_directory(const char *name);
 encoding_type detect_encoding(const char *s, int64_t len);
 int context_prefix(const buffer *b, char **p, int64_t *prefix_pos);
 line_desc *nth_line_desc(const buffer *b, const int64_t n);
+int64_t line_desc_number(const buffer *b, const line_desc *ld);
 const char *cur_bookmarks_string(const buffer *b);
 const char *cur_bracketed_paste_value(const buffer *b);
 const char *cur_bracketed_paste_string(const buffer *b);
 
+/* trigram.c */
+void free_trigram_index(buffer *b);
+bool trigram_index_pending(const buffer *b);
+bool build_trigram_index(buffer *b);
+void trigram_index_insert(buffer *b, int64_t line, line_desc *ld, int64_t pos, int64_t new_lines, int64_t end_pos, int64_t len);
+void trigram_index_delete(buffer *b, int64_t line, line_desc *ld, int64_t pos, int64_t removed_lines);
+bool set_trigram_query(const char *pattern, int len);
+line_desc *skip_trigram_blocks(buffer *b, line_desc *ld, int64_t *y, bool back, int64_t *start, int64_t *end);
+
 /* undo.c */
 void start_undo_chain(buffer *b);
 void end_undo_chain(buffer *b);
@@ -876,7 +876,14 @@ init_dfa (re_dfa_t *dfa, size_t pat_len)
   dfa->state_table = calloc (sizeof (struct re_state_table_entry), table_size);
   dfa->state_hash_mask = table_size - 1;
 
+#ifdef RE_ENABLE_I18N
   dfa->mb_cur_max = MB_CUR_MAX;
+#else
+  /* Without multibyte support matching is always bytewise, so a
+     multibyte locale would only disable the single-byte fast paths
+     (and, for instance, force the state log for every period).  */
+  dfa->mb_cur_max = 1;
+#endif
 #ifdef _LIBC
   if (dfa->mb_cur_max == 6
       && strcmp (_NL_CURRENT (LC_CTYPE, _NL_CTYPE_CODESET_NAME), "UTF-8") == 0)
@@ -0,0 +1,106 @@
+#!/usr/bin/env ruby
+
+# regress.rb runs ne on a few small documents, each case
+# reproducing a bug that has been fixed. Most cases run a
+# macro that edits the document, saves it and exits, and then
+# compare the saved document with the expected one; cases that
+# need to look at the screen (e.g., incremental find) type keys
+# on a pseudoterminal and check what ne outputs in response.
+#
+# Run it from the src directory after building ne, possibly with
+# NE_DEBUG=1 so that memory errors are caught, as
+#
+#   ruby regress.rb [BINARY]
+#
+# It prints GOOD or BAD for each case, and exits with a nonzero
+# status if any case is BAD.
+
+require 'pty'
+require 'io/console'
+require 'tmpdir'
+
+NE = File.expand_path(ARGV[0] || './ne')
+$bad = 0
+
+# Runs ne on the document doc (containing text) in the directory dir,
+# with the given macro (if any), and yields the pseudoterminal to the
+# block (if any). Returns whatever ne wrote after the block.
+
+def run_ne(dir, text, macro = nil)
+	File.write("#{dir}/doc", text)
+	args = ['--no-config']
+	if macro
+		File.write("#{dir}/macro", macro)
+		args += ['--macro', "#{dir}/macro"]
+	end
+	env = { 'HOME' => dir, 'TERM' => 'xterm', 'LANG' => 'C.UTF-8' }
+	out = ''.b
+	PTY.spawn(env, NE, *args, "#{dir}/doc") do |r, w, pid|
+		r.winsize = [24, 80]
+		drain = lambda do |t|
+			s = ''.b
+			while IO.select([r], nil, nil, t)
+				begin
+					s << r.readpartial(1 << 16)
+				rescue EOFError, Errno::EIO
+					break
+				end
+			end
+			s
+		end
+		drain.(1)
+		yield(lambda { |keys| w.write(keys); drain.(0.5) }) if block_given?
+		out = drain.(5) unless block_given?
+		Process.kill(:KILL, pid) rescue nil
+		Process.wait(pid)
+	end
+	out
+end
+
+def check(name, ok)
+	puts "#{name}: #{ok ? 'GOOD' : 'BAD'}"
+	$bad += 1 unless ok
+end
+
+# Runs macro on text, and checks that the saved document is expected.
+
+def check_macro(name, text, macro, expected)
+	Dir.mktmpdir do |dir|
+		run_ne(dir, text, macro)
+		check(name, File.read("#{dir}/doc", mode: 'rb') == expected.b)
+	end
+end
+
+# Extending the default find string must search for the extension:
+# "ba" has not been scanned for, so typing "z" after it must restart
+# the search rather than continue a scan that never happened.
+
+Dir.mktmpdir do |dir|
+	out = ''
+	run_ne(dir, "foo ba\nbar baz\n", "IncrementalFind 1\nFind ba\nMoveSOF\n") do |type|
+		type.("\x06")
+		type.("\eOF")
+		out = type.("z")
+	end
+	check('incremental find extending the default string', out.include?("\e[7mbaz"))
+end
+
+# With case folded, a bracket containing the long s matches S and s, as
+# the regex library folds them to the same upper case; the Kelvin sign,
+# instead, is upper case, and matches just itself. The second line contains
+# US-ASCII characters only, so the DFA filter must not reject it.
+
+check_macro('bracket with non-US-ASCII case variants', "é\nak s S k K\nſ \u212A\n",
+	"CaseSearch 0\nFindRegExp [ſ]\nReplaceAll X\nSave\nExit\n", "é\nak X X k K\nX \u212A\n")
+check_macro('bracket with the Kelvin sign', "é\nak s S k K\nſ \u212A\n",
+	"CaseSearch 0\nFindRegExp [\u212A]\nReplaceAll X\nSave\nExit\n", "é\nak s S k K\nſ X\n")
+
+# With case folded, UTF-8 text is matched against an upper-cased copy,
+# which may be reallocated while get_subexp() looks for the subexpression
+# of a back-reference. Without reloading the buffer, this reads freed memory
+# (build ne with NE_DEBUG=1 to catch it).
+
+check_macro('case-folded back-reference in UTF-8 text', "bbbabbbbaé\n",
+	"CaseSearch 0\nFindRegExp x?(.*)b\\1\nReplaceOnce <\\1>\nSave\nExit\n", "<bbba>é\n")
+
+exit($bad == 0)
@@ -22,6 +22,7 @@
 #include "ne.h"
 #include "regex.h"
 #include "support.h"
+#include <langinfo.h>
 
 /* This is the initial allocation size for regex.library. */
 
@@ -32,9 +33,9 @@
 
 bool last_replace_empty_match;
 
-/* This array is used both by the Boyer-Moore algorithm and by the regex
-library. It is updated if b->find_string_changed != search_serial_num (which 
-should be the case the first time the string is searched for). */
+/* This array is used by the Boyer-Moore algorithm. It is updated if
+b->find_string_changed != search_serial_num (which should be the case the
+first time the string is searched for). */
 
 static unsigned int d[256];
 
@@ -119,6 +120,11 @@ int find(buffer * const b, const char *pattern, const bool skip_first, bool wrap
 	int64_t y = b->cur_line;
 	stop = false;
 
+	/* If the buffer is indexed, we skip the lines outside [block_start..block_end)
+		that cannot contain the pattern (see trigram.c). */
+	const bool use_index = search_index && b->trigram_index && set_trigram_query(pattern, m);
+	int64_t block_start = 0, block_end = 0;
+
 	if (! b->opt.search_back) {
 
 		if (recompile_string) {
@@ -132,6 +138,16 @@ int find(buffer * const b, const char *pattern, const bool skip_first, bool wrap
 
 		while(y < b->num_lines && !stop && wrap_lines_left--) {
 
+			if (use_index && (y < block_start || y >= block_end)) {
+				const int64_t y0 = y;
+				ld = skip_trigram_blocks(b, ld, &y, false, &block_start, &block_end);
+				if (y != y0) {
+					if (y - y0 > wrap_lines_left) break;
+					wrap_lines_left -= y - y0;
+					p = ld->line + m - 1;
+				}
+			}
+
 			assert(ld->ld_node.next != NULL);
 
 			if (ld->line_len >= m) {
@@ -178,6 +194,16 @@ int find(buffer * const b, const char *pattern, const bool skip_first, bool wrap
 
 		while(y >= 0 && !stop && wrap_lines_left--) {
 
+			if (use_index && (y < block_start || y >= block_end)) {
+				const int64_t y0 = y;
+				ld = skip_trigram_blocks(b, ld, &y, true, &block_start, &block_end);
+				if (y != y0) {
+					if (y0 - y > wrap_lines_left) break;
+					wrap_lines_left -= y0 - y;
+					p = ld->line + ld->line_len - m;
+				}
+			}
+
 			assert(ld->ld_node.prev != NULL);
 
 			if (ld->line_len >= m) {
@@ -217,6 +243,165 @@ int find(buffer * const b, const char *pattern, const bool skip_first, bool wrap
 }
 
 
+/* Incremental search. start_incremental_find() records the current cursor
+   position; then, incremental_find() is called with the pattern on the input
+   line each time it might have changed, and whenever there is nothing better
+   to do. The cursor tracks the first occurrence of the pattern from the
+   starting position, in the current search direction.
+
+   When the pattern is extended, its first occurrence cannot precede the
+   first occurrence of the shorter pattern (or the point at which an
+   interrupted scan for the shorter pattern stopped), so scanning resumes from
+   there; if the shorter pattern was not found, nothing needs to be scanned at
+   all. This holds only if the shorter pattern has been scanned for: the
+   initial pattern (e.g., the default search string) has not, so its
+   extensions, like any other change, restart the scan from the starting
+   position.
+
+   Each call scans at most INCREMENTAL_FIND_BUDGET bytes, so that typing is
+   never delayed by a search through a large document: the caller should
+   keep calling incremental_find() while incremental_find_pending() is true
+   and no key is available. end_incremental_find() puts back the cursor on
+   the starting position if restore is true. */
+
+#define INCREMENTAL_FIND_BUDGET (1024 * 1024)
+
+static struct {
+	char *pattern;             /* the last pattern passed to incremental_find() */
+	line_desc *start_ld;       /* the line descriptor of the starting position */
+	int64_t start_line, start_pos; /* the starting position */
+	line_desc *ld;             /* the line descriptor where the scan resumes */
+	int64_t line, pos;         /* the position where the scan resumes (or the current match) */
+	bool scanned;              /* whether pattern has been scanned for (otherwise, the fields below are meaningless) */
+	bool pending;              /* whether the scan is incomplete */
+	bool found;                /* whether line and pos are an occurrence of pattern */
+} isearch;
+
+void start_incremental_find(buffer * const b, const char * const pattern) {
+	free(isearch.pattern);
+	isearch.pattern = str_dup(pattern ? pattern : "");
+	isearch.start_ld = b->cur_line_desc;
+	isearch.start_line = b->cur_line;
+	isearch.start_pos = b->cur_pos;
+	isearch.scanned = isearch.pending = isearch.found = false;
+}
+
+
+void end_incremental_find(buffer * const b, const bool restore) {
+	if (restore) goto_line_pos(b, isearch.start_line, isearch.start_pos);
+	free(isearch.pattern);
+	isearch.pattern = NULL;
+	isearch.scanned = isearch.pending = isearch.found = false;
+}
+
+
+bool incremental_find_pending(void) {
+	return isearch.pending;
+}
+
+
+/* Returns true if the cursor has been moved, or the search has just failed,
+   and thus the display needs to be updated. If match_len is not NULL, the
+   length of the occurrence under the cursor (or zero if there is none) is
+   stored into it. */
+
+bool incremental_find(buffer * const b, const char * const pattern, int64_t * const match_len) {
+	bool changed = false;
+
+	if (match_len) *match_len = 0;
+	if (!isearch.pattern) return false;
+
+	if (strcmp(pattern, isearch.pattern)) {
+		const size_t old_m = strlen(isearch.pattern);
+		const bool extended = isearch.scanned && old_m && !strncmp(pattern, isearch.pattern, old_m);
+
+		free(isearch.pattern);
+		if (!(isearch.pattern = str_dup(pattern))) return false;
+		highlight_match(b, 0, false);
+		changed = true;
+
+		if (!extended) {
+			/* Restart from scratch. */
+			if (b->cur_line != isearch.start_line || b->cur_pos != isearch.start_pos) goto_line_pos(b, isearch.start_line, isearch.start_pos);
+			isearch.ld = isearch.start_ld;
+			isearch.line = isearch.start_line;
+			isearch.pos = isearch.start_pos;
+			isearch.scanned = true;
+			isearch.pending = *pattern;
+		}
+		/* If the shorter pattern was found, we start from its occurrence. If the scan was not
+		complete, we resume it. If the shorter pattern was not found, neither is this one. */
+		else if (isearch.found) isearch.pending = true;
+		isearch.found = false;
+	}
+
+	if (!isearch.pending) return changed;
+
+	const int64_t m = strlen(isearch.pattern);
+	const unsigned char * const up_case = b->encoding == ENC_UTF8 ? ascii_up_case : localised_up_case;
+	const bool sense_case = (b->opt.case_search != 0);
+	const char * const pattern_end = isearch.pattern + m;
+	line_desc *ld = isearch.ld;
+	int64_t y = isearch.line, pos = isearch.pos, budget = INCREMENTAL_FIND_BUDGET;
+
+	if (! b->opt.search_back) {
+		while(ld->ld_node.next && budget > 0) {
+			for(; pos <= ld->line_len - m; pos++) {
+				const char *p = ld->line + pos, *q = isearch.pattern;
+				while(q < pattern_end && CONV(*p) == CONV(*q)) p++, q++;
+				if (q == pattern_end) {
+					isearch.found = true;
+					goto done;
+				}
+			}
+			budget -= ld->line_len + 1;
+			ld = (line_desc *)ld->ld_node.next;
+			y++;
+			pos = 0;
+		}
+		if (!ld->ld_node.next) isearch.pending = false;
+	}
+	else {
+		while(ld->ld_node.prev && budget > 0) {
+			for(pos = min(pos, ld->line_len - m); pos >= 0; pos--) {
+				const char *p = ld->line + pos, *q = isearch.pattern;
+				while(q < pattern_end && CONV(*p) == CONV(*q)) p++, q++;
+				if (q == pattern_end) {
+					isearch.found = true;
+					goto done;
+				}
+			}
+			budget -= ld->line_len + 1;
+			ld = (line_desc *)ld->ld_node.prev;
+			y--;
+			pos = INT64_MAX;
+		}
+		if (!ld->ld_node.prev) isearch.pending = false;
+	}
+
+	done:
+	isearch.ld = ld;
+	isearch.line = y;
+	isearch.pos = pos;
+
+	if (isearch.found) {
+		isearch.pending = false;
+		goto_line_pos(b, y, pos);
+		if (match_len) *match_len = m;
+		return true;
+	}
+
+	if (!isearch.pending) {
+		/* The search failed: we go back to the starting position. */
+		if (b->cur_line != isearch.start_line || b->cur_pos != isearch.start_pos) goto_line_pos(b, isearch.start_line, isearch.start_pos);
+		alert();
+		return true;
+	}
+
+	return changed;
+}
+
+
 
 /* Replaces n characters with the given string at the current cursor position,
    and then moves it to the end of the string. */
@@ -246,14 +431,85 @@ int replace(buffer * const b, const int n, const char * const string) {
 
 
 
-/* The following variables are used by regex. In particular, re_reg holds
-the start/end of the extended replacement registers. */
+/* The maximum number of compiled regular expressions kept in re_cache. */
+
+#define REGEX_CACHE_SIZE 16
+
+/* A compiled regular expression. If the expression is an alternation of
+   literal strings, multi contains the Aho-Corasick automaton compiled from
+   it, and pb is not compiled. Otherwise, dfa contains the lazy DFA compiled
+   from the same expression as pb, used to skip quickly lines that cannot
+   contain a match, or NULL if the expression is not suitable for
+   filtering. If rewritten is true, the expression has been rewritten by
+   utf8_byte_regexp() to search UTF-8 text bytewise, and map_group maps the
+   groups of regex to the actual ones. */
+
+typedef struct {
+	char *regex;
+	bool utf8, icase;   /* The encoding and case folding of the compilation (together with pb.translate). */
+	bool rewritten;
+	int map_group[RE_NREGS];
+	struct re_pattern_buffer pb;
+	char fastmap[256];
+	struct lazy_dfa *dfa;
+	struct aho_corasick *multi;
+} compiled_regexp;
+
+/* Compiled regular expressions, most recently used first, so that switching
+   between a few expressions (e.g., in macros, or while detecting virtual
+   extensions) does not recompile them every time. re_cache[0] is the
+   expression of the last search. */
+
+static compiled_regexp *re_cache[REGEX_CACHE_SIZE];
+
+/* re_reg holds the start/end of the extended replacement registers. When
+   re_cache[0] has an Aho-Corasick automaton, it contains just the match. */
 
-static struct re_pattern_buffer re_pb;
 static struct re_registers re_reg;
 
-/* This string is used to replace the dot in UTF-8 searches. It will match only
- whole UTF-8 sequences. */
+/* The regex library matches multibyte characters if the current locale is
+   multibyte. regex_locale() returns a locale with the suitable character
+   type for the given encoding: a UTF-8 locale for UTF-8 text, and a
+   single-byte locale (if possible, the current one) otherwise. The result is
+   (locale_t)0 if no such locale is available, in which case the current
+   locale should be used.
+
+   If ne has been compiled without wide-character support, or no UTF-8
+   locale is available, native_utf8_regexp() returns false: UTF-8 text must
+   then be searched bytewise (in the single-byte locale) for the expression
+   rewritten by utf8_byte_regexp(). */
+
+static locale_t utf8_locale, byte_locale;
+
+static void init_regex_locales(void) {
+	static bool initialized;
+
+	if (!initialized) {
+		initialized = true;
+		const char * const codeset = nl_langinfo(CODESET);
+		if (!strcmp(codeset, "UTF-8") || !strcmp(codeset, "utf8")) utf8_locale = LC_GLOBAL_LOCALE;
+		else if (!(utf8_locale = newlocale(LC_CTYPE_MASK, "C.UTF-8", (locale_t)0))) utf8_locale = newlocale(LC_CTYPE_MASK, "en_US.UTF-8", (locale_t)0);
+		byte_locale = MB_CUR_MAX == 1 ? LC_GLOBAL_LOCALE : newlocale(LC_CTYPE_MASK, "C", (locale_t)0);
+	}
+}
+
+locale_t regex_locale(const encoding_type encoding) {
+	init_regex_locales();
+	return encoding == ENC_UTF8 ? utf8_locale : byte_locale;
+}
+
+bool native_utf8_regexp(void) {
+#ifdef NOWCHAR
+	return false;
+#else
+	init_regex_locales();
+	return utf8_locale != (locale_t)0;
+#endif
+}
+
+
+/* This string is used to replace the dot in bytewise UTF-8 searches. It will
+ match only whole UTF-8 sequences. */
 
 #define UTF8DOT "([\x01-\x7F\xC0-\xFF][\x80-\xBF]*)"
 
@@ -264,25 +520,235 @@ static struct re_registers re_reg;
 
 #define UTF8COMP "([\xC0-\xFF][\x80-\xBF]+|[^"
 
-/* This string is used to replace non-word-constituents (\W) in UTF-8
+/* This string is used to replace non-word-constituents (\W) in bytewise UTF-8
  searches. It will match only whole UTF-8 sequences of non-word-constituent
  characters. */
 
 #define UTF8NONWORD "([\x01-\x1E\x20-\x2F\x3A-\x40\x5B-\x60\x7B-\x7F]|[\xC0-\xFF][\x80-\xBF]+)"
 
-/* In UTF-8 text, the numbering of a parenthesised group may differ from the
-   "official" one, due to the usage of parenthesis in UTF8DOT, UT8COMP and
-   UTF8NONWORD. This array records for each user-invoked group the
-   corresponding (usually larger) regex group. The group may be larger than
-   RE_NREGS, in which case there is no way to recover it. */
+/* Rewrites regex so that, when matched bytewise against UTF-8 text, it does
+   not match UTF-8 subsequences: dots are replaced with UTF8DOT,
+   non-word-constituents (\W) with UTF8NONWORD, and complemented character
+   classes are embedded in UTF8COMP. Character classes may contain US-ASCII
+   characters only. The rewritten expression is stored in a newly allocated
+   string in *actual_regex.
+
+   Since the substitutions introduce new groups, the numbering of a
+   parenthesised group may differ from the "official" one. If map_group is
+   not NULL, for each user-invoked group the corresponding (usually larger)
+   actual group is recorded in map_group, which must have RE_NREGS elements.
+   The group may be larger than RE_NREGS, in which case there is no way to
+   recover it. */
+
+int utf8_byte_regexp(const char * const regex, char ** const actual_regex, int * const map_group) {
+	const char *s;
+	char *q;
+	bool escape = false;
+	int virtual_group = 0, real_group = 0, dots = 0, comps = 0, nonwords = 0;
+
+	s = regex;
+
+	/* We first scan regex to compute the exact number of characters of
+		the actual (i.e., after substitutions) regex. */
+
+	do {
+		if (!escape) {
+			if (*s == '.') dots++;
+			else if (*s == '[') {
+				if (*(s+1) == '^') {
+					comps++;
+					s++;
+				}
+
+				if (*(s+1) == ']') s++; /* A literal ]. */
+
+				/* We scan the list up to ] and check that no non-US-ASCII characters appear. */
+				do if (utf8len(*(++s)) != 1) return UTF8_REGEXP_CHARACTER_CLASS_NOT_SUPPORTED; while(*s && *s != ']');
+			}
+			else if (*s == '\\') {
+				escape = true;
+				continue;
+			}
+		}
+		else if (*s == 'W') nonwords++;
+		escape = false;
+	} while(*(++s));
+
+	*actual_regex = q = malloc(strlen(regex) + 1 + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
+	if (!*actual_regex) return OUT_OF_MEMORY;
+	s = regex;
+	escape = false;
+
+	if (map_group) {
+		map_group[0] = 0;
+		for(int i = 1; i < RE_NREGS; i++) map_group[i] = RE_NREGS;
+	}
+
+	do {
+		if (escape || *s != '.' && *s != '(' && *s != '[' && *s != '\\') {
+			if (escape && *s == 'W') {
+				q--;
+				strcpy(q, UTF8NONWORD);
+				q += strlen(UTF8NONWORD);
+				real_group++;
+			}
+			else *(q++) = *s;
+		}
+		else {
+			if (*s == '\\') {
+				escape = true;
+				*(q++) = '\\';
+				continue;
+			}
+
+			if (*s == '.') {
+				strcpy(q, UTF8DOT);
+				q += strlen(UTF8DOT);
+				real_group++;
+			}
+			else if (*s == '(') {
+				*(q++) = '(';
+				++real_group;
+				if (map_group && virtual_group < RE_NREGS - 1) map_group[++virtual_group] = real_group;
+			}
+			else if (*s == '[') {
+				if (*(s+1) == '^') {
+					strcpy(q, UTF8COMP);
+					q += strlen(UTF8COMP);
+					s++;
+					if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
+					do *(q++) = *(++s); while (*s && *s != ']');
+					if (*s) *(q++) = ')';
+					real_group++;
+				}
+				else {
+					*(q++) = '[';
+					if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
+					do *(q++) = *(++s); while (*s && *s != ']');
+				}
+			}
+		}
+
+		escape = false;
+	} while(*(s++));
+
+	/* This assert may be false if a [ is not closed. */
+	assert(strlen(*actual_regex) == strlen(regex) + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
+	return OK;
+}
+
+static void free_compiled_regexp(compiled_regexp * const r) {
+	if (!r) return;
+	/* regfree() would free our fastmap and translation table. */
+	r->pb.fastmap = NULL;
+	r->pb.translate = NULL;
+	regfree(&r->pb);
+	free_lazy_dfa(r->dfa);
+	free_aho_corasick(r->multi);
+	free(r->regex);
+	free(r);
+}
+
+
+/* Moves to the front of re_cache the compilation of regex for the given
+   encoding and case folding, compiling it (after rewriting it with
+   utf8_byte_regexp(), if rewrite is true) if it is not in the cache (and
+   possibly evicting the least recently used expression). Must be called with
+   the locale returned by regex_locale(). */
+
+static int select_regexp(const char * const regex, const bool utf8, const bool rewrite, const bool icase, unsigned char * const translate) {
+	int i;
+	for(i = 0; i < REGEX_CACHE_SIZE && re_cache[i]; i++)
+		if (re_cache[i]->utf8 == utf8 && re_cache[i]->rewritten == rewrite && re_cache[i]->icase == icase && re_cache[i]->pb.translate == translate && !strcmp(re_cache[i]->regex, regex)) break;
+
+	compiled_regexp *r;
+
+	if (i < REGEX_CACHE_SIZE && re_cache[i]) r = re_cache[i];
+	else {
+		if (!(r = calloc(1, sizeof *r))) return OUT_OF_MEMORY;
+		if (!(r->regex = str_dup(regex))) {
+			free(r);
+			return OUT_OF_MEMORY;
+		}
+		r->utf8 = utf8;
+		r->rewritten = rewrite;
+		r->icase = icase;
+		r->pb.translate = translate;
+		r->pb.fastmap = r->fastmap;
+
+		char *actual_regex = r->regex;
+		if (rewrite) {
+			const int error = utf8_byte_regexp(regex, &actual_regex, r->map_group);
+			if (error) {
+				free_compiled_regexp(r);
+				return error;
+			}
+		}
+
+		/* Alternations of literal strings do not need the regex library. */
+		if (!(r->multi = alloc_aho_corasick(actual_regex, icase ? ascii_up_case : translate, icase))) {
+			const reg_syntax_t syntax = re_syntax_options;
+			if (icase) re_set_syntax(syntax | RE_ICASE);
+			const char * const p = re_compile_pattern(actual_regex, strlen(actual_regex), &r->pb);
+			re_set_syntax(syntax);
+
+			if (p) {
+				if (rewrite) free(actual_regex);
+				free_compiled_regexp(r);
+				/* Here we have a very dirty hack: since we cannot return the error of
+					regex, we print it here. Which means that we access term.c's
+					functions. 8^( */
+				print_message(p);
+				alert();
+				return ERROR;
+			}
+
+			/* All expressions share re_reg. */
+			r->pb.regs_allocated = REGS_REALLOCATE;
+			r->dfa = alloc_lazy_dfa(actual_regex, icase ? ascii_up_case : translate, utf8);
+		}
+		else if (!re_reg.start) {
+			if (!(re_reg.start = malloc(sizeof *re_reg.start)) || !(re_reg.end = malloc(sizeof *re_reg.end))) {
+				free(re_reg.start);
+				re_reg.start = NULL;
+				if (rewrite) free(actual_regex);
+				free_compiled_regexp(r);
+				return OUT_OF_MEMORY;
+			}
+			re_reg.num_regs = 1;
+		}
+
+		if (rewrite) free(actual_regex);
+
+		if (i == REGEX_CACHE_SIZE) free_compiled_regexp(re_cache[--i]);
+	}
+
+	memmove(re_cache + 1, re_cache, i * sizeof *re_cache);
+	re_cache[0] = r;
+	return OK;
+}
+
+
+/* Searches for the expression in the len bytes of line using the given
+   Aho-Corasick automaton, as re_search() would, starting at start (forward)
+   or at start or before (backward), and sets re_reg accordingly. */
+
+static int64_t multi_search(const struct aho_corasick * const multi, const char * const line, const int64_t len, const int64_t start, const bool back) {
+	int64_t end;
+	const int64_t pos = aho_corasick_search(multi, line, len, start, back, &end);
+	if (pos >= 0) {
+		re_reg.num_regs = 1;
+		re_reg.start[0] = pos;
+		re_reg.end[0] = end;
+	}
+	return pos;
+}
 
-static int map_group[RE_NREGS];
 
 /* Works exactly like find(), but uses the regex library instead. */
 
 int find_regexp(buffer * const b, const char *regex, const bool skip_first, bool wrap_once) {
 
-	const unsigned char * const up_case = b->encoding == ENC_UTF8 ? ascii_up_case : localised_up_case;
 	bool recompile_string;
 
 	if (!regex) {
@@ -298,156 +764,68 @@ int find_regexp(buffer * const b, const char *regex, const bool skip_first, bool
 
 	if (!regex || !strlen(regex)) return ERROR;
 
-	if (re_pb.buffer == NULL) {
-		if (re_pb.buffer = malloc(START_BUFFER_SIZE)) re_pb.allocated = START_BUFFER_SIZE;
-		else return OUT_OF_MEMORY;
-	}
+	/* In UTF-8 text the regex library works on characters, and case is folded
+		using RE_ICASE; otherwise, we use a translation table. If UTF-8 text
+		cannot be matched natively, we search it bytewise for a rewritten
+		expression, folding only US-ASCII letters. We have to be careful: even
+		if the search string has not changed, it is possible that case
+		sensitivity or the encoding has. In this case, we select another
+		compilation. */
 
-	re_pb.fastmap = (void *)d;
+	const bool utf8 = b->encoding == ENC_UTF8 && native_utf8_regexp(), rewrite = b->encoding == ENC_UTF8 && !utf8, icase = !b->opt.case_search && utf8;
+	unsigned char * const translate = b->opt.case_search || utf8 ? NULL : rewrite ? (unsigned char *)ascii_up_case : localised_up_case;
 
-	/* We have to be careful: even if the search string has not changed, it
-	is possible that case sensitivity has. In this case, we force recompilation. */
+	if (!re_cache[0] || re_cache[0]->pb.translate != translate || re_cache[0]->utf8 != utf8 || re_cache[0]->rewritten != rewrite || re_cache[0]->icase != icase) recompile_string = true;
 
-	if (b->opt.case_search) {
-		if (re_pb.translate != 0) recompile_string = true;
-		re_pb.translate = 0;
-	}
-	else {
-		if (re_pb.translate != up_case) recompile_string = true;
-		re_pb.translate = (unsigned char *)up_case;
-	}
+	const locale_t locale = uselocale(regex_locale(utf8 ? ENC_UTF8 : ENC_8_BIT));
 
 	if (recompile_string) {
-		const char *actual_regex = regex;
-
-		/* If the buffer encoding is UTF-8, we need to replace dots with UTF8DOT,
-			non-word-constituents (\W) with UTF8NONWORD, and embed complemented
-			character classes in UTF8COMP, so that they do not match UTF-8
-			subsequences. Moreover, we must compute the remapping from the virtual
-			to the actual groups caused by the new groups thus introduced. */
-
-		if (b->encoding == ENC_UTF8) {
-			const char *s;
-			char *q;
-			bool escape = false;
-			int virtual_group = 0, real_group = 0, dots = 0, comps = 0, nonwords = 0;
-
-			s = regex;
-
-			/* We first scan regex to compute the exact number of characters of
-				the actual (i.e., after substitutions) regex. */
-
-			do {
-				if (!escape) {
-					if (*s == '.') dots++;
-					else if (*s == '[') {
-						if (*(s+1) == '^') {
-							comps++;
-							s++;
-						}
-
-						if (*(s+1) == ']') s++; /* A literal ]. */
-
-						/* We scan the list up to ] and check that no non-US-ASCII characters appear. */
-						do if (utf8len(*(++s)) != 1) return UTF8_REGEXP_CHARACTER_CLASS_NOT_SUPPORTED; while(*s && *s != ']');
-					}
-					else if (*s == '\\') {
-						escape = true;
-						continue;
-					}
-				}
-				else if (*s == 'W') nonwords++;
-				escape = false;
-			} while(*(++s));
-
-			actual_regex = q = malloc(strlen(regex) + 1 + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
-			if (!actual_regex) return OUT_OF_MEMORY;
-			s = regex;
-			escape = false;
-
-			do {
-				if (escape || *s != '.' && *s != '(' && *s != '[' && *s != '\\') {
-					if (escape && *s == 'W') {
-						q--;
-						strcpy(q, UTF8NONWORD);
-						q += strlen(UTF8NONWORD);
-						real_group++;
-					}
-					else *(q++) = *s;
-				}
-				else {
-					if (*s == '\\') {
-						escape = true;
-						*(q++) = '\\';
-						continue;
-					}
-
-					if (*s == '.') {
-						strcpy(q, UTF8DOT);
-						q += strlen(UTF8DOT);
-						real_group++;
-					}
-					else if (*s == '(') {
-						*(q++) = '(';
-						if (virtual_group < RE_NREGS - 1) map_group[++virtual_group] = ++real_group;
-					}
-					else if (*s == '[') {
-						if (*(s+1) == '^') {
-							strcpy(q, UTF8COMP);
-							q += strlen(UTF8COMP);
-							s++;
-							if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
-							do *(q++) = *(++s); while (*s && *s != ']');
-							if (*s) *(q++) = ')';
-							real_group++;
-						}
-						else {
-							*(q++) = '[';
-							if (*(s+1) == ']') *(q++) = *(++s); /* A literal ]. */
-							do *(q++) = *(++s); while (*s && *s != ']');
-						}
-					}
-				}
-
-				escape = false;
-			} while(*(s++));
-
-			/* This assert may be false if a [ is not closed. */
-			assert(strlen(actual_regex) == strlen(regex) + (strlen(UTF8DOT) - 1) * dots + (strlen(UTF8NONWORD) - 2) * nonwords + (strlen(UTF8COMP) - 1) * comps);
-		}
-
-		const char * p = re_compile_pattern(actual_regex, strlen(actual_regex), &re_pb);
-
-		if (b->encoding == ENC_UTF8) free((void*)actual_regex);
-
-		if (p) {
-			/* Here we have a very dirty hack: since we cannot return the error of
-				regex, we print it here. Which means that we access term.c's
-				functions. 8^( */
-			print_message(p);
-			alert();
-			return ERROR;
+		const int error = select_regexp(regex, utf8, rewrite, icase, translate);
+		if (error) {
+			uselocale(locale);
+			return error;
 		}
-
 	}
 
 	b->find_string_changed = search_serial_num;
 
+	struct re_pattern_buffer * const re_pb = &re_cache[0]->pb;
+	struct lazy_dfa * const re_dfa = re_cache[0]->dfa;
+	const struct aho_corasick * const re_multi = re_cache[0]->multi;
 	line_desc *ld = b->cur_line_desc;
 	int64_t y = b->cur_line;
 	stop = false;
 
+	const char *literal = NULL;
+	const int literal_len = re_dfa ? lazy_dfa_literal(re_dfa, &literal) : 0;
+	const bool use_index = search_index && b->trigram_index && set_trigram_query(literal, literal_len);
+	int64_t block_start = 0, block_end = 0;
+
 	if (! b->opt.search_back) {
 
 		int64_t start_pos = b->cur_pos + (skip_first ? 1 : 0);
 		int64_t wrap_lines_left = b->num_lines + 1;
 
 		while(y < b->num_lines && !stop && wrap_lines_left--) {
+
+			if (use_index && (y < block_start || y >= block_end)) {
+				const int64_t y0 = y;
+				ld = skip_trigram_blocks(b, ld, &y, false, &block_start, &block_end);
+				if (y != y0) {
+					if (y - y0 > wrap_lines_left) break;
+					wrap_lines_left -= y - y0;
+					start_pos = 0;
+				}
+			}
+
 			assert(ld->ld_node.next != NULL);
 
 			int64_t pos;
 			if (start_pos <= ld->line_len &&
-				 (pos = re_search(&re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, ld->line_len - start_pos, &re_reg)) >= 0) {
+				 (!re_dfa || lazy_dfa_may_match(re_dfa, ld->line + start_pos, ld->line_len - start_pos)) &&
+				 (pos = re_multi ? multi_search(re_multi, ld->line, ld->line_len, start_pos, false)
+					: re_search(re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, ld->line_len - start_pos, &re_reg)) >= 0) {
+				uselocale(locale);
 				goto_line_pos(b, y, pos);
 				return OK;
 			}
@@ -469,11 +847,24 @@ int find_regexp(buffer * const b, const char *regex, const bool skip_first, bool
 
 		while(y >= 0 && !stop && wrap_lines_left--) {
 
+			if (use_index && (y < block_start || y >= block_end)) {
+				const int64_t y0 = y;
+				ld = skip_trigram_blocks(b, ld, &y, true, &block_start, &block_end);
+				if (y != y0) {
+					if (y0 - y > wrap_lines_left) break;
+					wrap_lines_left -= y0 - y;
+					start_pos = ld->line_len;
+				}
+			}
+
 			assert(ld->ld_node.prev != NULL);
 
 			int64_t pos;
 			if (start_pos >= 0 &&
-				 (pos = re_search(&re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, -start_pos - 1, &re_reg)) >= 0) {
+				 (!re_dfa || lazy_dfa_may_match(re_dfa, ld->line, ld->line_len)) &&
+				 (pos = re_multi ? multi_search(re_multi, ld->line, ld->line_len, start_pos, true)
+					: re_search(re_pb, ld->line ? ld->line : "", ld->line_len, start_pos, -start_pos - 1, &re_reg)) >= 0) {
+				uselocale(locale);
 				goto_line_pos(b, y, pos);
 				return OK;
 			}
@@ -490,10 +881,81 @@ int find_regexp(buffer * const b, const char *regex, const bool skip_first, bool
 		}
 	}
 
+	uselocale(locale);
 	return stop ? STOPPED : NOT_FOUND;
 }
 
 
+/* Searches for any of the nonempty lines of the file with the given name
+   (or, if name is NULL, of the current clip), taken literally. The search
+   string becomes a regular expression matching any of the lines, so
+   RepeatLast, Replace and so on work as usual; such expressions are
+   matched by an Aho-Corasick automaton (see aho.c). */
+
+int find_any(buffer * const b, const char *name) {
+	char_stream *cs = NULL;
+	const clip_desc *cd = NULL;
+
+	if (name) {
+		name = tilde_expand(name);
+		if (is_directory(name)) return FILE_IS_DIRECTORY;
+		const int fd = open(name, READ_FLAGS);
+		if (fd < 0) return CANT_OPEN_FILE;
+		if (!(cs = alloc_char_stream(0))) {
+			close(fd);
+			return OUT_OF_MEMORY;
+		}
+		cs = load_stream_from_fd(cs, fd, false, false);
+		close(fd);
+		if (!cs) return CANT_OPEN_FILE;
+	}
+	else if (!(cd = get_nth_clip(b->opt.cur_clip))) return CLIP_DOESNT_EXIST;
+
+	const char * const stream = cs ? cs->stream : cd->cs->stream;
+	const int64_t len = cs ? cs->len : cd->cs->len;
+	char * const regex = malloc(2 * len + 1);
+
+	if (!regex) {
+		free_char_stream(cs);
+		return OUT_OF_MEMORY;
+	}
+
+	/* Lines are NUL-terminated in streams. We escape special characters, and
+		separate nonempty lines with |. */
+	char *q = regex;
+	bool new_line = false;
+	for(int64_t i = 0; i < len; i++) {
+		if (stream[i] == 0) new_line = true;
+		else {
+			if (new_line && q != regex) *q++ = '|';
+			new_line = false;
+			if (strchr("\\.[]*+?^$()|", stream[i])) *q++ = '\\';
+			*q++ = stream[i];
+		}
+	}
+	*q = 0;
+	free_char_stream(cs);
+
+	if (!*regex) {
+		free(regex);
+		return STRING_IS_EMPTY;
+	}
+
+	const encoding_type encoding = detect_encoding(regex, q - regex);
+	if (encoding != ENC_ASCII && b->encoding != ENC_ASCII && encoding != b->encoding) {
+		free(regex);
+		return INCOMPATIBLE_SEARCH_STRING_ENCODING;
+	}
+
+	free(b->find_string);
+	b->find_string = regex;
+	b->find_string_changed = 1;
+	b->last_was_replace = 0;
+	b->last_was_regexp = 1;
+	return find_regexp(b, NULL, false, false);
+}
+
+
 /* This allows regexp users to retrieve matched substrings.
    They are responsible for freeing these strings.
    n should be <= number of paren groups in original regex.
@@ -550,10 +1012,10 @@ int replace_regexp(buffer * const b, const char * const string) {
 				len--;
 			}
 			else if (i >= 0 && i < re_reg.num_regs && re_reg.start[i] >= 0) {
-				if (b->encoding == ENC_UTF8) {
-					/* In the UTF-8 case, the replacement group index must be
+				if (re_cache[0]->rewritten) {
+					/* In the bytewise UTF-8 case, the replacement group index must be
 						mapped through map_group to recover the real group. */
-					if ((i = map_group[i]) >= RE_NREGS) {
+					if ((i = re_cache[0]->map_group[i]) >= RE_NREGS) {
 						free(p);
 						return GROUP_NOT_AVAILABLE;
 					}
@@ -630,3 +1092,233 @@ int replace_regexp(buffer * const b, const char * const string) {
 	last_replace_empty_match = re_reg.start[0] == re_reg.end[0];
 	return OK;
 }
+
+
+
+/* The line rebuilt by replace_all(), its allocated size and its length. */
+
+static char *ra_buf;
+static int64_t ra_size, ra_len;
+
+/* Appends len bytes to ra_buf, enlarging it if necessary. */
+
+static bool ra_append(const char * const s, const int64_t len) {
+	if (ra_len + len > ra_size) {
+		const int64_t new_size = max(ra_size * 2, ra_len + len + START_BUFFER_SIZE);
+		char * const p = realloc(ra_buf, new_size);
+		if (!p) return false;
+		ra_buf = p;
+		ra_size = new_size;
+	}
+	memcpy(ra_buf + ra_len, s, len);
+	ra_len += len;
+	return true;
+}
+
+
+/* Appends to ra_buf the expansion of the regular-expression replacement
+   string for the match described by re_reg, with the same rules (and the
+   same errors) of replace_regexp(). The text of group i starts at
+   s2 + re_reg.start[i] - len1 (see re_search_2()). */
+
+static int ra_append_regexp(const char *string, const char * const s2, const int64_t len1) {
+	for(;;) {
+		const char *q = string;
+		while(*q && *q != '\\') q++;
+		if (!ra_append(string, q - string)) return OUT_OF_MEMORY;
+		if (!*q) return OK;
+
+		int i = *(q + 1) - '0';
+
+		if (*(q + 1) == '\\') {
+			if (!ra_append(q + 1, 1)) return OUT_OF_MEMORY;
+		}
+		else if (i >= 0 && i < re_reg.num_regs && re_reg.start[i] >= 0) {
+			if (re_cache[0]->rewritten && (i = re_cache[0]->map_group[i]) >= RE_NREGS) return GROUP_NOT_AVAILABLE;
+			if (re_reg.end[i] - re_reg.start[i] && !ra_append(s2 + re_reg.start[i] - len1, re_reg.end[i] - re_reg.start[i])) return OUT_OF_MEMORY;
+		}
+		else return WRONG_CHAR_AFTER_BACKSLASH;
+
+		string = q + 2;
+	}
+}
+
+
+/* Returns true if the given regular expression might match differently
+   depending on the characters preceding the starting position of the search
+   (i.e., if it contains ^, \b, \B, \<, \> or \`). The check is conservative. */
+
+static bool regexp_depends_on_context(const char *regex) {
+	for(; *regex; regex++) {
+		if (*regex == '^') return true;
+		if (*regex == '\\' && *++regex && strchr("bB<>`", *regex)) return true;
+		if (!*regex) break;
+	}
+	return false;
+}
+
+
+/* Replaces all occurrences of the current search string, from the cursor
+   position to the end of the buffer, with the given string, storing the
+   number of replacements in num_replace. The search string must have just
+   been successfully searched for by find() or find_regexp(), so the cursor
+   is on the first occurrence; only forward searches are supported.
+
+   The result is the same as alternating find()/find_regexp() and
+   replace()/replace_regexp() (in particular, each search starts after the
+   previous replacement), but all occurrences in a line are gathered while
+   rebuilding the line in ra_buf, and then the line is modified just once.
+   Syntax states and the display are updated once at the end. For regular
+   expressions that depend on the preceding context, the search must see the
+   text already replaced, so the rebuilt prefix and the rest of the line are
+   passed to re_search_2() (which concatenates them); otherwise, the
+   original line is searched directly.
+
+   The return value is NOT_FOUND if the end of the buffer was reached, as
+   the iterative loop would have, or STOPPED, or an error code. */
+
+int replace_all(buffer * const b, const char * const string, int64_t * const num_replace) {
+	assert(string != NULL);
+	assert(!b->opt.search_back);
+
+	const unsigned char * const up_case = b->encoding == ENC_UTF8 ? ascii_up_case : localised_up_case;
+	const bool sense_case = (b->opt.case_search != 0);
+	const bool regexp = b->last_was_regexp;
+	const bool context = regexp && regexp_depends_on_context(b->find_string);
+	const int64_t m = strlen(b->find_string), string_len = strlen(string);
+	line_desc *ld = b->cur_line_desc, *first_ld = NULL, *last_ld = NULL;
+	int64_t y = b->cur_line, src = b->cur_pos, cursor_line = b->cur_line, cursor_pos = b->cur_pos;
+	int error = NOT_FOUND;
+
+	*num_replace = 0;
+	stop = false;
+
+	const locale_t locale = uselocale(regexp ? regex_locale(re_cache[0]->utf8 ? ENC_UTF8 : ENC_8_BIT) : (locale_t)0);
+	struct re_pattern_buffer * const re_pb = regexp ? &re_cache[0]->pb : NULL;
+	struct lazy_dfa * const re_dfa = regexp ? re_cache[0]->dfa : NULL;
+	const struct aho_corasick * const re_multi = regexp ? re_cache[0]->multi : NULL;
+
+	for(; ld->ld_node.next && !stop; ld = (line_desc *)ld->ld_node.next, y++, src = 0) {
+		const char * const line = ld->line ? ld->line : "";
+		int64_t first = -1;
+
+		ra_len = 0;
+
+		/* The lazy DFA lets us skip quickly lines without matches. */
+		if (re_dfa && !lazy_dfa_may_match(re_dfa, line + src, ld->line_len - src)) continue;
+
+		while(src <= ld->line_len) {
+			const char *s2 = line;
+			int64_t len1 = 0, match_start = -1, match_end;
+
+			if (regexp) {
+				/* For context-dependent expressions, after the first replacement
+					we search the rebuilt prefix followed by the rest of the line. */
+				const bool rebuilt = context && first >= 0;
+				if (rebuilt) {
+					s2 = line + src;
+					len1 = ra_len;
+				}
+				const int64_t len2 = ld->line_len - (s2 - line), start = rebuilt ? ra_len : src;
+				const int64_t pos = re_multi ? multi_search(re_multi, line, ld->line_len, src, false)
+					: re_search_2(re_pb, rebuilt ? ra_buf : NULL, len1, s2, len2, start, len1 + len2 - start, &re_reg, len1 + len2);
+				if (pos < 0) break;
+
+				match_start = (s2 - line) + pos - len1;
+				match_end = (s2 - line) + re_reg.end[0] - len1;
+			}
+			else {
+				if (ld->line_len - src < m) break;
+
+				/* This is the inner loop of find(), which has already compiled d. */
+				const char *p = line + src + m - 1;
+				const unsigned char first_char = CONV(b->find_string[m - 1]);
+
+				while(p - line < ld->line_len) {
+					const unsigned char c = CONV(*p);
+					if (c != first_char) p += d[c];
+					else {
+						int i;
+						for (i = 1; i < m; i++)
+							if (CONV(*(p - i)) != CONV(b->find_string[m - i - 1])) {
+								p += d[c];
+								break;
+							}
+						if (i == m) {
+							match_start = (p - line) - m + 1;
+							break;
+						}
+					}
+				}
+
+				if (match_start < 0) break;
+				match_end = match_start + m;
+			}
+
+			if (first < 0) {
+				first = match_start;
+				if (!ra_append(line, match_start)) { error = OUT_OF_MEMORY; goto done; }
+			}
+			else if (!ra_append(line + src, match_start - src)) { error = OUT_OF_MEMORY; goto done; }
+
+			if (regexp) {
+				const int e = ra_append_regexp(string, s2, len1);
+				if (e) {
+					error = e;
+					goto done;
+				}
+			}
+			else if (!ra_append(string, string_len)) { error = OUT_OF_MEMORY; goto done; }
+
+			(*num_replace)++;
+			cursor_line = y;
+			cursor_pos = ra_len;
+			src = match_end;
+
+			/* After an empty match, we skip a character, as the iterative loop does. */
+			if (match_start == match_end) {
+				if (src == ld->line_len) {
+					if (((line_desc *)ld->ld_node.next)->ld_node.next) {
+						cursor_line = y + 1;
+						cursor_pos = 0;
+					}
+					break;
+				}
+				const int64_t len = next_pos(line, src, b->encoding) - src;
+				if (!ra_append(line + src, len)) { error = OUT_OF_MEMORY; goto done; }
+				src += len;
+				cursor_pos = ra_len;
+			}
+		}
+
+		if (first >= 0) {
+			/* We now replace the modified part of the line. */
+			int e = OK;
+			if (src - first) e = delete_stream(b, ld, y, first, src - first);
+			if (!e && ra_len - first) e = insert_stream(b, ld, y, first, ra_buf + first, ra_len - first);
+			if (e) {
+				error = e;
+				goto done;
+			}
+			if (!first_ld) first_ld = ld;
+			last_ld = ld;
+		}
+	}
+
+	done:
+	uselocale(locale);
+	free(ra_buf);
+	ra_buf = NULL;
+	ra_size = ra_len = 0;
+
+	if (first_ld) {
+		update_syntax_states_delay(b, first_ld, last_ld);
+		reset_window();
+		b->attr_len = -1;
+		if (cursor_line == b->cur_line) goto_pos(b, cursor_pos);
+		else goto_line_pos(b, cursor_line, cursor_pos);
+	}
+
+	if (stop) error = STOPPED;
+	return error;
+}
@@ -563,13 +563,13 @@ void unset_interactive_mode(void) {
 	clear_to_eol();
 	move_cursor(ne_lines - 1, 0);
 
-	/* Now we disable the keypad, cursor addressing, etc. fflush() guarantees
+	/* Now we disable the keypad, cursor addressing, etc. flush_frame() guarantees
 		that tcsetattr() won't clip part of the capability strings output by
 		reset_terminal_modes(). */
 
 	reset_terminal_modes();
-	putchar('\r');
-	fflush(stdout);
+	frame_putc('\r');
+	flush_frame();
 
 	/* Now we restore all the flags in the termios structure to the state they
 		were before us. */
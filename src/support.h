@@ -56,12 +56,19 @@ static int inline get_char_width(const char * const s, const encoding_type encod
 
 /* Computes the TAB-expanded width of a line descriptor up to a certain
    position. The position can be greater than the line length, the usual
-   convention of infinite expansion via spaces being in place. */
+   convention of infinite expansion via spaces being in place. On long lines,
+   the scan starts from a checkpoint of the column index (see colindex.c). */
 
 static int64_t inline calc_width(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding) {
 
-	int64_t width = 0;
-	for(int64_t pos = 0; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
+	int64_t pos = 0, width = 0;
+	if (ld->line_len >= COL_INDEX_MIN_LEN) {
+		const col_checkpoint * const cp = col_checkpoint_by_pos(ld, n, tab_size, encoding);
+		pos = cp->pos;
+		width = cp->width;
+	}
+
+	for(; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
 		if (pos >= ld->line_len) width++;
 		else if (ld->line[pos] != '\t') width += get_char_width(&ld->line[pos], encoding);
 		else width += tab_size - width % tab_size;
@@ -77,7 +84,7 @@ static int64_t inline calc_width(const line_desc * const ld, const int64_t n, co
    known width. */
 
 static int64_t inline calc_width_hint(const line_desc * const ld, const int64_t n, const int tab_size, const encoding_type encoding, const int64_t cur_pos, const int64_t cur_width) {
-	if (cur_pos < n) {
+	if (cur_pos < n && n - cur_pos < COL_INDEX_MIN_LEN) {
 		int64_t width = cur_width;
 		for(int64_t pos = cur_pos; pos < n; pos = pos < ld->line_len ? next_pos(ld->line, pos, encoding) : pos + 1) {
 			if (pos >= ld->line_len) width++;
@@ -93,8 +100,13 @@ static int64_t inline calc_width_hint(const line_desc * const ld, const int64_t
 /* Computes character length of a line descriptor up to a given position. */
 
 static int64_t inline calc_char_len(const line_desc * const ld, const int64_t n, const encoding_type encoding) {
-	int64_t len = 0;
-	for(int64_t pos = 0; pos < n; pos = next_pos(ld->line, pos, encoding), len++);
+	int64_t pos = 0, len = 0;
+	if (ld->line_len >= COL_INDEX_MIN_LEN) {
+		const col_checkpoint * const cp = col_checkpoint_by_pos(ld, n, 0, encoding);
+		pos = cp->pos;
+		len = cp->chars;
+	}
+	for(; pos < n; pos = next_pos(ld->line, pos, encoding), len++);
 	return len;
 }
 
@@ -106,8 +118,13 @@ static int64_t inline calc_char_len(const line_desc * const ld, const int64_t n,
 
 static int64_t inline calc_pos(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding) {
 	int c_width;
-	int64_t pos = 0;
-	for(int64_t width = 0; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
+	int64_t pos = 0, width = 0;
+	if (ld->line_len >= COL_INDEX_MIN_LEN) {
+		const col_checkpoint * const cp = col_checkpoint_by_col(ld, col, tab_size, encoding);
+		pos = cp->pos;
+		width = cp->width;
+	}
+	for(; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
 		if (ld->line[pos] != '\t') width += c_width;
 		else width += tab_size - width % tab_size;
 	}
@@ -122,8 +139,13 @@ static int64_t inline calc_pos(const line_desc * const ld, const int64_t col, co
 
 static int64_t inline calc_virt_pos(const line_desc * const ld, const int64_t col, const int tab_size, const encoding_type encoding) {
 	int c_width;
-	int64_t pos, width;
-	for(pos = width = 0; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
+	int64_t pos = 0, width = 0;
+	if (ld->line_len >= COL_INDEX_MIN_LEN) {
+		const col_checkpoint * const cp = col_checkpoint_by_col(ld, col, tab_size, encoding);
+		pos = cp->pos;
+		width = cp->width;
+	}
+	for(; pos < ld->line_len && width + (c_width = get_char_width(&ld->line[pos], encoding)) <= col; pos = next_pos(ld->line, pos, encoding)) {
 		if (ld->line[pos] != '\t') width += c_width;
 		else width += tab_size - width % tab_size;
 	}
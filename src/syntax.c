@@ -22,6 +22,8 @@
 #include "ne.h"
 #include "support.h"
 #include "termchar.h"
+#include <pthread.h>
+#include <sys/mman.h>
 #undef joe_gettext
 #define joe_gettext(a) (a)
 
@@ -165,6 +167,141 @@ unsigned char *lowerize(unsigned char *s) {
 	return s;
 }
 
+/* Compares two strings ignoring case, like zcmp() on their lowerized versions. */
+
+static int zicmp(const unsigned char *a, const unsigned char *b) {
+	while(*a && tolower(*a) == tolower(*b)) a++, b++;
+	return tolower(*a) - tolower(*b);
+}
+
+/* Keyword tables */
+
+/* Hashes the NUL-terminated string s, lowering its characters if ignore is
+   set, and stores its length in *len. */
+
+static inline uint64_t keyword_hash(const uint64_t seed, const unsigned char *s, const bool ignore, int * const len) {
+	const unsigned char * const s0 = s;
+	uint64_t h = seed ^ 0xcbf29ce484222325ULL;
+
+	if (ignore) for(; *s; s++) h = (h ^ tolower(*s)) * 0x100000001b3ULL;
+	else for(; *s; s++) h = (h ^ *s) * 0x100000001b3ULL;
+
+	*len = s - s0;
+	return h ^ h >> 29;
+}
+
+/* Returns the slot of a keyword with hash h. */
+
+static inline uint32_t keyword_slot(const struct high_keywords * const kw, const uint64_t h) {
+	return ((uint32_t)(h >> 32) + kw->disp[h & kw->bucket_mask] * 0x9E3779B9U) * 0x85EBCA6BU >> kw->slot_shift;
+}
+
+/* Returns the number of slots of a keyword table. */
+
+static inline uint32_t keyword_slots(const struct high_keywords * const kw) {
+	return UINT32_C(1) << (32 - kw->slot_shift);
+}
+
+/* Returns the command associated with the NUL-terminated string s in a
+   keyword table, or NULL. The string is lowered on the fly if the table
+   ignores case. */
+
+static inline struct high_cmd *find_keyword(const struct high_keywords * const kw, const unsigned char * const s, const bool ignore) {
+	int len;
+	const uint64_t h = keyword_hash(kw->seed, s, ignore, &len);
+	const struct high_keyword * const k = &kw->slot[keyword_slot(kw, h)];
+
+	if (k->len != len) return NULL;
+	if (ignore) {
+		for(int i = 0; i < len; i++) if (tolower(s[i]) != k->name[i]) return NULL;
+	}
+	else {
+		for(int i = 0; i < len; i++) if (s[i] != k->name[i]) return NULL;
+	}
+	return k->cmd;
+}
+
+/* Compiles the n keywords in k (already lowered if case is ignored) into a
+   perfect hash. If a keyword appears more than once, the last occurrence
+   wins. The array k is not freed. */
+
+static struct high_keywords *build_keywords(const struct high_keyword * const k, const int n) {
+	struct high_keywords * const kw = joe_malloc(sizeof *kw);
+	uint32_t nbuckets = 1, nslots = 2;
+	while(nbuckets < (uint32_t)n / 2) nbuckets *= 2;
+	for(kw->slot_shift = 31; nslots < 2 * (uint32_t)n; kw->slot_shift--) nslots *= 2;
+	kw->bucket_mask = nbuckets - 1;
+	kw->disp = joe_malloc(nbuckets * sizeof *kw->disp);
+	kw->slot = joe_malloc(nslots * sizeof *kw->slot);
+
+	uint64_t * const h = joe_malloc(n * sizeof *h);
+	/* Keywords grouped by bucket: bucket b owns key[first[b]] ... key[first[b + 1] - 1]. */
+	int * const key = joe_malloc(n * sizeof *key);
+	int * const first = joe_malloc((nbuckets + 1) * sizeof *first);
+	int * const fill = joe_malloc(nbuckets * sizeof *fill);
+	uint32_t * const slot = joe_malloc(n * sizeof *slot);
+	bool * const used = joe_malloc(nslots * sizeof *used);
+
+	for(kw->seed = 0;; kw->seed++) {
+		int len, max_size = 0;
+		for(int i = 0; i < n; i++) h[i] = keyword_hash(kw->seed, k[i].name, false, &len);
+
+		memset(first, 0, (nbuckets + 1) * sizeof *first);
+		for(int i = 0; i < n; i++) first[(h[i] & kw->bucket_mask) + 1]++;
+		for(uint32_t b = 0; b < nbuckets; b++) {
+			if (first[b + 1] > max_size) max_size = first[b + 1];
+			first[b + 1] += first[b];
+			fill[b] = first[b];
+		}
+		for(int i = 0; i < n; i++) key[fill[h[i] & kw->bucket_mask]++] = i;
+
+		/* Duplicates end up in the same bucket: drop all but the last one. */
+		for(uint32_t b = 0; b < nbuckets; b++)
+			for(int j = first[b]; j < first[b + 1]; j++)
+				for(int l = j + 1; l < first[b + 1]; l++)
+					if (h[key[j]] == h[key[l]] && !zcmp(k[key[j]].name, k[key[l]].name)) {
+						key[j] = -1;
+						break;
+					}
+
+		memset(used, 0, nslots * sizeof *used);
+		for(uint32_t i = 0; i < nslots; i++) kw->slot[i] = (struct high_keyword){ NULL, -1, NULL };
+
+		/* Largest buckets first, as they are the hardest to place. */
+		bool ok = true;
+		for(int size = max_size; ok && size > 0; size--)
+			for(uint32_t b = 0; ok && b < nbuckets; b++) {
+				if (first[b + 1] - first[b] != size) continue;
+				for(kw->disp[b] = 0;; kw->disp[b]++) {
+					if (kw->disp[b] == 1 << 16) {
+						ok = false;
+						break;
+					}
+					int j;
+					for(j = first[b]; j < first[b + 1]; j++) {
+						if (key[j] < 0) continue;
+						slot[j] = keyword_slot(kw, h[key[j]]);
+						if (used[slot[j]]) break;
+						used[slot[j]] = true;
+					}
+					if (j == first[b + 1]) break;
+					while(j-- != first[b]) if (key[j] >= 0) used[slot[j]] = false;
+				}
+				for(int j = first[b]; ok && j < first[b + 1]; j++)
+					if (key[j] >= 0) kw->slot[slot[j]] = k[key[j]];
+			}
+		if (ok) break;
+	}
+
+	joe_free(used);
+	joe_free(slot);
+	joe_free(fill);
+	joe_free(first);
+	joe_free(key);
+	joe_free(h);
+	return kw;
+}
+
 /* Parse one line.  Returns new state.
    'syntax' is the loaded syntax definition for this buffer.
    'line' is advanced to start of next line.
@@ -177,8 +314,22 @@ int64_t attr_len = 0;
 int stack_count = 0;
 static int state_count = 0; /* Max transitions possible without cycling */
 
-HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, HIGHLIGHT_STATE h_state, const bool utf8)
+/* Stack frames are shared by all lines, and created on demand: this mutex
+   protects their creation when lines are parsed in parallel (see parse_r()),
+   that is, when parallel_parse is true. */
+
+bool parallel_parse;
+static pthread_mutex_t stack_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* A reentrant version of parse(): the attributes are stored in the given
+   buffer, which is enlarged as necessary, and their number in *attr_len_p.
+   It can be called concurrently on different lines, provided that each
+   thread uses its own buffer. */
+
+HIGHLIGHT_STATE parse_r(struct high_syntax * const syntax, line_desc * const ld, HIGHLIGHT_STATE h_state, const bool utf8, uint32_t **attr_buf_p, int64_t *attr_size_p, int64_t *attr_len_p)
 {
+	uint32_t *attr_buf = *attr_buf_p;
+	int64_t attr_size = *attr_size_p;
 	struct high_frame *stack;
 
 	struct high_state *h;
@@ -186,8 +337,6 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 			/* Current state */
 
 	unsigned char buf[24];			/* Name buffer (trunc after 23 characters) */
-	unsigned char lbuf[24];			/* Lower case version of name buffer */
-	unsigned char lsaved_s[24];		/* Lower case version of delimiter match buffer */
 	int buf_idx=0;				/* Index into buffer */
 	int c;					/* Current character */
 	int c_len;				/* Character length in bytes */
@@ -199,6 +348,7 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 	int mark2 = 0;  			/* offset to mark end from current pos */
 	int mark_en = 0;			/* set if marking */
 	int recolor_delimiter_or_keyword;
+	const bool stats = syntax_stats;
 
 	/* Nothing should reference 'h' above here. */
 	if (h_state.state < 0) {
@@ -218,7 +368,7 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 	/* Get next character */
 							/* Una iterazione in più: aggiungo '\n' come ultimo carattere. */
 	while( p <= q ) { /* On the last iteration, process the virtual '\n' character. */
-		struct high_cmd *cmd, *kw_cmd;
+		struct high_cmd *cmd, *char_cmd, *kw_cmd;
 		int iters = -8; /* +8 extra iterations before cycle detect. */
 		int x;
 
@@ -254,6 +404,8 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 			/* Guard against infinite loops from buggy syntaxes */
 			if (iters++ > state_count) {
 				invalidate_state(&h_state);
+				*attr_buf_p = attr_buf;
+				*attr_size_p = attr_size;
 				return h_state;
 			}
 
@@ -266,29 +418,32 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 			else
 				cmd = h->cmd[c];
 
-			/* Lowerize strings for case-insensitive matching */
-			if (cmd->ignore) {
-				zcpy(lbuf,buf);
-				lowerize(lbuf);
-				if (cmd->delim) {
-					zcpy(lsaved_s,h_state.saved_s);
-					lowerize(lsaved_s);
-				}
-			}
-
-			/* Check for delimiter or keyword matches */
+			/* Check for delimiter or keyword matches (case is folded in place) */
 			recolor_delimiter_or_keyword = 0;
-			if (cmd->delim && (cmd->ignore ? !zcmp(lsaved_s,lbuf) : !zcmp(h_state.saved_s,buf))) {
+			char_cmd = cmd;
+			if (cmd->delim && (cmd->ignore ? !zicmp(h_state.saved_s,buf) : !zcmp(h_state.saved_s,buf))) {
 				cmd = cmd->delim;
 				recolor_delimiter_or_keyword = 1;
-			} else if (cmd->keywords && (cmd->ignore ? (kw_cmd=htfind(cmd->keywords,lbuf)) : (kw_cmd=htfind(cmd->keywords,buf)))) {
+			} else if (cmd->keywords && (kw_cmd = find_keyword(cmd->keywords, buf, cmd->ignore))) {
 				cmd = kw_cmd;
 				recolor_delimiter_or_keyword = 1;
 			}
 
+			/* Update profiling counters of the current state */
+			if (stats) {
+				struct high_stats * const st = &h->stats;
+				if (cmd->noeat) st->noeat++;
+				else st->chars++;
+				if (char_cmd->delim) st->delims++;
+				if (char_cmd->keywords && (!char_cmd->delim || cmd != char_cmd->delim)) st->keywords++;
+				if (cmd->call) st->calls++;
+				if (recolor_delimiter_or_keyword || cmd->recolor < 0 || cmd->recolor_mark) st->recolors++;
+			}
+
 			/* Determine new state */
 			if (cmd->call) {
 				/* Call */
+				if (parallel_parse) pthread_mutex_lock(&stack_mutex);
 				struct high_frame **frame_ptr = stack ? &stack->child : &syntax->stack_base;
 				/* Search for an existing stack frame for this call */
 				while (*frame_ptr && !((*frame_ptr)->syntax == cmd->call && (*frame_ptr)->return_state == cmd->new_state))
@@ -306,6 +461,7 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 					stack = frame;
 					++stack_count;
 				}
+				if (parallel_parse) pthread_mutex_unlock(&stack_mutex);
 				h = stack->syntax->states[0];
 			} else if (cmd->rtn) {
 				/* Return */
@@ -403,10 +559,17 @@ HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, H
 	/* Return new state */
 	h_state.stack = stack;
 	h_state.state = h->no;
-	attr_len = attr - attr_buf - 1; /* -1 because of the fake newline. */
+	*attr_buf_p = attr_buf;
+	*attr_size_p = attr_size;
+	*attr_len_p = attr - attr_buf - 1; /* -1 because of the fake newline. */
 	return h_state;
 }
 
+HIGHLIGHT_STATE parse(struct high_syntax * const syntax, line_desc * const ld, HIGHLIGHT_STATE h_state, const bool utf8)
+{
+	return parse_r(syntax, ld, h_state, utf8, &attr_buf, &attr_size, &attr_len);
+}
+
 /* Subroutines for load_dfa() */
 
 static struct high_state *find_state(struct high_syntax *syntax,unsigned char *name)
@@ -419,7 +582,7 @@ static struct high_state *find_state(struct high_syntax *syntax,unsigned char *n
 	/* It doesn't exist, so create it */
 	if(!state) {
 		int y;
-		state=joe_malloc(sizeof(struct high_state));
+		state=joe_calloc(1,sizeof(struct high_state));
 		state->name=zdup(name);
 		state->no=syntax->nstates;
 		state->color=FG_WHITE;
@@ -440,6 +603,8 @@ static struct high_state *find_state(struct high_syntax *syntax,unsigned char *n
 
 static void iz_cmd(struct high_cmd *cmd)
 {
+	/* Clear padding, too, so that compact_syntax() can compare commands with memcmp(). */
+	memset(cmd, 0, sizeof *cmd);
 	cmd->noeat = 0;
 	cmd->recolor = 0;
 	cmd->start_buffering = 0;
@@ -640,6 +805,8 @@ void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsig
 		} else if(!parsing_strings && (!zcmp(bf,USTR "strings") || !zcmp(bf,USTR "istrings"))) {
 			if (bf[0]=='i')
 				cmd->ignore = 1;
+			struct high_keyword *kw = NULL;
+			int nkw = 0, szkw = 0;
 			while(fgets((char *)buf,1023,f)) {
 				++line;
 				p = buf;
@@ -658,9 +825,9 @@ void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsig
 							if (!zcmp(bf, USTR "&")) {
 								cmd->delim = kw_cmd;
 							} else {
-								if(!cmd->keywords)
-									cmd->keywords = htmk(64);
-								htadd(cmd->keywords,zdup(bf),kw_cmd);
+								if (nkw == szkw)
+									kw = joe_realloc(kw, sizeof *kw * (szkw = szkw ? szkw * 2 : 64));
+								kw[nkw++] = (struct high_keyword){ zdup(bf), zlen(bf), kw_cmd };
 							}
 							parse_options(syntax,kw_cmd,f,p,1,name,line);
 						} else
@@ -669,6 +836,10 @@ void parse_options(struct high_syntax *syntax,struct high_cmd *cmd,FILE *f,unsig
 						i_printf_2((char *)joe_gettext(_("%s %d: Missing string\n")),name,line);
 				}
 			}
+			if (nkw) {
+				cmd->keywords = build_keywords(kw, nkw);
+				joe_free(kw);
+			}
 		} else if(!zcmp(bf,USTR "noeat")) {
 			cmd->noeat = 1;
 		} else if(!zcmp(bf,USTR "mark")) {
@@ -915,6 +1086,63 @@ int syntax_match(struct high_syntax *syntax,unsigned char *name,unsigned char *s
 	return syntax_params == params;
 }
 
+/* Compacts the character tables of a freshly loaded syntax. Every distinct
+   command referenced by a character table or by a state delimiter is moved
+   into a single contiguous array, so that the transitions visited while
+   parsing share as few cache lines as possible, and the tables are
+   repointed accordingly. Commands that are identical field by field are
+   merged, as they would behave in the same way. */
+
+static void compact_syntax(struct high_syntax *syntax)
+{
+	struct high_cmd **orig = joe_malloc(sizeof(struct high_cmd *) * (256 + 1) * syntax->nstates);
+	int *index = joe_malloc(sizeof(int) * (256 + 1) * syntax->nstates);
+	int norig = 0, s, c, i, j;
+
+	syntax->cmds = joe_malloc(sizeof(struct high_cmd) * (256 + 1) * syntax->nstates);
+	syntax->ncmds = 0;
+
+	for(s = 0; s != syntax->nstates; ++s) {
+		struct high_state * const state = syntax->states[s];
+		for(c = 0; c != 257; ++c) {
+			struct high_cmd * const cmd = c == 256 ? state->delim : state->cmd[c];
+			if (!cmd) continue;
+			/* Consecutive bytes usually share their command. */
+			if (norig && orig[norig - 1] == cmd) continue;
+			for(i = 0; i != norig && orig[i] != cmd; i++);
+			if (i != norig) continue;
+			for(j = 0; j != syntax->ncmds && memcmp(&syntax->cmds[j], cmd, sizeof *cmd); j++);
+			if (j == syntax->ncmds) syntax->cmds[syntax->ncmds++] = *cmd;
+			orig[norig] = cmd;
+			index[norig++] = j;
+		}
+	}
+
+	syntax->cmds = joe_realloc(syntax->cmds, sizeof(struct high_cmd) * syntax->ncmds);
+
+	for(s = 0; s != syntax->nstates; ++s) {
+		struct high_state * const state = syntax->states[s];
+		struct high_cmd *last = NULL, *last_new = NULL;
+		for(c = 0; c != 257; ++c) {
+			struct high_cmd ** const p = c == 256 ? &state->delim : &state->cmd[c];
+			if (!*p) continue;
+			if (*p != last) {
+				last = *p;
+				for(i = 0; orig[i] != *p; i++);
+				last_new = &syntax->cmds[index[i]];
+			}
+			*p = last_new;
+		}
+	}
+
+	/* Character-table commands are referenced only by the tables. */
+	for(i = 0; i != norig; i++)
+		if (orig[i] != &syntax->default_cmd) joe_free(orig[i]);
+
+	joe_free(index);
+	joe_free(orig);
+}
+
 struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,struct high_param *params)
 {
 	struct high_syntax *syntax;	/* New syntax table */
@@ -942,6 +1170,7 @@ struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,str
 	syntax_list = syntax;
 
 	if (load_dfa(syntax)) {
+		compact_syntax(syntax);
 		/* dump_syntax(syntax); */
 		return syntax;
 	} else {
@@ -960,10 +1189,660 @@ struct high_syntax *load_syntax_subr(unsigned char *name,unsigned char *subr,str
 	}
 }
 
+/* Binary syntax cache
+
+   Loading a syntax requires parsing its .jsf file and the files of all the
+   subroutines it calls. To avoid paying this cost every time ne starts, a
+   syntax loaded from source is serialized, together with all syntaxes it
+   calls, into a file in the SYNTAX_CACHE_DIR subdirectory of the
+   preferences directory. The file records the path, modification time and
+   size of every source file involved, and it is used only if all names
+   still resolve to the same files (so, for instance, copying a global
+   syntax file to ~/.ne/syntax invalidates the cache). Cache files are
+   mapped in memory, and names and keyword displacements are used in place.
+
+   Cache files are in host byte order and contain 32-bit words and
+   NUL-terminated strings padded to a multiple of four bytes. Any mismatch
+   in the header, or any inconsistency, causes the syntax to be loaded from
+   source and the cache to be rewritten. */
+
+#define SYNTAX_CACHE_MAGIC "ne-jsc\n"
+#define SYNTAX_CACHE_VERSION 1
+#define SYNTAX_CACHE_BYTE_ORDER 0x01020304
+
+/* Resolves the source file of a syntax as load_dfa() does, and stats it. */
+
+static bool stat_syntax_file(const unsigned char * const name, char * const path, const size_t size, struct stat * const st)
+{
+	const char * const dir[2] = { exists_prefs_dir(), exists_gprefs_dir() };
+
+	for(int i = 0; i < 2; i++)
+		if (dir[i] && strlen(dir[i]) + 2 + strlen(SYNTAX_DIR) + strlen(SYNTAX_EXT) + strlen((const char *)name) < size) {
+			strcat(strcat(strcat(strcat(strcpy(path, dir[i]), SYNTAX_DIR), "/"), (const char *)name), SYNTAX_EXT);
+			if (!stat(path, st) && !access(path, R_OK)) return true;
+		}
+	return false;
+}
+
+/* Computes the name of the cache file of a syntax. */
+
+static bool syntax_cache_file(const unsigned char * const name, char * const path, const size_t size)
+{
+	const char * const p = exists_prefs_dir();
+
+	if (!p || strchr((const char *)name, '/') || strlen(p) + 2 + strlen(SYNTAX_CACHE_DIR) + strlen(SYNTAX_CACHE_EXT) + strlen((const char *)name) >= size) return false;
+	strcat(strcat(strcat(strcat(strcpy(path, p), SYNTAX_CACHE_DIR), "/"), (const char *)name), SYNTAX_CACHE_EXT);
+	return true;
+}
+
+static uint32_t cmd_flags(const struct high_cmd * const cmd)
+{
+	return cmd->noeat | cmd->start_buffering << 1 | cmd->stop_buffering << 2 | cmd->save_c << 3 | cmd->save_s << 4 | cmd->ignore << 5
+		| cmd->start_mark << 6 | cmd->stop_mark << 7 | cmd->recolor_mark << 8 | cmd->rtn << 9 | cmd->reset << 10;
+}
+
+static void set_cmd_flags(struct high_cmd * const cmd, const uint32_t flags)
+{
+	cmd->noeat = flags;
+	cmd->start_buffering = flags >> 1;
+	cmd->stop_buffering = flags >> 2;
+	cmd->save_c = flags >> 3;
+	cmd->save_s = flags >> 4;
+	cmd->ignore = flags >> 5;
+	cmd->start_mark = flags >> 6;
+	cmd->stop_mark = flags >> 7;
+	cmd->recolor_mark = flags >> 8;
+	cmd->rtn = flags >> 9;
+	cmd->reset = flags >> 10;
+}
+
+/* A syntax being saved, with the commands that are not in its character
+   tables (delimiters and keywords, which are numbered after syntax->cmds)
+   and its keyword tables. */
+
+struct saved_syntax {
+	struct high_syntax *syntax;
+	struct high_cmd **extra;
+	int nextra, szextra;
+	struct high_keywords **kw;
+	int nkw, szkw;
+};
+
+static struct high_cmd *saved_cmd(const struct saved_syntax * const s, const int i)
+{
+	return i < s->syntax->ncmds ? &s->syntax->cmds[i] : s->extra[i - s->syntax->ncmds];
+}
+
+static void add_extra(struct saved_syntax * const s, struct high_cmd * const cmd)
+{
+	if (s->nextra == s->szextra) s->extra = joe_realloc(s->extra, sizeof *s->extra * (s->szextra = s->szextra ? s->szextra * 2 : 64));
+	s->extra[s->nextra++] = cmd;
+}
+
+/* Returns the index of cmd in s, or -1 for NULL. Extra commands are
+   searched starting from hint, as they are referenced mostly in order.
+   Clears *ok if cmd is not in s. */
+
+static int32_t saved_cmd_index(const struct saved_syntax * const s, const struct high_cmd * const cmd, int * const hint, bool * const ok)
+{
+	if (!cmd) return -1;
+	if (cmd >= s->syntax->cmds && cmd < s->syntax->cmds + s->syntax->ncmds) return cmd - s->syntax->cmds;
+	for(int i = 0; i < s->nextra; i++) {
+		const int j = (*hint + i) % s->nextra;
+		if (s->extra[j] == cmd) {
+			*hint = j + 1;
+			return s->syntax->ncmds + j;
+		}
+	}
+	*ok = false;
+	return -1;
+}
+
+static void write32(FILE * const f, const uint32_t x)
+{
+	fwrite(&x, sizeof x, 1, f);
+}
+
+static void write64(FILE * const f, const uint64_t x)
+{
+	write32(f, x);
+	write32(f, x >> 32);
+}
+
+static void write_str(FILE * const f, const unsigned char * const s)
+{
+	static const char pad[4];
+	const uint32_t len = zlen((unsigned char *)s);
+	write32(f, len);
+	fwrite(s, 1, len + 1, f);
+	fwrite(pad, 1, -(len + 1) & 3, f);
+}
+
+/* Saves syntax and all syntaxes it calls to the cache. Errors are ignored,
+   as the cache is just an optimization. */
+
+void save_syntax_cache(struct high_syntax * const syntax)
+{
+	char path[1024], tmp[1024 + 16], src[1024];
+	struct stat st;
+
+	if (!syntax_cache_file(syntax->name, path, sizeof path)) return;
+
+	/* Collect the syntaxes reachable through calls, their extra commands and their keyword tables. */
+	int n = 1, sz = 8;
+	struct saved_syntax *s = joe_malloc(sizeof *s * sz);
+	memset(s, 0, sizeof *s);
+	s[0].syntax = syntax;
+
+	for(int i = 0; i < n; i++)
+		for(int j = 0; j < s[i].syntax->ncmds + s[i].nextra; j++) {
+			struct high_cmd * const cmd = saved_cmd(&s[i], j);
+			if (cmd->call) {
+				int k;
+				for(k = 0; k < n && s[k].syntax != cmd->call; k++);
+				if (k == n) {
+					if (n == sz) s = joe_realloc(s, sizeof *s * (sz *= 2));
+					memset(&s[n], 0, sizeof *s);
+					s[n++].syntax = cmd->call;
+				}
+			}
+			if (cmd->delim) add_extra(&s[i], cmd->delim);
+			if (cmd->keywords) {
+				int k;
+				for(k = 0; k < s[i].nkw && s[i].kw[k] != cmd->keywords; k++);
+				if (k == s[i].nkw) {
+					if (s[i].nkw == s[i].szkw) s[i].kw = joe_realloc(s[i].kw, sizeof *s[i].kw * (s[i].szkw = s[i].szkw ? s[i].szkw * 2 : 8));
+					s[i].kw[s[i].nkw++] = cmd->keywords;
+					for(uint32_t l = 0; l <= keyword_slots(cmd->keywords) - 1; l++)
+						if (cmd->keywords->slot[l].name) add_extra(&s[i], cmd->keywords->slot[l].cmd);
+				}
+			}
+		}
+
+	FILE *f = NULL;
+	bool ok = true;
+
+	/* Create the cache directory, if necessary. */
+	strcat(strcpy(tmp, exists_prefs_dir()), SYNTAX_CACHE_DIR);
+	mkdir(tmp, 0700);
+	snprintf(tmp, sizeof tmp, "%s.%d", path, (int)getpid());
+	if (!(f = fopen(tmp, "w"))) ok = false;
+
+	if (ok) {
+		fwrite(SYNTAX_CACHE_MAGIC, 1, sizeof SYNTAX_CACHE_MAGIC, f);
+		write32(f, SYNTAX_CACHE_VERSION);
+		write32(f, SYNTAX_CACHE_BYTE_ORDER);
+
+		/* Source files (one per syntax name). */
+		int nfiles = 0;
+		for(int i = 0; i < n; i++) {
+			int k;
+			for(k = 0; k < i && zcmp(s[k].syntax->name, s[i].syntax->name); k++);
+			if (k == i) nfiles++;
+		}
+		write32(f, nfiles);
+		for(int i = 0; i < n; i++) {
+			int k;
+			for(k = 0; k < i && zcmp(s[k].syntax->name, s[i].syntax->name); k++);
+			if (k < i) continue;
+			if (!stat_syntax_file(s[i].syntax->name, src, sizeof src, &st)) {
+				ok = false;
+				break;
+			}
+			write_str(f, s[i].syntax->name);
+			write_str(f, (unsigned char *)src);
+			write64(f, st.st_mtime);
+			write64(f, st.st_size);
+		}
+
+		/* Syntax headers. */
+		write32(f, n);
+		for(int i = 0; i < n; i++) {
+			const struct high_syntax * const syn = s[i].syntax;
+			int nparams = 0;
+			write_str(f, syn->name);
+			write32(f, syn->subr != NULL);
+			if (syn->subr) write_str(f, syn->subr);
+			for(struct high_param *param = syn->params; param; param = param->next) nparams++;
+			write32(f, nparams);
+			for(struct high_param *param = syn->params; param; param = param->next) write_str(f, param->name);
+		}
+
+		/* Syntax bodies. */
+		for(int i = 0; i < n; i++) {
+			const struct high_syntax * const syn = s[i].syntax;
+			int hint = 0;
+			write32(f, syn->nstates);
+			write32(f, syn->ncmds);
+			write32(f, s[i].nextra);
+			write32(f, s[i].nkw);
+
+			for(int j = 0; j < syn->nstates; j++) {
+				const struct high_state * const state = syn->states[j];
+				write_str(f, state->name);
+				write32(f, state->color);
+				write32(f, saved_cmd_index(&s[i], state->delim, &hint, &ok));
+				for(int c = 0; c < 256; c++) write32(f, saved_cmd_index(&s[i], state->cmd[c], &hint, &ok));
+			}
+
+			for(int j = 0; j < syn->ncmds + s[i].nextra; j++) {
+				const struct high_cmd * const cmd = saved_cmd(&s[i], j);
+				int k = -1;
+				write32(f, cmd_flags(cmd));
+				write32(f, cmd->recolor);
+				if (cmd->new_state && (cmd->new_state->no >= syn->nstates || syn->states[cmd->new_state->no] != cmd->new_state)) ok = false;
+				write32(f, cmd->new_state ? cmd->new_state->no : -1);
+				if (cmd->call) for(k = 0; s[k].syntax != cmd->call; k++);
+				write32(f, k);
+				write32(f, saved_cmd_index(&s[i], cmd->delim, &hint, &ok));
+				k = -1;
+				if (cmd->keywords) for(k = 0; s[i].kw[k] != cmd->keywords; k++);
+				write32(f, k);
+			}
+
+			for(int j = 0; j < s[i].nkw; j++) {
+				const struct high_keywords * const kw = s[i].kw[j];
+				write64(f, kw->seed);
+				write32(f, kw->bucket_mask);
+				write32(f, kw->slot_shift);
+				for(uint32_t b = 0; b <= kw->bucket_mask; b++) write32(f, kw->disp[b]);
+				for(uint32_t l = 0; l < keyword_slots(kw); l++) {
+					write32(f, kw->slot[l].len);
+					if (kw->slot[l].len < 0) continue;
+					write_str(f, kw->slot[l].name);
+					write32(f, saved_cmd_index(&s[i], kw->slot[l].cmd, &hint, &ok));
+				}
+			}
+		}
+	}
+
+	if (f) {
+		if (ferror(f)) ok = false;
+		if (fclose(f)) ok = false;
+		if (!ok || rename(tmp, path)) unlink(tmp);
+	}
+
+	for(int i = 0; i < n; i++) {
+		joe_free(s[i].extra);
+		joe_free(s[i].kw);
+	}
+	joe_free(s);
+}
+
+struct cache_reader {
+	const unsigned char *p, *end;
+	bool error;
+};
+
+static uint32_t read32(struct cache_reader * const r)
+{
+	uint32_t x = 0;
+	if (r->end - r->p < 4) r->error = true;
+	else {
+		memcpy(&x, r->p, sizeof x);
+		r->p += sizeof x;
+	}
+	return x;
+}
+
+static uint64_t read64(struct cache_reader * const r)
+{
+	const uint64_t x = read32(r);
+	return x | (uint64_t)read32(r) << 32;
+}
+
+/* Returns a string stored in place in the cache. */
+
+static unsigned char *read_str(struct cache_reader * const r)
+{
+	const uint32_t len = read32(r);
+	const unsigned char * const s = r->p;
+	if (r->error || (uint64_t)(r->end - r->p) < ((uint64_t)len + 4 & ~3) || s[len]) {
+		r->error = true;
+		return USTR "";
+	}
+	r->p += (uint64_t)len + 4 & ~3;
+	return (unsigned char *)s;
+}
+
+/* Returns the count n, checking that the cache contains at least n items of min_size bytes. */
+
+static uint32_t read_count(struct cache_reader * const r, const size_t min_size)
+{
+	const uint32_t n = read32(r);
+	if (n > (size_t)(r->end - r->p) / min_size) r->error = true;
+	return r->error ? 0 : n;
+}
+
+/* Returns the command with index read32() of syntax, or NULL for -1. */
+
+static struct high_cmd *read_cmd(struct cache_reader * const r, const struct high_syntax * const syntax, const uint32_t ncmds)
+{
+	const uint32_t i = read32(r);
+	if (i == UINT32_MAX) return NULL;
+	if (i >= ncmds) {
+		r->error = true;
+		return NULL;
+	}
+	return &syntax->cmds[i];
+}
+
+static void free_cached_syntax(struct high_syntax * const syntax, struct high_keywords ** const kw, const int nkw)
+{
+	for(int i = 0; i < nkw; i++) {
+		joe_free(kw[i]->slot);
+		joe_free(kw[i]);
+	}
+	for(int i = 0; i < syntax->nstates; i++) joe_free(syntax->states[i]);
+	while(syntax->params) {
+		struct high_param * const param = syntax->params;
+		syntax->params = param->next;
+		joe_free(param);
+	}
+	joe_free(syntax->states);
+	joe_free(syntax->cmds);
+	joe_free(syntax);
+}
+
+/* Builds the syntaxes stored in a mapped cache file, and returns the first
+   one, or NULL if the cache is not valid. Syntaxes that have already been
+   loaded are not duplicated. */
+
+static struct high_syntax *read_syntax_cache(const unsigned char * const name, const unsigned char * const map, const size_t size)
+{
+	struct cache_reader r = { map, map + size, false };
+	char path[1024];
+	struct stat st;
+
+	if (size < sizeof SYNTAX_CACHE_MAGIC || memcmp(map, SYNTAX_CACHE_MAGIC, sizeof SYNTAX_CACHE_MAGIC)) return NULL;
+	r.p += sizeof SYNTAX_CACHE_MAGIC;
+	if (read32(&r) != SYNTAX_CACHE_VERSION || read32(&r) != SYNTAX_CACHE_BYTE_ORDER) return NULL;
+
+	/* Check that the source files have not changed. */
+	const uint32_t nfiles = read_count(&r, 4);
+	for(uint32_t i = 0; i < nfiles; i++) {
+		const unsigned char * const file_name = read_str(&r);
+		const unsigned char * const file_path = read_str(&r);
+		const uint64_t mtime = read64(&r), file_size = read64(&r);
+		if (r.error || !stat_syntax_file(file_name, path, sizeof path, &st) || strcmp(path, (const char *)file_path)
+			|| (uint64_t)st.st_mtime != mtime || (uint64_t)st.st_size != file_size) return NULL;
+	}
+
+	const uint32_t n = read_count(&r, 4);
+	if (n == 0) return NULL;
+
+	struct high_syntax ** const syn = joe_calloc(n, sizeof *syn);
+	/* Syntaxes already loaded, to be used in place of the corresponding new ones */
+	struct high_syntax ** const loaded = joe_calloc(n, sizeof *loaded);
+	/* Keyword tables, and total no. commands, of each syntax */
+	struct high_keywords *** const kw = joe_calloc(n, sizeof *kw);
+	uint32_t * const nkw = joe_calloc(n, sizeof *nkw);
+	uint32_t * const ncmds = joe_calloc(n, sizeof *ncmds);
+	uint32_t i;
+
+	for(i = 0; i < n && !r.error; i++) {
+		struct high_syntax * const syntax = syn[i] = joe_malloc(sizeof *syntax);
+		struct high_param **param_ptr = &syntax->params;
+		syntax->name = read_str(&r);
+		syntax->subr = read32(&r) ? read_str(&r) : NULL;
+		const uint32_t nparams = read_count(&r, 4);
+		for(uint32_t j = 0; j < nparams; j++) {
+			*param_ptr = joe_malloc(sizeof **param_ptr);
+			(*param_ptr)->name = read_str(&r);
+			param_ptr = &(*param_ptr)->next;
+		}
+		*param_ptr = NULL;
+		syntax->states = NULL;
+		syntax->nstates = 0;
+		syntax->cmds = NULL;
+		syntax->ht_states = NULL;
+		syntax->color = NULL;
+		iz_cmd(&syntax->default_cmd);
+		syntax->default_cmd.reset = 1;
+		syntax->stack_base = NULL;
+
+		for(loaded[i] = syntax_list; loaded[i] && !syntax_match(loaded[i], syntax->name, syntax->subr, syntax->params); loaded[i] = loaded[i]->next);
+	}
+
+	if (!r.error && (zcmp(syn[0]->name, (unsigned char *)name) || syn[0]->subr || loaded[0])) r.error = true;
+
+	for(i = 0; i < n && !r.error; i++) {
+		struct high_syntax * const syntax = syn[i];
+		const uint32_t nstates = read_count(&r, 4);
+		syntax->ncmds = read_count(&r, 4);
+		ncmds[i] = syntax->ncmds + read_count(&r, 4);
+		const uint32_t nkeywords = read_count(&r, 4);
+		/* States take more than 1024 bytes, commands 24 bytes. */
+		if (r.error || nstates == 0 || (uint64_t)nstates * 1024 + (uint64_t)ncmds[i] * 24 > (uint64_t)(r.end - r.p)) {
+			r.error = true;
+			break;
+		}
+
+		syntax->states = joe_malloc(sizeof *syntax->states * nstates);
+		syntax->szstates = nstates;
+		syntax->cmds = joe_malloc(sizeof *syntax->cmds * (ncmds[i] ? ncmds[i] : 1));
+		kw[i] = joe_malloc(sizeof **kw * (nkeywords ? nkeywords : 1));
+		for(uint32_t j = 0; j < nkeywords; j++) {
+			kw[i][j] = joe_malloc(sizeof ***kw);
+			kw[i][j]->slot = NULL;
+		}
+		nkw[i] = nkeywords;
+
+		for(uint32_t j = 0; j < nstates && !r.error; j++) {
+			struct high_state * const state = syntax->states[syntax->nstates++] = joe_calloc(1, sizeof *state);
+			state->no = j;
+			state->name = read_str(&r);
+			state->color = read32(&r);
+			state->delim = read_cmd(&r, syntax, ncmds[i]);
+			for(int c = 0; c < 256; c++)
+				if (!(state->cmd[c] = read_cmd(&r, syntax, ncmds[i]))) r.error = true;
+		}
+
+		for(uint32_t j = 0; j < ncmds[i] && !r.error; j++) {
+			struct high_cmd * const cmd = &syntax->cmds[j];
+			iz_cmd(cmd);
+			set_cmd_flags(cmd, read32(&r));
+			cmd->recolor = read32(&r);
+			const uint32_t new_state = read32(&r), call = read32(&r);
+			if (new_state != UINT32_MAX) {
+				if (new_state < nstates) cmd->new_state = syntax->states[new_state];
+				else r.error = true;
+			}
+			if (call != UINT32_MAX) {
+				if (call < n) cmd->call = syn[call];
+				else r.error = true;
+			}
+			cmd->delim = read_cmd(&r, syntax, ncmds[i]);
+			const uint32_t k = read32(&r);
+			if (k != UINT32_MAX) {
+				if (k < nkeywords) cmd->keywords = kw[i][k];
+				else r.error = true;
+			}
+		}
+
+		for(uint32_t j = 0; j < nkeywords && !r.error; j++) {
+			struct high_keywords * const k = kw[i][j];
+			k->seed = read64(&r);
+			const uint32_t nbuckets = read32(&r) + 1;
+			k->bucket_mask = nbuckets - 1;
+			k->slot_shift = read32(&r);
+			if (r.error || nbuckets == 0 || (nbuckets & nbuckets - 1) || nbuckets > (size_t)(r.end - r.p) / 4
+				|| k->slot_shift < 1 || k->slot_shift > 31 || keyword_slots(k) > (size_t)(r.end - r.p) / 4) {
+				r.error = true;
+				break;
+			}
+			k->disp = (uint32_t *)r.p;
+			r.p += nbuckets * sizeof *k->disp;
+			k->slot = joe_malloc(sizeof *k->slot * keyword_slots(k));
+			for(uint32_t l = 0; l < keyword_slots(k); l++) {
+				k->slot[l] = (struct high_keyword){ NULL, read32(&r), NULL };
+				if (k->slot[l].len < 0) continue;
+				k->slot[l].name = read_str(&r);
+				if (zlen(k->slot[l].name) != (size_t)k->slot[l].len) r.error = true;
+				k->slot[l].cmd = read_cmd(&r, syntax, ncmds[i]);
+				if (!k->slot[l].cmd) r.error = true;
+			}
+		}
+
+	}
+
+	struct high_syntax *syntax = NULL;
+
+	if (!r.error) {
+		/* Redirect calls to syntaxes that were already loaded. */
+		for(i = 0; i < n; i++)
+			for(uint32_t j = 0; j < ncmds[i]; j++)
+				for(uint32_t k = 0; k < n; k++)
+					if (loaded[k] && syn[i]->cmds[j].call == syn[k]) syn[i]->cmds[j].call = loaded[k];
+
+		for(i = n; i-- != 0;)
+			if (!loaded[i]) {
+				syn[i]->next = syntax_list;
+				syntax_list = syn[i];
+				state_count += syn[i]->nstates;
+			}
+		syntax = syn[0];
+	}
+
+	for(i = 0; i < n; i++) {
+		if (syn[i] && (r.error || loaded[i])) free_cached_syntax(syn[i], kw[i], nkw[i]);
+		joe_free(kw[i]);
+	}
+	joe_free(ncmds);
+	joe_free(nkw);
+	joe_free(kw);
+	joe_free(loaded);
+	joe_free(syn);
+	return syntax;
+}
+
+/* Loads a syntax from the cache, if the cache is valid. */
+
+struct high_syntax *load_syntax_cache(unsigned char * const name)
+{
+	char path[1024];
+	struct stat st;
+	void *map = MAP_FAILED;
+
+	if (!syntax_cache_file(name, path, sizeof path)) return NULL;
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	if (!fstat(fd, &st) && st.st_size > 0) map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+
+	/* On success, the mapping stays in place, as names are used in place. */
+	struct high_syntax * const syntax = read_syntax_cache(name, map, st.st_size);
+	if (!syntax) munmap(map, st.st_size);
+	return syntax;
+}
+
 struct high_syntax *load_syntax(unsigned char *name)
 {
+	struct high_syntax *syntax;
+
 	if (!name)
 		return 0;
 
-	return load_syntax_subr(name,0,0);
+	/* Already loaded? */
+	for(syntax=syntax_list;syntax;syntax=syntax->next)
+		if(syntax_match(syntax,name,0,0))
+			return syntax;
+
+	if ((syntax = load_syntax_cache(name)))
+		return syntax;
+
+	if ((syntax = load_syntax_subr(name,0,0)))
+		save_syntax_cache(syntax);
+	return syntax;
+}
+
+/* Profiling */
+
+bool syntax_stats;
+
+/* Clears the profiling counters of all states of all loaded syntaxes. */
+
+void reset_syntax_stats(void)
+{
+	for(struct high_syntax *syntax = syntax_list; syntax; syntax = syntax->next)
+		for(int i = 0; i < syntax->nstates; i++)
+			memset(&syntax->states[i]->stats, 0, sizeof syntax->states[i]->stats);
+}
+
+struct state_stats {
+	const struct high_syntax *syntax;
+	const struct high_state *state;
+};
+
+static uint64_t stats_iterations(const struct high_stats * const st)
+{
+	return st->chars + st->noeat;
+}
+
+static int stats_cmp(const void *a, const void *b)
+{
+	const uint64_t x = stats_iterations(&((const struct state_stats *)a)->state->stats);
+	const uint64_t y = stats_iterations(&((const struct state_stats *)b)->state->stats);
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_stats_line(FILE * const f, const char * const name, const struct high_stats * const st)
+{
+	fprintf(f, "%-32s %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+		name, st->chars, st->noeat, st->keywords, st->delims, st->calls, st->recolors);
+}
+
+static void syntax_stats_name(char * const s, const size_t size, const struct high_syntax * const syntax, const struct high_state * const state)
+{
+	snprintf(s, size, "%s%s%s%s%s", syntax->name, syntax->subr ? "." : "", syntax->subr ? (char *)syntax->subr : "", state ? ":" : "", state ? (char *)state->name : "");
+}
+
+/* Prints the profiling counters summed over the states of each loaded
+   syntax (subroutines are listed separately), followed by the counters of
+   the n states with the largest number of iterations. */
+
+void print_syntax_stats(FILE *f, int n)
+{
+	static const char header[] = "%-32s %12s %12s %12s %12s %10s %10s\n";
+	struct high_stats total = { 0 };
+	int nstates = 0;
+	char name[256];
+
+	for(struct high_syntax *syntax = syntax_list; syntax; syntax = syntax->next)
+		nstates += syntax->nstates;
+	struct state_stats * const s = joe_malloc(sizeof *s * (nstates + 1));
+	nstates = 0;
+
+	fprintf(f, header, "Syntax", "chars", "noeat", "keywords", "delims", "calls", "recolors");
+	for(struct high_syntax *syntax = syntax_list; syntax; syntax = syntax->next) {
+		struct high_stats sum = { 0 };
+		for(int i = 0; i < syntax->nstates; i++) {
+			const struct high_stats * const st = &syntax->states[i]->stats;
+			if (!stats_iterations(st)) continue;
+			sum.chars += st->chars;
+			sum.noeat += st->noeat;
+			sum.keywords += st->keywords;
+			sum.delims += st->delims;
+			sum.calls += st->calls;
+			sum.recolors += st->recolors;
+			s[nstates].syntax = syntax;
+			s[nstates++].state = syntax->states[i];
+		}
+		if (!stats_iterations(&sum)) continue;
+		syntax_stats_name(name, sizeof name, syntax, NULL);
+		print_stats_line(f, name, &sum);
+		total.chars += sum.chars;
+		total.noeat += sum.noeat;
+	}
+
+	fprintf(f, "\n%" PRIu64 " characters, %.2f iterations per character\n\n", total.chars, total.chars ? (double)stats_iterations(&total) / total.chars : 0);
+
+	qsort(s, nstates, sizeof *s, stats_cmp);
+	fprintf(f, header, "State", "chars", "noeat", "keywords", "delims", "calls", "recolors");
+	for(int i = 0; i < nstates && i < n; i++) {
+		syntax_stats_name(name, sizeof name, s[i].syntax, s[i].state);
+		print_stats_line(f, name, &s[i].state->stats);
+	}
+	joe_free(s);
 }
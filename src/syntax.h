@@ -30,14 +30,26 @@ struct high_color {
 	uint32_t color;			/* Color value */
 };
 
+/* Profiling counters of a state, updated by parse() if syntax_stats is true */
+
+struct high_stats {
+	uint64_t chars;			/* Characters consumed */
+	uint64_t noeat;			/* Iterations that did not consume a character */
+	uint64_t keywords;		/* Keyword lookups */
+	uint64_t delims;		/* Delimiter checks */
+	uint64_t calls;			/* Subroutine calls */
+	uint64_t recolors;		/* Recoloring operations */
+};
+
 /* State */
 
 struct high_state {
 	int32_t no;				/* State number */
 	uint32_t color;			/* Color for this state */
-	unsigned char *name;		/* Highlight state name */
-	struct high_cmd *cmd[256];	/* Character table */
 	struct high_cmd *delim;		/* Matching delimiter */
+	unsigned char *name;		/* Highlight state name */
+	struct high_cmd *cmd[256];	/* Character table (points into syntax->cmds once loaded) */
+	struct high_stats stats;	/* Profiling counters */
 };
 
 /* Parameter list */
@@ -47,6 +59,26 @@ struct high_param {
 	unsigned char *name;
 };
 
+/* Keyword of a keyword table */
+
+struct high_keyword {
+	unsigned char *name;		/* Keyword (lower case if the table ignores case), or NULL for an empty slot */
+	int len;			/* Length of the keyword */
+	struct high_cmd *cmd;		/* Command to execute when the keyword is matched */
+};
+
+/* Keyword table, compiled at load time into a perfect hash: keywords are
+   distributed into buckets by a seeded hash, and each bucket is assigned a
+   displacement that places its keywords in distinct slots. */
+
+struct high_keywords {
+	uint64_t seed;			/* Seed of the hash function */
+	uint32_t bucket_mask;		/* No. buckets minus one */
+	int slot_shift;			/* 32 minus the base-2 logarithm of the no. slots */
+	uint32_t *disp;			/* Displacement of each bucket */
+	struct high_keyword *slot;	/* Slots */
+};
+
 /* Command (transition) */
 
 struct high_cmd {
@@ -63,7 +95,7 @@ struct high_cmd {
 	unsigned reset : 1;		/* Set to reset the call stack */
 	int recolor;			/* No. chars to recolor if <0. */
 	struct high_state *new_state;	/* The new state */
-	HASH *keywords;			/* Hash table of keywords */
+	struct high_keywords *keywords;	/* Table of keywords */
 	struct high_cmd *delim;		/* Matching delimiter */
 	struct high_syntax *call;	/* Syntax subroutine to call */
 };
@@ -91,6 +123,8 @@ struct high_syntax {
 	int szstates;			/* Malloc size of states array */
 	struct high_color *color;	/* Linked list of color definitions */
 	struct high_cmd default_cmd;	/* Default transition for new states */
+	struct high_cmd *cmds;		/* Distinct commands of the character tables, stored contiguously */
+	int ncmds;			/* No. distinct commands */
 	struct high_frame *stack_base;  /* Root of run-time call tree */
 };
 
@@ -98,11 +132,28 @@ struct high_syntax {
 
 struct high_syntax *load_syntax PARAMS((unsigned char *name));
 
+/* Load a syntax from the binary cache, or save a syntax (and the syntaxes it calls) to the cache. */
+
+struct high_syntax *load_syntax_cache PARAMS((unsigned char *name));
+void save_syntax_cache PARAMS((struct high_syntax *syntax));
+
 /* Parse a lines.  Returns new state. */
 
 extern uint32_t *attr_buf;
+extern int64_t attr_size;
 extern int64_t attr_len;
 HIGHLIGHT_STATE parse PARAMS((struct high_syntax *syntax, line_desc *ld, HIGHLIGHT_STATE h_state, bool utf8));
+HIGHLIGHT_STATE parse_r PARAMS((struct high_syntax *syntax, line_desc *ld, HIGHLIGHT_STATE h_state, bool utf8, uint32_t **attr_buf_p, int64_t *attr_size_p, int64_t *attr_len_p));
+
+/* True while parse_r() may be running in several threads. */
+
+extern bool parallel_parse;
+
+/* Profiling of parse(): counters are updated only if syntax_stats is true. */
+
+extern bool syntax_stats;
+void reset_syntax_stats PARAMS((void));
+void print_syntax_stats PARAMS((FILE *f, int n));
 
 #define clear_state(s) (((s)->saved_s[0] = 0), ((s)->state = 0), ((s)->stack = 0))
 #define invalidate_state(s) ((s)->state = -1)
@@ -34,7 +34,10 @@
 #endif
 
 #include <termios.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include "term.h"
 #include "ansi.h"
@@ -215,6 +218,7 @@ bool underline_ok;      /* Terminal supports standout without magic cookies */
 bool cursor_on_off_ok;  /* Terminal can make the cursor visible or invisible */
 bool ansi_color_ok;     /* Terminal supports ANSI color */
 bool color_ok;          /* Terminal supports color */
+bool sync_output_ok;    /* Terminal supports synchronized output */
 uint32_t curr_attr;     /* The current video attributes. */
 
 
@@ -242,6 +246,81 @@ int  specified_window;
 
 bool io_utf8;
 
+/* All output is collected in a frame buffer, which is written to the
+   terminal with a single system call by flush_frame(), so that a frame is
+   never split by stdio buffering. The buffer starts in static storage and
+   grows as necessary; if it cannot grow, it is flushed. */
+
+#define FRAME_BUFFER_SIZE (64 * 1024)
+
+static char frame_static[FRAME_BUFFER_SIZE];
+static char *frame = frame_static;
+static size_t frame_len, frame_size = sizeof frame_static;
+
+static void write_frame(void);
+static void sync_cursor(void);
+
+static void grow_frame(void) {
+	char * const p = frame == frame_static ? malloc(frame_size * 2) : realloc(frame, frame_size * 2);
+	if (!p) {
+		write_frame();
+		return;
+	}
+	if (frame == frame_static) memcpy(p, frame_static, frame_len);
+	frame = p;
+	frame_size *= 2;
+}
+
+static inline void put_byte(const int c) {
+	if (frame_len == frame_size) grow_frame();
+	frame[frame_len++] = c;
+}
+
+/* Appends a byte to the frame buffer; it can be used with tputs(). */
+
+int frame_putc(const int c) {
+	put_byte(c);
+	return c;
+}
+
+/* Writes the frame buffer to the terminal, enclosing it in synchronized-output
+   sequences if the terminal supports them. */
+
+static void write_frame(void) {
+	if (frame_len == 0) return;
+
+	struct iovec iov[3] = {
+		{ SYNC_BEGIN_SEQ, sizeof SYNC_BEGIN_SEQ - 1 },
+		{ frame, frame_len },
+		{ SYNC_END_SEQ, sizeof SYNC_END_SEQ - 1 }
+	};
+	struct iovec *v = sync_output_ok ? iov : iov + 1;
+	int n = sync_output_ok ? 3 : 1;
+	frame_len = 0;
+
+	while(n > 0) {
+		ssize_t w = writev(fileno(stdout), v, n);
+		if (w < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			return;
+		}
+		/* Skip what has been written. */
+		for(; n > 0 && w >= v->iov_len; w -= v->iov_len, v++, n--);
+		if (n > 0) {
+			v->iov_base = (char *)v->iov_base + w;
+			v->iov_len -= w;
+		}
+	}
+}
+
+/* Moves the terminal cursor to its logical position (see move_cursor())
+   and writes the frame buffer to the terminal. */
+
+void flush_frame(void) {
+	sync_cursor();
+	write_frame();
+}
+
 /* Returns the output width of the given character. It is maximised with 1
    w.r.t. wcwidth(), so its result is equivalent to the width of the character
    that will be output by out(). */
@@ -338,8 +417,133 @@ void set_attr(const uint32_t attr) {
 
 #else
 
+/* The sequences setting colors, computed by tparm() only once. */
+
+static char *color_seq[2][8];
+
+static const char *set_color(const int bg, const int color) {
+	char ** const seq = &color_seq[bg][color];
+	if (*seq) return *seq;
+	const char * const buf = TPARM2(bg ? ne_set_background : ne_set_foreground, color);
+	return (*seq = buf ? strdup(buf) : NULL) ? *seq : buf;
+}
+
+/* If s is a (padding-free) ANSI SGR sequence, that is, ESC [ params m,
+   returns the length of params and stores in *params a pointer to them;
+   otherwise, returns -1. */
+
+static int sgr_params(const char * const s, const char ** const params) {
+	if (!s || s[0] != '\x1b' || s[1] != '[') return -1;
+	const char *t = s + 2;
+	while(*t >= '0' && *t <= '9' || *t == ';') t++;
+	if (t[0] != 'm' || t[1] != 0) return -1;
+	*params = s + 2;
+	return t - *params;
+}
+
+/* If true, the capabilities setting attributes are SGR sequences, and
+   set_attr() merges them into a single sequence. exit_attribute_mode may
+   contain other sequences before and after its SGR sequence (e.g., xterm
+   selects the ASCII character set, and the Linux console shifts in), which
+   are emitted around the merged sequence. */
+
+static bool sgr_ok;
+static const char *sgr0_seq, *sgr0_suffix;
+
+static void check_sgr(void) {
+	if (!ne_exit_attribute_mode || strstr(ne_exit_attribute_mode, "$<")) return;
+
+	/* We look for the last SGR sequence in exit_attribute_mode. */
+	for(const char *s = ne_exit_attribute_mode; (s = strstr(s, "\x1b[")); s++) {
+		const char *t = s + 2;
+		while(*t >= '0' && *t <= '9' || *t == ';') t++;
+		if (*t == 'm') {
+			sgr0_seq = s;
+			sgr0_suffix = t + 1;
+		}
+	}
+	if (!sgr0_seq) return;
+
+	const char *params;
+	const char * const mode[] = { ne_enter_reverse_mode, ne_enter_bold_mode, ne_enter_underline_mode, ne_enter_dim_mode, ne_enter_blink_mode };
+	for(int i = 0; i < sizeof mode / sizeof *mode; i++) if (mode[i] && sgr_params(mode[i], &params) < 0) return;
+	sgr_ok = true;
+}
+
+/* A buffer accumulating the parameters of an SGR sequence. */
+
+static char sgr_buf[256];
+static int sgr_len;
+
+static bool add_sgr(const char * const s) {
+	const char *params;
+	const int len = sgr_params(s, &params);
+	if (len < 0 || sgr_len + len + 2 > sizeof sgr_buf) return false;
+	if (sgr_len > 2) sgr_buf[sgr_len++] = ';';
+	memcpy(sgr_buf + sgr_len, params, len);
+	sgr_len += len;
+	return true;
+}
+
+/* Emits the shortest SGR sequence turning the current attributes into attr.
+   Attributes and colors that do not change are not emitted; if some
+   attribute must be turned off, or some color set to the default, we emit a
+   reset parameter followed by the parameters that set the new attributes,
+   all in the same sequence. A color sequence that is not an SGR sequence
+   is emitted after the merged sequence. */
+
+static void set_attr_sgr(const uint32_t attr) {
+	const bool attr_reset = (curr_attr & AT_MASK & ~attr)
+			|| (!(attr & FG_NOT_DEFAULT) && (curr_attr & FG_NOT_DEFAULT))
+			|| (!(attr & BG_NOT_DEFAULT) && (curr_attr & BG_NOT_DEFAULT));
+	const uint32_t new_attr = attr & (attr_reset ? AT_MASK : AT_MASK & ~curr_attr);
+	const char *color[2] = { NULL, NULL };
+
+	memcpy(sgr_buf, "\x1b[", 2);
+	sgr_len = 2;
+
+	if (attr_reset) {
+		for(const char *p = ne_exit_attribute_mode; p < sgr0_seq; p++) put_byte(*p);
+		/* An empty parameter list (as in ESC [ m) is equivalent to 0. */
+		const char *p = sgr0_seq + 2;
+		if (*p == 'm') sgr_buf[sgr_len++] = '0';
+		else while(*p != 'm') sgr_buf[sgr_len++] = *p++;
+	}
+
+	if ((new_attr & INVERSE) && MAY_USE_WITH_COLORS(NC_REVERSE) && ne_enter_reverse_mode) add_sgr(ne_enter_reverse_mode);
+	if ((new_attr & BOLD) && MAY_USE_WITH_COLORS(NC_BOLD) && ne_enter_bold_mode) add_sgr(ne_enter_bold_mode);
+	if ((new_attr & UNDERLINE) && MAY_USE_WITH_COLORS(NC_UNDERLINE) && ne_enter_underline_mode) add_sgr(ne_enter_underline_mode);
+	if ((new_attr & DIM) && MAY_USE_WITH_COLORS(NC_DIM) && ne_enter_dim_mode) add_sgr(ne_enter_dim_mode);
+	if ((new_attr & BLINK) && MAY_USE_WITH_COLORS(NC_BLINK) && ne_enter_blink_mode) add_sgr(ne_enter_blink_mode);
+
+	if (color_ok) {
+		if ((attr & FG_NOT_DEFAULT) && (attr_reset || (attr & FG_MASK) != (curr_attr & FG_MASK))) {
+			const char * const seq = set_color(0, joe2color(attr >> FG_SHIFT));
+			if (!add_sgr(seq)) color[0] = seq;
+		}
+		if ((attr & BG_NOT_DEFAULT) && (attr_reset || (attr & BG_MASK) != (curr_attr & BG_MASK))) {
+			const char * const seq = set_color(1, joe2color(attr >> BG_SHIFT));
+			if (!add_sgr(seq)) color[1] = seq;
+		}
+	}
+
+	if (sgr_len > 2) {
+		sgr_buf[sgr_len++] = 'm';
+		for(int i = 0; i < sgr_len; i++) put_byte(sgr_buf[i]);
+	}
+	if (attr_reset) for(const char *p = sgr0_suffix; *p; p++) put_byte(*p);
+	for(int i = 0; i < 2; i++) if (color[i]) OUTPUT1(color[i]);
+
+	curr_attr = attr;
+}
 
 void set_attr(const uint32_t attr) {
+	if (attr == curr_attr) return;
+	if (sgr_ok) {
+		set_attr_sgr(attr);
+		return;
+	}
+
 	bool attr_reset = false;
 
 	/* If we have to set a different subset of attributes, or if we have to
@@ -364,16 +568,10 @@ void set_attr(const uint32_t attr) {
 		   color is not default, or in any case if the color has changed. */
 
 		if (attr_reset && (attr & FG_NOT_DEFAULT) || (attr & FG_MASK) != (curr_attr & FG_MASK)) {
-			if (attr & FG_NOT_DEFAULT) {
-				const char * const buf = TPARM2(ne_set_foreground , joe2color(attr >> FG_SHIFT));
-				OUTPUT1(buf);
-			}
+			if (attr & FG_NOT_DEFAULT) OUTPUT1(set_color(0, joe2color(attr >> FG_SHIFT)));
 		}
 		if (attr_reset && (attr & BG_NOT_DEFAULT) || (attr & BG_MASK) != (curr_attr & BG_MASK)) {
-			if (attr & BG_NOT_DEFAULT) {
-				const char * const buf = TPARM2(ne_set_background , joe2color(attr >> BG_SHIFT));
-				OUTPUT1(buf);
-			}
+			if (attr & BG_NOT_DEFAULT) OUTPUT1(set_color(1, joe2color(attr >> BG_SHIFT)));
 		}
 	}
 
@@ -434,13 +632,10 @@ void underline_off (void) {
 }
 
 
-/* Depending on the value of io_utf8, this function will do a simple putchar(),
-   or a series of putchar() that expand the given character in UTF-8 encoding.
-   If attr is -1, no attribute will be set. */
-
-static void out(int c, const uint32_t attr) {
-	uint32_t add_attr = 0;
+/* Returns the character that will be actually output in place of c,
+   possibly setting *add_attr to INVERSE. */
 
+static int printable(int c, uint32_t * const add_attr) {
 	/* PORTABILITY PROBLEM: this code is responsible for filtering nonprintable
 	   characters. On systems with a wider system character set, it could be
 	   redefined, for instance, in order to allow characters between 128 and 160 to
@@ -450,22 +645,22 @@ static void out(int c, const uint32_t attr) {
 
 	if (c >= 127 && c < 160) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c == 160) {
 		c = ' ';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c < ' ') {
 		c += '@';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	if (c > 0xFF && !io_utf8) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
 	/* If io_utf8 is off, we consider all characters in the range of ISO-8859-x
@@ -473,45 +668,60 @@ static void out(int c, const uint32_t attr) {
 
 	if (io_utf8 && wcwidth(c) <= 0) {
 		c = '?';
-		add_attr = INVERSE;
+		*add_attr = INVERSE;
 	}
 
-	if (attr != -1) set_attr(attr | add_attr);
+	return c;
+}
+
+/* Depending on the value of io_utf8, this function will do a simple put_byte(),
+   or a series of put_byte() that expand the given character in UTF-8 encoding. */
 
+static void emit_char(const int c) {
 	if (io_utf8) {
-		if (c < 0x80) putchar(c); /* ASCII */
+		if (c < 0x80) put_byte(c); /* ASCII */
 		else if (c < 0x800) {
-			putchar(0xC0 | (c >> 6));
-			putchar(0x80 | (c >> 0) & 0x3F);
+			put_byte(0xC0 | (c >> 6));
+			put_byte(0x80 | (c >> 0) & 0x3F);
 		}
 		else if (c < 0x10000) {
-			putchar(0xE0 | (c >> 12));
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			put_byte(0xE0 | (c >> 12));
+			put_byte(0x80 | (c >> 6) & 0x3F);
+			put_byte(0x80 | (c >> 0) & 0x3F);
 		}
 		else if (c < 0x200000) {
-			putchar(0xF0 | (c >> 18));
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			put_byte(0xF0 | (c >> 18));
+			put_byte(0x80 | (c >> 12) & 0x3F);
+			put_byte(0x80 | (c >> 6) & 0x3F);
+			put_byte(0x80 | (c >> 0) & 0x3F);
 		}
 		else if (c < 0x4000000) {
-			putchar(0xF8 | (c >> 24));
-			putchar(0x80 | (c >> 18) & 0x3F);
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			put_byte(0xF8 | (c >> 24));
+			put_byte(0x80 | (c >> 18) & 0x3F);
+			put_byte(0x80 | (c >> 12) & 0x3F);
+			put_byte(0x80 | (c >> 6) & 0x3F);
+			put_byte(0x80 | (c >> 0) & 0x3F);
 		}
 		else {
-			putchar(0xFC | (c >> 30));
-			putchar(0x80 | (c >> 24) & 0x3F);
-			putchar(0x80 | (c >> 18) & 0x3F);
-			putchar(0x80 | (c >> 12) & 0x3F);
-			putchar(0x80 | (c >> 6) & 0x3F);
-			putchar(0x80 | (c >> 0) & 0x3F);
+			put_byte(0xFC | (c >> 30));
+			put_byte(0x80 | (c >> 24) & 0x3F);
+			put_byte(0x80 | (c >> 18) & 0x3F);
+			put_byte(0x80 | (c >> 12) & 0x3F);
+			put_byte(0x80 | (c >> 6) & 0x3F);
+			put_byte(0x80 | (c >> 0) & 0x3F);
 		}
 	}
-	else putchar(c);
+	else put_byte(c);
+}
+
+/* Outputs a character, filtering nonprintable characters. If attr is -1, no
+   attribute will be set. */
+
+static void out(int c, const uint32_t attr) {
+	uint32_t add_attr = 0;
+	c = printable(c, &add_attr);
+	if (attr != -1) set_attr(attr | add_attr);
+	emit_char(c);
 }
 
 
@@ -562,6 +772,251 @@ static void turn_off_insert (void) {
 	insert_mode = false;
 }
 
+
+/* The shadow screen records what the terminal is displaying. Each cell
+   contains a character (SHADOW_UNKNOWN if we do not know what is displayed,
+   SHADOW_WIDE for the second half of a double-width character) and the
+   attributes it has been written with, including standout and underline
+   modes. Output functions skip cells that already display the right
+   character with the right attributes, so redraws send to the terminal just
+   what actually changed.
+
+   For this to work, move_cursor() does not move the cursor: it just sets the
+   logical cursor position (cur_row, cur_col). The terminal cursor (curY,
+   curX) is moved there by sync_cursor() only when something must be output,
+   or when the frame is flushed. A negative logical position means that we do
+   not know where we are. */
+
+#define SHADOW_UNKNOWN   (-1)
+#define SHADOW_WIDE      (-2)
+#define SHADOW_STANDOUT  ((uint64_t)1 << 32)
+#define SHADOW_UNDERLINE ((uint64_t)1 << 33)
+
+typedef struct {
+	int32_t c;
+	uint64_t attr;
+} screen_cell;
+
+/* Attributes that are visible on a blank cell. */
+
+#define BLANK_VISIBLE (BG_NOT_DEFAULT | INVERSE | UNDERLINE | SHADOW_STANDOUT | SHADOW_UNDERLINE)
+
+/* Returns the attributes recorded for a cell containing c written with
+   attributes (and modes) attr: blanks with no visible attributes are all
+   equivalent, so we record them with no attributes. */
+
+static inline uint64_t cell_attr(const int c, const uint64_t attr) {
+	return c == ' ' && !(attr & BLANK_VISIBLE) ? 0 : attr;
+}
+
+static screen_cell *shadow;
+static int shadow_lines, shadow_columns;
+static int cur_row = -1, cur_col = -1;
+
+/* While capturing (see capture_lines()), output to the rows from
+   capture_first to capture_last is recorded in the capture screen, which has
+   the same layout as the shadow screen, instead of being sent to the
+   terminal. */
+
+static screen_cell *capture;
+static int capture_first, capture_last;
+static bool capturing;
+
+/* Returns the shadow screen, reallocating it (with unknown content) if the
+   size of the terminal has changed, or NULL if it is not available. */
+
+static screen_cell *get_shadow(void) {
+	if (shadow_lines != ne_lines || shadow_columns != ne_columns) {
+		free(shadow);
+		free(capture);
+		shadow = capture = NULL;
+		shadow_lines = shadow_columns = 0;
+		if (ne_lines <= 0 || ne_columns <= 0 || !(shadow = malloc(sizeof *shadow * ne_lines * ne_columns))) return NULL;
+		shadow_lines = ne_lines;
+		shadow_columns = ne_columns;
+		for(int i = ne_lines * ne_columns; i-- != 0;) shadow[i].c = SHADOW_UNKNOWN;
+	}
+	return shadow;
+}
+
+/* Forgets the content of the given row from column from (inclusive) to
+   column to (exclusive). If row is negative, forgets the whole screen. */
+
+static void forget_cells(const int row, int from, int to) {
+	if (!get_shadow() || row >= ne_lines) return;
+	if (row < 0) {
+		for(int i = ne_lines * ne_columns; i-- != 0;) shadow[i].c = SHADOW_UNKNOWN;
+		return;
+	}
+	if (from < 0) from = 0;
+	if (to > ne_columns) to = ne_columns;
+	screen_cell * const r = shadow + row * ne_columns;
+	for(int x = from; x < to; x++) r[x].c = SHADOW_UNKNOWN;
+}
+
+/* Forgets the halves of double-width characters that will be broken by
+   changing the cells of a row from column from to column to (exclusive). */
+
+static void break_wide(screen_cell * const r, const int from, const int to) {
+	if (from > 0 && from < ne_columns && r[from].c == SHADOW_WIDE) r[from - 1].c = r[from].c = SHADOW_UNKNOWN;
+	if (to < ne_columns && r[to].c == SHADOW_WIDE) r[to].c = SHADOW_UNKNOWN;
+}
+
+/* Records that the given row has been erased from column from (inclusive)
+   to column to (exclusive). Erased cells are known to be blank only if
+   no background color, inverse video, standout or underline are active. */
+
+static void erase_cells(const int row, int from, int to) {
+	if (row < 0 || (curr_attr & (BG_NOT_DEFAULT | INVERSE)) || standout_mode || underline_mode) {
+		forget_cells(row, from, to);
+		return;
+	}
+	if (!get_shadow() || row >= ne_lines) return;
+	if (from < 0) from = 0;
+	if (to > ne_columns) to = ne_columns;
+	screen_cell * const r = shadow + row * ne_columns;
+	break_wide(r, from, to);
+	for(int x = from; x < to; x++) {
+		r[x].c = ' ';
+		r[x].attr = 0;
+	}
+}
+
+/* Records that the screen has been erased from the given position. */
+
+static void erase_to_end(const int row, const int col) {
+	if (row < 0) forget_cells(row, 0, 0);
+	else {
+		erase_cells(row, col, ne_columns);
+		for(int i = row + 1; i < ne_lines; i++) erase_cells(i, 0, ne_columns);
+	}
+}
+
+/* Records that n characters have been inserted (or -n deleted, if n is
+   negative) at the given position. Inserted characters are forgotten, and
+   characters uncovered by a deletion are erased. */
+
+static void shift_cells(const int row, const int col, const int n) {
+	if (row < 0 || col < 0) forget_cells(-1, 0, 0);
+	if (row < 0 || col < 0 || col >= ne_columns || !get_shadow() || row >= ne_lines) return;
+
+	screen_cell * const r = shadow + row * ne_columns;
+	const int k = abs(n) < ne_columns - col ? abs(n) : ne_columns - col;
+
+	if (n > 0) {
+		/* The last character might be the first half of a double-width character. */
+		const bool wide_at_end = r[ne_columns - k].c == SHADOW_WIDE;
+		break_wide(r, col, col);
+		memmove(r + col + k, r + col, (ne_columns - col - k) * sizeof *r);
+		for(int x = col; x < col + k; x++) r[x].c = SHADOW_UNKNOWN;
+		if (wide_at_end) r[ne_columns - 1].c = SHADOW_UNKNOWN;
+	}
+	else {
+		break_wide(r, col, col + k);
+		memmove(r + col, r + col + k, (ne_columns - col - k) * sizeof *r);
+		erase_cells(row, ne_columns - k, ne_columns);
+	}
+}
+
+/* Records that the lines from top to bottom (inclusive) have been scrolled
+   down by n lines (or up by -n lines, if n is negative). Uncovered lines are
+   erased, or forgotten if the terminal might retain memory below the screen. */
+
+static void scroll_cells(const int top, const int bottom, const int n) {
+	if (!get_shadow() || top < 0 || bottom >= ne_lines || top > bottom) return;
+
+	const int k = abs(n) < bottom - top + 1 ? abs(n) : bottom - top + 1;
+	const size_t moved = (size_t)(bottom - top + 1 - k) * ne_columns * sizeof *shadow;
+	int first = top;
+
+	if (n > 0) memmove(shadow + (top + k) * ne_columns, shadow + top * ne_columns, moved);
+	else {
+		memmove(shadow + top * ne_columns, shadow + (top + k) * ne_columns, moved);
+		first = bottom - k + 1;
+	}
+
+	for(int i = first; i < first + k; i++)
+		if (ne_memory_below && n < 0) forget_cells(i, 0, ne_columns);
+		else erase_cells(i, 0, ne_columns);
+}
+
+/* Moves the terminal cursor to the logical cursor position. */
+
+static void sync_cursor(void) {
+	if (cur_row < 0 || cur_col >= ne_columns || curY == cur_row && curX == cur_col) return;
+	if (!ne_move_standout_mode) turn_off_standout();
+	if (!ne_move_insert_mode) turn_off_insert();
+	cmgoto(cur_row, cur_col);
+}
+
+/* Sets the logical cursor position to the position of the terminal cursor;
+   to be used after output that moved the latter. */
+
+static void catch_cursor(void) {
+	cur_row = curY;
+	cur_col = curX;
+}
+
+/* Moves the logical cursor as output of n columns would move the terminal
+   cursor (see cmplus()). Output never continues on the next row, so on
+   terminals with AutoWrap the logical cursor stays past the last column, as
+   with MagicWrap. */
+
+static void advance_cursor(const int n) {
+	if ((cur_col += n) >= ScreenCols && !MagicWrap) {
+		if (Wcm.cm_losewrap) cur_row = cur_col = -1;
+		else if (!AutoWrap) cur_col--;
+	}
+}
+
+/* If the terminal cursor is on the same row and to the left of the logical
+   cursor, and rewriting the cells in between with the current attributes
+   does not change them and costs less than moving the cursor, rewrites them
+   and returns true. */
+
+static bool rewrite_gap(const screen_cell * const r, const uint64_t modes) {
+	if (curY != cur_row || curX < 0 || curX >= cur_col || insert_mode
+		|| standout_mode != standout_wanted || underline_mode != underline_wanted) return false;
+
+	const uint64_t key = curr_attr | modes;
+	int cost = 0;
+	for(int x = curX; x < cur_col; x++) {
+		if (r[x].c < 0 || x + 1 < ne_columns && r[x + 1].c == SHADOW_WIDE) return false;
+		if (r[x].attr != cell_attr(r[x].c, key)) return false;
+		cost += io_utf8 ? utf8seqlen(r[x].c) : 1;
+	}
+
+	if (cost > cmgoto_cost(cur_row, cur_col)) return false;
+
+	for(int x = curX; x < cur_col; x++) emit_char(r[x].c);
+	cmplus(cur_col - curX);
+	return true;
+}
+
+/* Outputs at the logical cursor position the character c, of width w, with
+   attributes attr (or the current ones, if attr is -1) and the given
+   (wanted) modes, and records it in the row r of the shadow screen. */
+
+static void draw_cell(screen_cell * const r, const int c, const int w, const uint32_t attr, const uint64_t modes) {
+	if ((curY != cur_row || curX != cur_col) && !rewrite_gap(r, modes)) sync_cursor();
+	turn_off_insert();
+	standout_if_wanted();
+	underline_if_wanted();
+	if (attr != -1) set_attr(attr);
+	emit_char(c);
+	/* Many terminals with AutoWrap but without MagicWrap (e.g., xterm or tmux
+		with TERM=ansi) actually defer the wrap, so after writing in the last
+		column we do not know where the cursor is, and the next cmgoto() must
+		use absolute addressing. */
+	if (curX + w >= ScreenCols && AutoWrap && !MagicWrap) losecursor();
+	else cmplus(w);
+
+	break_wide(r, cur_col, cur_col + w);
+	r[cur_col] = (screen_cell){ c, cell_attr(c, curr_attr | modes) };
+	if (w == 2) r[cur_col + 1] = (screen_cell){ SHADOW_WIDE, curr_attr | modes };
+	advance_cursor(w);
+}
+
 void turn_on_bracketed_paste(void) {
 	if (!bpaste_mode) OUTPUT1_IF(BPASTE_ENABLE_SEQ);
 	bpaste_mode = true;
@@ -596,6 +1051,7 @@ void set_terminal_modes(void) {
 		turn_off_standout();
 	turn_off_underline();
 	losecursor();
+	forget_cells(-1, 0, 0);
 }
 
 
@@ -633,13 +1089,12 @@ void cursor_off (void) {
 }
 
 
-/* Move to absolute position, specified origin 0 */
+/* Move to absolute position, specified origin 0. The terminal cursor is
+   actually moved only when necessary (see sync_cursor()). */
 
 void move_cursor (const int row, const int col) {
-	if (curY == row && curX == col) return;
-	if (!ne_move_standout_mode) turn_off_standout();
-	if (!ne_move_insert_mode) turn_off_insert ();
-	cmgoto (row, col);
+	cur_row = row;
+	cur_col = col;
 }
 
 
@@ -648,15 +1103,38 @@ void move_cursor (const int row, const int col) {
    may be moved, on terminals lacking a `ce' string.  */
 
 void clear_end_of_line(const int first_unused_hpos) {
-	if (curX >= first_unused_hpos) return;
+	if (cur_col >= first_unused_hpos) return;
+
+	if (capturing) {
+		if (shadow_lines != ne_lines || shadow_columns != ne_columns) return;
+		assert(cur_row >= capture_first && cur_row <= capture_last && cur_col >= 0);
+		screen_cell * const r = capture + cur_row * ne_columns;
+		break_wide(r, cur_col, ne_columns);
+		for(int x = cur_col; x < ne_columns; x++) r[x] = (screen_cell){ ' ', 0 };
+		return;
+	}
+
+	/* If the shadow screen says that the line is already clear, we are done. */
+	if (cur_row >= 0 && cur_row < ne_lines && cur_col >= 0 && get_shadow()) {
+		const screen_cell * const r = shadow + cur_row * ne_columns;
+		int x;
+		for(x = cur_col; x < ne_columns && r[x].c == ' ' && r[x].attr == 0; x++);
+		if (x == ne_columns) return;
+	}
 
+	sync_cursor();
 	if (curr_attr & BG_NOT_DEFAULT) set_attr(0);
-	if (ne_clr_eol) OUTPUT1 (ne_clr_eol);
+	if (ne_clr_eol) {
+		OUTPUT1 (ne_clr_eol);
+		erase_cells(cur_row, cur_col, ne_columns);
+	}
 	else {
 		/* We have to do it the hard way. */
 		turn_off_insert ();
-		for (int i = curX; i < first_unused_hpos; i++) putchar (' ');
+		for (int i = curX; i < first_unused_hpos; i++) put_byte(' ');
+		forget_cells(cur_row, cur_col, first_unused_hpos);
 		cmplus (first_unused_hpos - curX);
+		catch_cursor();
 	}
 }
 
@@ -673,9 +1151,13 @@ void clear_to_eol(void) {
 
 void clear_to_end (void) {
 
-	if (ne_clr_eos) OUTPUT(ne_clr_eos);
+	if (ne_clr_eos) {
+		sync_cursor();
+		OUTPUT(ne_clr_eos);
+		erase_to_end(cur_row, cur_col);
+	}
 	else {
-		for (int i = curY; i < ne_lines; i++) {
+		for (int i = cur_row; i < ne_lines; i++) {
 			move_cursor (i, 0);
 			clear_to_eol();
 		}
@@ -690,6 +1172,8 @@ void clear_entire_screen (void) {
 	if (ne_clear_screen) {
 		OUTPUTL(ne_clear_screen, ne_lines);
 		cmat (0, 0);
+		catch_cursor();
+		erase_to_end(0, 0);
 	}
 	else {
 		move_cursor (0, 0);
@@ -698,6 +1182,53 @@ void clear_entire_screen (void) {
 }
 
 
+/* Returns the character that will be output in place of the next character
+   of *string, or a space if *string is NULL, advancing *string. The width of
+   the character is stored in *w, and additional attributes in *add_attr. */
+
+static int next_output_char(const char ** const string, const bool utf8, int * const w, uint32_t * const add_attr) {
+	if (*string == NULL) {
+		*w = 1;
+		return ' ';
+	}
+
+	int c;
+	if (utf8) {
+		c = utf8char(*string);
+		*string += utf8len(**string);
+	}
+	else c = (unsigned char)*(*string)++;
+
+	*w = output_width(c);
+	return printable(c, add_attr);
+}
+
+/* Records in the capture screen the output of len characters (see
+   output_chars()). */
+
+static void capture_chars(const char *string, const uint32_t * const attr, const int len, const bool utf8) {
+	/* If the size of the terminal has changed, the screen will be redrawn anyway. */
+	if (shadow_lines != ne_lines || shadow_columns != ne_columns) return;
+	assert(cur_row >= capture_first && cur_row <= capture_last && cur_col >= 0);
+
+	screen_cell * const r = capture + cur_row * ne_columns;
+	const bool spaces = string == NULL;
+	const uint64_t modes = (standout_wanted ? SHADOW_STANDOUT : 0) | (underline_wanted ? SHADOW_UNDERLINE : 0);
+
+	for(int i = 0; i < len; i++) {
+		int w;
+		uint32_t add_attr = 0;
+		const int c = next_output_char(&string, utf8, &w, &add_attr);
+		const uint64_t key = cell_attr(c, (attr ? (spaces ? *attr : attr[i] | add_attr) : curr_attr) | modes);
+
+		break_wide(r, cur_col, cur_col + w);
+		r[cur_col] = (screen_cell){ c, key };
+		if (w == 2) r[cur_col + 1] = (screen_cell){ SHADOW_WIDE, key };
+		advance_cursor(w);
+	}
+}
+
+
 /* Outputs raw_len characters pointed at by string, attributed as
    indicated by a corresponding vector of attributes, which can be NULL,
    in which case no attribute will be set. The characters will be
@@ -708,10 +1239,6 @@ void clear_entire_screen (void) {
 void output_chars(const char *string, const uint32_t *attr, const int raw_len, const bool utf8) {
 	if (raw_len == 0) return;
 
-	turn_off_insert();
-	standout_if_wanted();
-	underline_if_wanted();
-
 	/* If the string is UTF-8 encoded, compute its real length. */
 	int len = utf8 && string != NULL ? utf8strlen(string, raw_len) : raw_len;
 
@@ -719,45 +1246,83 @@ void output_chars(const char *string, const uint32_t *attr, const int raw_len, c
 	   len. Moreover, we don't dare write in last column of bottom line, if
 	   AutoWrap, since that would scroll the whole screen on some terminals. */
 
-	cmplus(string_output_width(string, &len, ne_columns - curX - (AutoWrap && !MagicWrap && curY == ne_lines - 1), utf8));
+	const int width = string_output_width(string, &len, ne_columns - cur_col - (AutoWrap && !MagicWrap && cur_row == ne_lines - 1), utf8);
 
-	if (string == NULL) {
-		for(int i = 0; i < len; i++) {
-			/* When outputting spaces, it's only the first attribute that's used. */
-			if (attr) set_attr(*attr);
-			putchar(' ');
-		}
+	if (capturing) {
+		capture_chars(string, attr, len, utf8);
 		return;
 	}
 
-	if (!ne_transparent_underline && !ne_tilde_glitch) {
-		for(int i = 0; i < len; i++) {
-			if (utf8) {
-				const int c = utf8char(string);
-				string += utf8len(*string);
-				out(c, attr ? attr[i] : -1);
-			}
-			else {
-				const int c = (unsigned char)*string++;
-				out(c, attr ? attr[i] : -1);
+	if (cur_row < 0 || cur_row >= ne_lines || cur_col < 0 || ne_transparent_underline || ne_tilde_glitch || !get_shadow()) {
+		/* We do not track output on glitchy terminals, or if we do not know where we are. */
+		forget_cells(cur_row < ne_lines ? cur_row : -1, cur_col, cur_col + width);
+		sync_cursor();
+		turn_off_insert();
+		standout_if_wanted();
+		underline_if_wanted();
+		cmplus(width);
+		catch_cursor();
+
+		if (string == NULL) {
+			for(int i = 0; i < len; i++) {
+				/* When outputting spaces, it's only the first attribute that's used. */
+				if (attr) set_attr(*attr);
+				put_byte(' ');
 			}
+			return;
 		}
-	}
-	else
-		for(int i = 0; i < len; i++) {
-			if (attr) set_attr(attr[i]);
-			int c = utf8 ? utf8char(string) : (unsigned char)*string;
 
-			if (c == '_' && ne_transparent_underline) {
-				putchar (' ');
-				OUTPUT1(Left);
+		if (!ne_transparent_underline && !ne_tilde_glitch) {
+			for(int i = 0; i < len; i++) {
+				if (utf8) {
+					const int c = utf8char(string);
+					string += utf8len(*string);
+					out(c, attr ? attr[i] : -1);
+				}
+				else {
+					const int c = (unsigned char)*string++;
+					out(c, attr ? attr[i] : -1);
+				}
 			}
+		}
+		else
+			for(int i = 0; i < len; i++) {
+				if (attr) set_attr(attr[i]);
+				int c = utf8 ? utf8char(string) : (unsigned char)*string;
 
-			if (ne_tilde_glitch && c == '~') c = '`';
+				if (c == '_' && ne_transparent_underline) {
+					put_byte(' ');
+					OUTPUT1(Left);
+				}
 
-			out(c, attr ? attr[i] : -1);
-			string += utf8 ? utf8len(*string) : 1;
+				if (ne_tilde_glitch && c == '~') c = '`';
+
+				out(c, attr ? attr[i] : -1);
+				string += utf8 ? utf8len(*string) : 1;
+			}
+		return;
+	}
+
+	/* We compare each character with the shadow screen, and output only
+	   those that are different. When outputting spaces, it's only the first
+	   attribute that's used. */
+
+	screen_cell * const r = shadow + cur_row * ne_columns;
+	const bool spaces = string == NULL;
+	const uint64_t modes = (standout_wanted ? SHADOW_STANDOUT : 0) | (underline_wanted ? SHADOW_UNDERLINE : 0);
+
+	for(int i = 0; i < len; i++) {
+		int w;
+		uint32_t add_attr = 0;
+		const int c = next_output_char(&string, utf8, &w, &add_attr);
+		const uint64_t key = cell_attr(c, (attr ? (spaces ? *attr : attr[i] | add_attr) : curr_attr) | modes);
+		if (r[cur_col].c == c && r[cur_col].attr == key && (w == 1 || r[cur_col + 1].c == SHADOW_WIDE)) {
+			advance_cursor(w);
+			continue;
 		}
+
+		draw_cell(r, c, w, attr ? (spaces ? *attr : attr[i] | add_attr) : -1, modes);
+	}
 }
 
 
@@ -802,6 +1367,7 @@ void output_spaces(const int n, const uint32_t * const attr) {
 void insert_chars(const char * start, const uint32_t * const attr, const int raw_len, const bool utf8) {
 	if (raw_len == 0) return;
 
+	sync_cursor();
 	standout_if_wanted();
 	underline_if_wanted();
 
@@ -819,6 +1385,7 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 
 		const char * const buf = TPARM2(ne_parm_ich, width);
 		OUTPUT1 (buf);
+		shift_cells(cur_row, cur_col, width);
 
 		if (start) output_chars(start, attr, raw_len, utf8);
 
@@ -832,7 +1399,10 @@ void insert_chars(const char * start, const uint32_t * const attr, const int raw
 	   bottom line, if AutoWrap, since that would scroll the whole screen
 	   on some terminals. */
 
-	cmplus(string_output_width(start, &len, ne_columns - curX - (AutoWrap && !MagicWrap && curY == ne_lines - 1), utf8));
+	const int width = string_output_width(start, &len, ne_columns - curX - (AutoWrap && !MagicWrap && curY == ne_lines - 1), utf8);
+	shift_cells(cur_row, cur_col, width);
+	cmplus(width);
+	catch_cursor();
 
 	if (!ne_transparent_underline && !ne_tilde_glitch && start
 		  && ne_insert_padding == NULL && ne_insert_character == NULL) {
@@ -899,6 +1469,7 @@ void insert_char(const int c, const uint32_t attr, const bool utf8) {
 void delete_chars (int n) {
 	if (n == 0) return;
 
+	sync_cursor();
 	standout_if_wanted();
 	underline_if_wanted();
 	if (delete_in_insert_mode) turn_on_insert();
@@ -911,9 +1482,10 @@ void delete_chars (int n) {
 		const char * const buf = TPARM2(ne_parm_dch, n);
 		OUTPUT1(buf);
 	}
-	else while(n-- != 0) OUTPUT1(ne_delete_character);
+	else for(int i = n; i-- != 0;) OUTPUT1(ne_delete_character);
 
 	if (!delete_in_insert_mode) OUTPUT_IF(ne_exit_delete_mode);
+	shift_cells(cur_row, cur_col, -n);
 }
 
 
@@ -954,32 +1526,45 @@ int ins_del_lines (const int vpos, const int n) {
 
 		if (n < 0) {
 			move_cursor(specified_window - 1, 0);
+			sync_cursor();
 			while (i-- != 0) OUTPUTL(ne_scroll_forward, specified_window - vpos + 1);
 		}
 		else {
 			move_cursor(vpos, 0);
+			sync_cursor();
 			while (i-- != 0) OUTPUTL(ne_scroll_reverse, specified_window - vpos + 1);
 		}
 
+		if (specified_window != ne_lines) scroll_cells(vpos, specified_window - 1, n);
+		else forget_cells(-1, 0, 0);
+
 		if (specified_window != ne_lines) set_scroll_region(0, ne_lines - 1);
 	}
 	else {
 		if (n > 0) {
 			if (specified_window != ne_lines) {
 				move_cursor(specified_window - i, 0);
+				sync_cursor();
 				do_multi_ins_del(ne_parm_delete_line, ne_delete_line, i);
+				scroll_cells(specified_window - i, ne_lines - 1, -i);
 			}
 
 			move_cursor(vpos, 0);
+			sync_cursor();
 			do_multi_ins_del(ne_parm_insert_line, ne_insert_line, i);
+			scroll_cells(vpos, ne_lines - 1, i);
 		}
 		else {
 			move_cursor(vpos, 0);
+			sync_cursor();
 			do_multi_ins_del(ne_parm_delete_line, ne_delete_line, i);
+			scroll_cells(vpos, ne_lines - 1, -i);
 
 			if (specified_window != ne_lines) {
 				move_cursor(specified_window - i, 0);
+				sync_cursor();
 				do_multi_ins_del(ne_parm_insert_line, ne_insert_line, i);
+				scroll_cells(specified_window - i, ne_lines - 1, i);
 			}
 			else if (ne_memory_below) {
 				move_cursor(ne_lines + n, 0);
@@ -992,6 +1577,190 @@ int ins_del_lines (const int vpos, const int n) {
 }
 
 
+/* Starts capturing the output to the rows from first to last (see
+   flush_captured_lines()). Cells of the captured rows that are not output
+   keep their current content. Returns false if capturing is not possible,
+   in which case output goes to the terminal as usual. */
+
+bool capture_lines(const int first, const int last) {
+	if (capturing || !line_ins_del_ok || ne_transparent_underline || ne_tilde_glitch || !get_shadow()
+		|| first < 0 || last >= specified_window || first > last) return false;
+	if (!capture && !(capture = malloc(sizeof *capture * ne_lines * ne_columns))) return false;
+
+	memcpy(capture + first * ne_columns, shadow + first * ne_columns, sizeof *capture * (last - first + 1) * ne_columns);
+	capture_first = first;
+	capture_last = last;
+	capturing = true;
+	return true;
+}
+
+/* Returns a hash of the given row, or 0 if it contains unknown cells. */
+
+static uint64_t row_hash(const screen_cell * const r) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for(int x = 0; x < ne_columns; x++) {
+		if (r[x].c == SHADOW_UNKNOWN) return 0;
+		h = (h ^ (uint32_t)r[x].c) * 0x100000001b3ULL;
+		h = (h ^ r[x].attr) * 0x100000001b3ULL;
+	}
+	return h | 1;
+}
+
+/* Returns the number of cells that differ in the given rows; if b is NULL,
+   the number of cells of a that are not blank. */
+
+static int row_diff(const screen_cell * const a, const screen_cell * const b) {
+	int d = 0;
+	if (b) for(int x = 0; x < ne_columns; x++) d += a[x].c != b[x].c || a[x].attr != b[x].attr;
+	else for(int x = 0; x < ne_columns; x++) d += a[x].c != ' ' || a[x].attr != 0;
+	return d;
+}
+
+/* The approximate cost, in bytes, of scrolling a region, excluding the
+   scrolling sequences proper. */
+
+#define SCROLL_COST 24
+
+/* Returns true if moving the len rows displayed at row from to row to is
+   cheaper than outputting the differing cells. We estimate the cost of
+   both options by counting the cells that will have to be output; rows
+   uncovered by the scroll are assumed to be cleared. */
+
+static bool worth_scrolling(const int to, const int from, const int len) {
+	const int d = abs(to - from), top = to < from ? to : from;
+	int before = 0, after = SCROLL_COST + d;
+
+	for(int i = top; i < top + len + d; i++) before += row_diff(capture + i * ne_columns, shadow + i * ne_columns);
+	for(int i = 0; i < len && after < before; i++) after += row_diff(capture + (to + i) * ne_columns, shadow + (from + i) * ne_columns);
+	for(int i = to < from ? to + len : from; i < (to < from ? from + len : to) && after < before; i++) after += row_diff(capture + i * ne_columns, NULL);
+
+	return after < before;
+}
+
+/* Scrolls the rows from top to bottom (inclusive) by n lines (see
+   ins_del_lines()). */
+
+static bool scroll_rows(const int top, const int bottom, const int n) {
+	const int saved_window = specified_window;
+	specified_window = bottom + 1;
+	const bool done = ins_del_lines(top, n);
+	specified_window = saved_window;
+	return done;
+}
+
+/* Looks for blocks of captured rows that are displayed on the terminal at a
+   different position, and moves them in place by scrolling. A block is built
+   around a row whose hash appears exactly once among the captured rows and
+   exactly once among the displayed rows, as in the ncurses hashmap
+   algorithm, and is extended in both directions as long as rows match. Only
+   blocks whose relative order is preserved are moved: first, blocks moving
+   up, from top to bottom, and then blocks moving down, from bottom to top,
+   so that no block is overwritten before being moved. */
+
+static void scroll_captured_lines(void) {
+	const int first = capture_first, n = capture_last - capture_first + 1;
+	uint64_t * const old = malloc(sizeof *old * n * 2);
+	int * const block = malloc(sizeof *block * n * 3);
+	if (!old || !block) {
+		free(old);
+		free(block);
+		return;
+	}
+	uint64_t * const new = old + n;
+
+	for(int i = 0; i < n; i++) {
+		old[i] = row_hash(shadow + (first + i) * ne_columns);
+		new[i] = row_hash(capture + (first + i) * ne_columns);
+	}
+
+	/* Each block is described by its new position, its old position and its length. */
+	int blocks = 0, last_new = -1, last_old = -1;
+
+	for(int i = 0; i < n; i++) {
+		if (i <= last_new || new[i] == 0 || new[i] == old[i]) continue;
+
+		int j = -1, count = 0;
+		for(int k = 0; k < n; k++) if (old[k] == new[i]) j = k, count++;
+		if (count != 1) continue;
+		for(int k = 0; k < n; k++) if (k != i && new[k] == new[i]) count++;
+		if (count != 1 || j <= last_old) continue;
+
+		int s = 0, e = 1;
+		while(i - s > last_new + 1 && j - s > last_old + 1 && new[i - s - 1] != 0 && new[i - s - 1] == old[j - s - 1]) s++;
+		while(i + e < n && j + e < n && new[i + e] != 0 && new[i + e] == old[j + e]) e++;
+
+		if (!worth_scrolling(first + i - s, first + j - s, s + e)) continue;
+
+		block[blocks * 3] = i - s;
+		block[blocks * 3 + 1] = j - s;
+		block[blocks * 3 + 2] = s + e;
+		blocks++;
+		last_new = i + e - 1;
+		last_old = j + e - 1;
+	}
+
+	for(int b = 0; b < blocks; b++) {
+		const int to = block[b * 3], from = block[b * 3 + 1], len = block[b * 3 + 2];
+		if (to < from) scroll_rows(first + to, first + from + len - 1, to - from);
+	}
+
+	for(int b = blocks; b-- != 0;) {
+		const int to = block[b * 3], from = block[b * 3 + 1], len = block[b * 3 + 2];
+		if (to > from) scroll_rows(first + from, first + to + len - 1, to - from);
+	}
+
+	free(old);
+	free(block);
+}
+
+/* Stops capturing, scrolls the terminal so to move in place blocks of rows
+   that are already displayed, and outputs the captured rows, sending just
+   the cells that differ from the shadow screen. */
+
+void flush_captured_lines(void) {
+	assert(capturing);
+	capturing = false;
+	if (shadow_lines != ne_lines || shadow_columns != ne_columns) return;
+
+	scroll_captured_lines();
+
+	const bool saved_standout = standout_wanted, saved_underline = underline_wanted;
+
+	for(int row = capture_first; row <= capture_last; row++) {
+		screen_cell * const r = shadow + row * ne_columns;
+		const screen_cell * const n = capture + row * ne_columns;
+
+		/* Trailing blanks are cleared, if necessary, using clear_to_eol(). */
+		int end = ne_columns;
+		while(end > 0 && n[end - 1].c == ' ' && n[end - 1].attr == 0) end--;
+
+		for(int x = 0; x < end;) {
+			const int w = x + 1 < ne_columns && n[x + 1].c == SHADOW_WIDE ? 2 : 1;
+			if (n[x].c < 0 || n[x].c == r[x].c && n[x].attr == r[x].attr && (w == 1 || r[x + 1].c == SHADOW_WIDE)) {
+				x += w;
+				continue;
+			}
+			cur_row = row;
+			cur_col = x;
+			standout_wanted = n[x].attr & SHADOW_STANDOUT;
+			underline_wanted = n[x].attr & SHADOW_UNDERLINE;
+			draw_cell(r, n[x].c, w, (uint32_t)n[x].attr, n[x].attr & (SHADOW_STANDOUT | SHADOW_UNDERLINE));
+			x += w;
+		}
+
+		if (end < ne_columns) {
+			cur_row = row;
+			cur_col = end;
+			standout_wanted = underline_wanted = false;
+			clear_to_eol();
+		}
+	}
+
+	standout_wanted = saved_standout;
+	underline_wanted = saved_underline;
+}
+
+
 extern int cost;  /* In cm.c */
 extern int evalcost(int);
 
@@ -1169,6 +1938,10 @@ void copy_caps(void) {
 	ne_enter_dim_mode = enter_dim_mode;
 	ne_enter_reverse_mode = enter_reverse_mode;
 	ne_exit_attribute_mode = exit_attribute_mode;
+
+	/* Synchronized output is an extended capability. */
+	const char * const sync = tigetstr("Sync");
+	sync_output_ok = sync && sync != (char *)-1;
 }
 
 
@@ -1283,4 +2056,8 @@ void term_init (void) {
 	cursor_on_off_ok = (ne_cursor_invisible && ne_cursor_normal);
 
 	color_ok = (ne_set_foreground && ne_set_background);
+
+#ifndef PLAIN_SET_ATTR
+	check_sgr();
+#endif
 }
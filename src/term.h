@@ -22,6 +22,8 @@
 #include <stdbool.h>
 
 int output_width(int c);
+int frame_putc(int c);
+void flush_frame(void);
 void ring_bell(void);
 void do_flash(void);
 void turn_off_bracketed_paste(void);
@@ -49,5 +51,7 @@ void insert_chars(const char *start, const uint32_t *attr, int raw_len, bool utf
 void insert_char(int c, const uint32_t attr, bool utf8);
 void delete_chars(int n);
 int ins_del_lines(int vpos, int n);
+bool capture_lines(int first, int last);
+void flush_captured_lines(void);
 int ttysize(void);
 void term_init(void);
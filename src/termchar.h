@@ -220,6 +220,14 @@ extern uint32_t curr_attr;
 #define BPASTE_BEGIN_SEQ    "\x1b[200~"
 #define BPASTE_END_SEQ      "\x1b[201~"
 extern bool  bracketed_paste_ok;
+
+/* If the terminal supports synchronized output (the Sync extended terminfo
+   capability), each frame is enclosed between SYNC_BEGIN_SEQ and SYNC_END_SEQ,
+   so that the terminal displays it atomically. */
+
+#define SYNC_BEGIN_SEQ      "\x1b[?2026h"
+#define SYNC_END_SEQ        "\x1b[?2026l"
+extern bool  sync_output_ok;
 extern char *bpaste_macro_before;
 extern char *bpaste_macro_after;
 
@@ -0,0 +1,398 @@
+/* Trigram index for searches in large documents.
+
+   Copyright (C) 2026 Todd M. Lewis and Sebastiano Vigna
+
+   This file is part of ne, the nice editor.
+
+   This library is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or (at your
+   option) any later version.
+
+   This library is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+   for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "ne.h"
+
+
+/* A trigram index lets repeated searches in a large document visit just a
+   small part of it. The lines of the document are partitioned into blocks
+   of consecutive lines containing about TRIGRAM_BLOCK_SIZE bytes, and for
+   each block we keep a bitmap in which the bits associated (by hashing) with
+   the trigrams occurring in the lines of the block are set. A block may
+   contain an occurrence of a pattern only if the bits of all trigrams of the
+   pattern are set, and all other blocks can be skipped. For regular
+   expressions, we use the literal that every match must contain (see dfa.c).
+
+   A bitmap is just a transposed form of the postings of its block, but its
+   size does not depend on the content of the block, and updates take
+   constant time. Bits are never cleared when text is deleted; this can only
+   cause a block to be visited needlessly, and the bitmap of a block is
+   recomputed from scratch when it grows enough to be split.
+
+   Trigrams are computed after mapping characters through fold[], which
+   identifies all characters identified by ascii_up_case or by
+   localised_up_case: in this way, the same index serves case-sensitive and
+   case-insensitive searches, whatever the encoding.
+
+   The index is built by build_trigram_index(), one block at a time, while
+   ne is waiting for a key, and only for documents larger than
+   TRIGRAM_MIN_SIZE bytes; the lines beyond the indexed prefix of the document
+   are always visited. insert_stream() and delete_stream() keep the index
+   up to date; if they fail halfway, the index is discarded (and built
+   again). */
+
+#define TRIGRAM_MIN_SIZE (16 * 1024 * 1024)
+
+/* The target size in bytes of a block. Blocks twice as large are split. */
+
+#define TRIGRAM_BLOCK_SIZE (64 * 1024)
+
+/* The base-2 logarithm of the number of bits of a block bitmap. */
+
+#define TRIGRAM_LOG2_BITS 15
+
+#define TRIGRAM_WORDS (1 << (TRIGRAM_LOG2_BITS - 6))
+
+/* The maximum number of trigrams of a pattern that we check. */
+
+#define MAX_QUERY_TRIGRAMS 16
+
+#define TRIGRAM_HASH(t) ((uint32_t)((t) * 0x9E3779B1U) >> (32 - TRIGRAM_LOG2_BITS))
+
+typedef struct {
+	line_desc *first;  /* The first line of the block. */
+	int64_t num_lines; /* The number of lines of the block. */
+	int64_t len;       /* An upper bound on the number of bytes of the block. */
+	uint64_t *bits;    /* The trigram bitmap. */
+} trigram_block;
+
+struct trigram_index {
+	trigram_block *block;
+	int64_t num_blocks, max_blocks;
+	int64_t indexed_lines;    /* The number of indexed lines, that is, the sum of the number of lines of all blocks. */
+	line_desc *next_ld;       /* The first line that has not been indexed yet, or NULL if all lines have been indexed. */
+	int64_t hint, hint_line;  /* A block and its first line, from which blocks are located. */
+};
+
+static unsigned char fold[256];
+
+/* The hashed trigrams of the pattern set by set_trigram_query(). */
+
+static struct {
+	int len;
+	uint32_t hash[MAX_QUERY_TRIGRAMS];
+} query;
+
+
+/* Computes fold[]: each character is mapped to the smallest character of its
+   class in the equivalence generated by ascii_up_case and localised_up_case. */
+
+static void init_fold(void) {
+	static bool initialized;
+	if (initialized) return;
+
+	for(int c = 0; c < 256; c++) fold[c] = c;
+
+	bool changed;
+	do {
+		changed = false;
+		for(int c = 0; c < 256; c++) {
+			const unsigned char u[] = { ascii_up_case[c], localised_up_case[c] };
+			for(int i = 0; i < 2; i++) {
+				const unsigned char m = fold[c] < fold[u[i]] ? fold[c] : fold[u[i]];
+				if (fold[c] != m || fold[u[i]] != m) {
+					fold[c] = fold[u[i]] = m;
+					changed = true;
+				}
+			}
+		}
+	} while(changed);
+
+	initialized = true;
+}
+
+
+/* Sets in the given bitmap the bits of the trigrams of the given line lying
+   within the positions from (inclusive) and to (exclusive), which may exceed
+   the line boundaries. */
+
+static void add_trigrams(uint64_t * const bits, const line_desc * const ld, int64_t from, int64_t to) {
+	if (from < 0) from = 0;
+	if (to > ld->line_len) to = ld->line_len;
+	if (to - from < 3) return;
+
+	const unsigned char *p = (const unsigned char *)ld->line + from, * const end = (const unsigned char *)ld->line + to;
+	uint32_t t = fold[p[0]] << 8 | fold[p[1]];
+	for(p += 2; p < end; p++) {
+		t = (t << 8 | fold[*p]) & 0xFFFFFF;
+		const uint32_t h = TRIGRAM_HASH(t);
+		bits[h >> 6] |= 1ULL << (h & 63);
+	}
+}
+
+
+/* Returns the index of the block containing the given (indexed) line,
+   and leaves it, with its first line, in the hint. */
+
+static int64_t find_block(struct trigram_index * const ti, const int64_t line) {
+	assert(line >= 0 && line < ti->indexed_lines);
+	int64_t i = ti->hint, start = ti->hint_line;
+	while(line < start) start -= ti->block[--i].num_lines;
+	while(line >= start + ti->block[i].num_lines) start += ti->block[i++].num_lines;
+	ti->hint = i;
+	ti->hint_line = start;
+	return i;
+}
+
+
+/* Inserts an empty block at the given index, returning false if we run out of memory. */
+
+static bool new_block(struct trigram_index * const ti, const int64_t i) {
+	if (ti->num_blocks == ti->max_blocks) {
+		const int64_t max_blocks = ti->max_blocks ? ti->max_blocks * 2 : 64;
+		trigram_block * const block = realloc(ti->block, sizeof *block * max_blocks);
+		if (!block) return false;
+		ti->block = block;
+		ti->max_blocks = max_blocks;
+	}
+
+	uint64_t * const bits = calloc(TRIGRAM_WORDS, sizeof *bits);
+	if (!bits) return false;
+
+	memmove(&ti->block[i + 1], &ti->block[i], sizeof *ti->block * (ti->num_blocks - i));
+	ti->block[i] = (trigram_block){ NULL, 0, 0, bits };
+	ti->num_blocks++;
+	return true;
+}
+
+
+/* Splits a block in two halves of approximately the same size, recomputing
+   their bitmaps from scratch. If we run out of memory, the block is left alone. */
+
+static void split_block(struct trigram_index * const ti, const int64_t i) {
+	if (ti->block[i].num_lines < 2 || !new_block(ti, i + 1)) return;
+
+	trigram_block * const a = &ti->block[i], * const c = &ti->block[i + 1];
+	const int64_t num_lines = a->num_lines;
+
+	line_desc *ld = a->first;
+	int64_t len = 0;
+	for(int64_t k = 0; k < num_lines; k++, ld = (line_desc *)ld->ld_node.next) len += ld->line_len + 1;
+
+	memset(a->bits, 0, TRIGRAM_WORDS * sizeof *a->bits);
+	a->num_lines = a->len = 0;
+	ld = a->first;
+	for(int64_t k = 0; k < num_lines; k++, ld = (line_desc *)ld->ld_node.next) {
+		trigram_block * const d = k > 0 && (a->len >= len / 2 || k == num_lines - 1 && !c->num_lines) ? c : a;
+		if (d == c && !c->num_lines) c->first = ld;
+		add_trigrams(d->bits, ld, 0, ld->line_len);
+		d->len += ld->line_len + 1;
+		d->num_lines++;
+	}
+}
+
+
+void free_trigram_index(buffer * const b) {
+	struct trigram_index * const ti = b->trigram_index;
+	if (!ti) return;
+	for(int64_t i = 0; i < ti->num_blocks; i++) free(ti->block[i].bits);
+	free(ti->block);
+	free(ti);
+	b->trigram_index = NULL;
+}
+
+
+/* Returns true if the given buffer should be (further) indexed. */
+
+bool trigram_index_pending(const buffer * const b) {
+	if (!search_index) return false;
+	if (b->trigram_index) return b->trigram_index->next_ld != NULL;
+	return b->allocated_chars - b->free_chars >= TRIGRAM_MIN_SIZE;
+}
+
+
+/* Indexes a new block of lines of the given buffer (which must satisfy
+   trigram_index_pending()). Returns false if we run out of memory. */
+
+bool build_trigram_index(buffer * const b) {
+	struct trigram_index *ti = b->trigram_index;
+	if (!ti) {
+		if (!(ti = b->trigram_index = calloc(1, sizeof *ti))) return false;
+		ti->next_ld = (line_desc *)b->line_desc_list.head;
+		init_fold();
+	}
+
+	assert(ti->next_ld != NULL);
+	if (!new_block(ti, ti->num_blocks)) return false;
+
+	trigram_block * const bl = &ti->block[ti->num_blocks - 1];
+	line_desc *ld = bl->first = ti->next_ld;
+	do {
+		add_trigrams(bl->bits, ld, 0, ld->line_len);
+		bl->len += ld->line_len + 1;
+		bl->num_lines++;
+		ld = (line_desc *)ld->ld_node.next;
+	} while(ld->ld_node.next && bl->len < TRIGRAM_BLOCK_SIZE);
+
+	ti->indexed_lines += bl->num_lines;
+	ti->next_ld = ld->ld_node.next ? ld : NULL;
+	assert(ti->next_ld || ti->indexed_lines == b->num_lines);
+	return true;
+}
+
+
+/* Updates the index after len bytes, containing new_lines line
+   terminators, have been inserted in the line ld, numbered line, at
+   position pos. The insertion ends on the line line + new_lines, at position
+   end_pos. */
+
+void trigram_index_insert(buffer * const b, const int64_t line, line_desc *ld, const int64_t pos, const int64_t new_lines, const int64_t end_pos, const int64_t len) {
+	struct trigram_index * const ti = b->trigram_index;
+	if (line >= ti->indexed_lines) return;
+
+	const int64_t i = find_block(ti, line);
+	trigram_block * const bl = &ti->block[i];
+	bl->num_lines += new_lines;
+	bl->len += len;
+	ti->indexed_lines += new_lines;
+
+	for(int64_t k = 0; k <= new_lines; k++, ld = (line_desc *)ld->ld_node.next)
+		add_trigrams(bl->bits, ld, k == 0 ? pos - 2 : 0, k == new_lines ? end_pos + 2 : ld->line_len);
+
+	if (bl->len > 2 * TRIGRAM_BLOCK_SIZE) split_block(ti, i);
+}
+
+
+/* Updates the index after some bytes have been deleted from the line ld,
+   numbered line, at position pos, joining to it the following removed_lines
+   lines (which are no longer in the buffer). */
+
+void trigram_index_delete(buffer * const b, const int64_t line, line_desc * const ld, const int64_t pos, int64_t removed_lines) {
+	struct trigram_index * const ti = b->trigram_index;
+	if (line >= ti->indexed_lines) return;
+
+	const int64_t i = find_block(ti, line);
+	trigram_block * const bl = &ti->block[i];
+	const int64_t n = removed_lines < ti->hint_line + bl->num_lines - 1 - line ? removed_lines : ti->hint_line + bl->num_lines - 1 - line;
+
+	/* If we joined lines from the following blocks, their content must be added to this block. */
+	add_trigrams(bl->bits, ld, pos - 2, n < removed_lines ? ld->line_len : pos + 2);
+	bl->num_lines -= n;
+	ti->indexed_lines -= n;
+	removed_lines -= n;
+
+	/* The following blocks lose their first lines, or disappear. */
+	line_desc * const next_ld = (line_desc *)ld->ld_node.next;
+	int64_t j = i + 1;
+	for(; removed_lines && j < ti->num_blocks && removed_lines >= ti->block[j].num_lines; j++) {
+		removed_lines -= ti->block[j].num_lines;
+		ti->indexed_lines -= ti->block[j].num_lines;
+		free(ti->block[j].bits);
+	}
+	if (removed_lines && j < ti->num_blocks) {
+		ti->block[j].num_lines -= removed_lines;
+		ti->block[j].first = next_ld;
+		ti->indexed_lines -= removed_lines;
+		removed_lines = 0;
+	}
+
+	memmove(&ti->block[i + 1], &ti->block[j], sizeof *ti->block * (ti->num_blocks - j));
+	ti->num_blocks -= j - (i + 1);
+
+	/* If some lines are left, the first line that was not indexed has been removed. */
+	if (removed_lines) {
+		assert(ti->indexed_lines == line + 1);
+		ti->next_ld = next_ld->ld_node.next ? next_ld : NULL;
+	}
+}
+
+
+/* Sets the pattern used by skip_trigram_blocks(). Returns false if the
+   pattern is too short to make use of the index. */
+
+bool set_trigram_query(const char * const pattern, const int len) {
+	if (len < 3) return false;
+	init_fold();
+
+	/* If the pattern is long, we pick MAX_QUERY_TRIGRAMS evenly spaced trigrams. */
+	const int n = len - 2;
+	query.len = n < MAX_QUERY_TRIGRAMS ? n : MAX_QUERY_TRIGRAMS;
+	for(int i = 0; i < query.len; i++) {
+		const unsigned char * const p = (const unsigned char *)pattern + (query.len == 1 ? 0 : (int64_t)i * (n - 1) / (query.len - 1));
+		query.hash[i] = TRIGRAM_HASH((uint32_t)fold[p[0]] << 16 | fold[p[1]] << 8 | fold[p[2]]);
+	}
+	return true;
+}
+
+
+static bool may_contain_query(const trigram_block * const bl) {
+	for(int i = 0; i < query.len; i++)
+		if (!(bl->bits[query.hash[i] >> 6] & 1ULL << (query.hash[i] & 63))) return false;
+	return true;
+}
+
+
+/* Given the line ld, numbered *y, which a search (backwards, if back is true)
+   is about to visit, moves *y to the nearest line in the search direction
+   that might contain the pattern set by set_trigram_query(), and returns its
+   descriptor. *start and *end are set to a range of lines (including *y)
+   that must be visited without calling this function again. If no line in
+   the search direction might contain the pattern, *y becomes the last (or
+   first) line of the buffer. */
+
+line_desc *skip_trigram_blocks(buffer * const b, line_desc *ld, int64_t * const y, const bool back, int64_t * const start, int64_t * const end) {
+	struct trigram_index * const ti = b->trigram_index;
+
+	if (*y >= ti->indexed_lines) {
+		*start = ti->indexed_lines;
+		*end = b->num_lines;
+		return ld;
+	}
+
+	const int64_t i = find_block(ti, *y);
+	int64_t j = i, first = ti->hint_line;
+
+	if (!back) {
+		while(j < ti->num_blocks && !may_contain_query(&ti->block[j])) first += ti->block[j++].num_lines;
+
+		if (j < ti->num_blocks) {
+			*start = first;
+			*end = first + ti->block[j].num_lines;
+			if (j == i) return ld;
+			*y = first;
+			return ti->block[j].first;
+		}
+
+		if (ti->next_ld) {
+			*start = *y = ti->indexed_lines;
+			*end = b->num_lines;
+			return ti->next_ld;
+		}
+
+		*start = *y = b->num_lines - 1;
+		*end = b->num_lines;
+		return (line_desc *)b->line_desc_list.tail_pred;
+	}
+	else {
+		while(j >= 0 && !may_contain_query(&ti->block[j])) if (--j >= 0) first -= ti->block[j].num_lines;
+
+		if (j >= 0) {
+			*start = first;
+			*end = first + ti->block[j].num_lines;
+			if (j == i) return ld;
+			*y = *end - 1;
+			return (line_desc *)ti->block[j + 1].first->ld_node.prev;
+		}
+
+		*start = *y = 0;
+		*end = 1;
+		return (line_desc *)b->line_desc_list.head;
+	}
+}